@@ -0,0 +1,193 @@
+#include "bdd.hpp"
+#include <string>
+#include <unordered_set>
+
+//terminals sort below every variable
+static const uint32_t terminal_var = UINT32_MAX;
+
+BddManager::BddManager() {
+	nodes.push_back({terminal_var, False, False});
+	nodes.push_back({terminal_var, True, True});
+}
+
+bdd BddManager::Make(uint32_t var, bdd low, bdd high) {
+	if (low == high) return low;
+	
+	const bdd_node n = {var, low, high};
+	auto it = unique.find(n);
+	if (it != unique.end()) return it->second;
+	
+	nodes.push_back(n);
+	const bdd f = nodes.size() - 1;
+	unique.emplace(n, f);
+	return f;
+}
+
+bdd BddManager::Ite(bdd f, bdd g, bdd h) {
+	if (f == True) return g;
+	if (f == False) return h;
+	if (g == h) return g;
+	if (g == True && h == False) return f;
+	
+	const bdd_node key = {h, f, g};
+	auto it = ite_cache.find(key);
+	if (it != ite_cache.end()) return it->second;
+	
+	const uint32_t var = min({Top(f), Top(g), Top(h)});
+	auto Low = [this, var](bdd x) { return Top(x) == var ? nodes[x].low : x; };
+	auto High = [this, var](bdd x) { return Top(x) == var ? nodes[x].high : x; };
+	
+	const bdd low = Ite(Low(f), Low(g), Low(h));
+	const bdd high = Ite(High(f), High(g), High(h));
+	const bdd r = Make(var, low, high);
+	ite_cache.emplace(key, r);
+	return r;
+}
+
+bool BddManager::Eval(bdd f, const vector<bool>& input) const {
+	while (f > True) {
+		const bdd_node& n = nodes[f];
+		f = (n.var < input.size() && input[n.var]) ? n.high : n.low;
+	}
+	return f == True;
+}
+
+double BddManager::Fraction(bdd f) const {
+	unordered_map<bdd, double> memo = {{False, 0.0}, {True, 1.0}};
+	
+	function<double(bdd)> Visit = [&](bdd x) -> double {
+		auto it = memo.find(x);
+		if (it != memo.end()) return it->second;
+		const double p = (Visit(nodes[x].low) + Visit(nodes[x].high)) / 2;
+		memo.emplace(x, p);
+		return p;
+	};
+	return Visit(f);
+}
+
+size_t BddManager::Size(bdd f) const {
+	unordered_set<bdd> seen = {f};
+	vector<bdd> stack = {f};
+	
+	while (!stack.empty()) {
+		const bdd x = stack.back();
+		stack.pop_back();
+		if (x <= True) continue;
+		
+		for (bdd c : {nodes[x].low, nodes[x].high})
+			if (seen.insert(c).second) stack.push_back(c);
+	}
+	return seen.size();
+}
+
+void BddManager::Dot(ostream& out, const vector<pair<string, bdd>>& roots) const {
+	out << "digraph bdd {\n";
+	out << "\tn0 [shape=box, label=\"0\"];\n";
+	out << "\tn1 [shape=box, label=\"1\"];\n";
+	
+	unordered_set<bdd> seen = {False, True};
+	vector<bdd> stack;
+	for (auto& [name, f] : roots) {
+		out << "\t\"" << name << "\" [shape=plaintext];\n";
+		out << "\t\"" << name << "\" -> n" << f << ";\n";
+		if (seen.insert(f).second) stack.push_back(f);
+	}
+	
+	while (!stack.empty()) {
+		const bdd x = stack.back();
+		stack.pop_back();
+		const bdd_node& n = nodes[x];
+		
+		out << "\tn" << x << " [label=\"x" << n.var << "\"];\n";
+		out << "\tn" << x << " -> n" << n.low << " [style=dashed];\n";
+		out << "\tn" << x << " -> n" << n.high << ";\n";
+		for (bdd c : {n.low, n.high})
+			if (seen.insert(c).second) stack.push_back(c);
+	}
+	out << "}\n";
+}
+
+
+// Symbolic simulation
+
+//a board state together with the inputs that lead to it
+struct symbolic_state {
+	FlatRunner runner;
+	bdd guard;
+	vector<bdd> outputs; //output k is 1
+};
+
+//states with equal keys behave the same from here on, except for the outputs
+//already produced, so they are merged. Positions of marbles that have left a
+//grid are reset when the next marble enters it and are not part of the key
+static string StateKey(const symbolic_state& s) {
+	const vector<int8_t>& bits = s.runner.Bits();
+	string key(bits.begin(), bits.end());
+	
+	for (const flat_marble& m : s.runner.Marbles())
+		key += m.inside ? '1' : '0';
+	
+	const uint32_t count = s.outputs.size();
+	key.append(reinterpret_cast<const char*>(&count), sizeof(count));
+	return key;
+}
+
+bool SymbolicRun(const FlatBoard& board, int n, BddManager& manager, symbolic_result& result, uint64_t max_ticks, size_t max_states) {
+	vector<symbolic_state> states = {{FlatRunner(board), BddManager::True, {}}};
+	result.max_states = 1;
+	result.state_limit = false;
+	
+	for (int i = 0; i < n; i++) {
+		vector<symbolic_state> next;
+		unordered_map<string, size_t> index;
+		const bdd var = manager.Var(i);
+		
+		for (const symbolic_state& s : states)
+			for (bool value : {false, true}) {
+				const bdd literal = value ? var : manager.Not(var);
+				symbolic_state child = {s.runner, manager.And(s.guard, literal), {}};
+				
+				vector<bool> produced;
+				uint64_t ticks = max_ticks;
+				if (!child.runner.Drop(value, produced, ticks)) return true;
+				
+				child.outputs.reserve(s.outputs.size() + produced.size());
+				for (bdd o : s.outputs)
+					child.outputs.push_back(manager.And(o, literal));
+				for (bool o : produced)
+					child.outputs.push_back(o ? child.guard : BddManager::False);
+				
+				auto [it, inserted] = index.emplace(StateKey(child), next.size());
+				if (inserted) {
+					if (next.size() == max_states) {
+						result.state_limit = true;
+						return true;
+					}
+					next.push_back(move(child));
+					continue;
+				}
+				
+				symbolic_state& merged = next[it->second];
+				merged.guard = manager.Or(merged.guard, child.guard);
+				for (size_t k = 0; k < merged.outputs.size(); k++)
+					merged.outputs[k] = manager.Or(merged.outputs[k], child.outputs[k]);
+			}
+		
+		states = move(next);
+		result.max_states = max(result.max_states, states.size());
+	}
+	
+	result.present.clear();
+	result.value.clear();
+	for (const symbolic_state& s : states) {
+		if (s.outputs.size() > result.value.size()) {
+			result.present.resize(s.outputs.size(), BddManager::False);
+			result.value.resize(s.outputs.size(), BddManager::False);
+		}
+		for (size_t k = 0; k < s.outputs.size(); k++) {
+			result.present[k] = manager.Or(result.present[k], s.guard);
+			result.value[k] = manager.Or(result.value[k], s.outputs[k]);
+		}
+	}
+	return false;
+}
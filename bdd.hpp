@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <iostream>
+#include "flat.hpp"
+
+using namespace std;
+
+//reduced ordered binary decision diagrams, variable 0 is tested first
+typedef uint32_t bdd;
+
+struct bdd_node {
+	uint32_t var;
+	bdd low, high;
+	
+	bool operator==(const bdd_node& o) const { return var == o.var && low == o.low && high == o.high; }
+};
+
+struct BddNodeHash {
+	size_t operator()(const bdd_node& n) const {
+		uint64_t x = (static_cast<uint64_t>(n.low) << 32) | n.high;
+		return hash<uint64_t>{}(x * 31 + n.var);
+	}
+};
+
+class BddManager {
+private:
+	vector<bdd_node> nodes;
+	unordered_map<bdd_node, bdd, BddNodeHash> unique;
+	unordered_map<bdd_node, bdd, BddNodeHash> ite_cache; //var holds the third operand
+	
+	bdd Make(uint32_t var, bdd low, bdd high);
+	uint32_t Top(bdd f) const { return nodes[f].var; }
+	
+public:
+	static constexpr bdd False = 0, True = 1;
+	
+	BddManager();
+	
+	bdd Var(uint32_t var) { return Make(var, False, True); }
+	bdd Ite(bdd f, bdd g, bdd h);
+	bdd Not(bdd f) { return Ite(f, False, True); }
+	bdd And(bdd f, bdd g) { return Ite(f, g, False); }
+	bdd Or(bdd f, bdd g) { return Ite(f, True, g); }
+	bdd Xor(bdd f, bdd g) { return Ite(f, Not(g), g); }
+	
+	bool Eval(bdd f, const vector<bool>& input) const;
+	//share of all assignments for which f is true
+	double Fraction(bdd f) const;
+	//nodes reachable from f, terminals included
+	size_t Size(bdd f) const;
+	size_t Nodes(void) const { return nodes.size(); }
+	
+	//graphviz drawing of the given functions
+	void Dot(ostream& out, const vector<pair<string, bdd>>& roots) const;
+};
+
+
+// Symbolic simulation
+
+//boolean function of a board for inputs of a fixed length, input bit i is variable i
+struct symbolic_result {
+	vector<bdd> present; //output k exists
+	vector<bdd> value;   //output k exists and is 1
+	size_t max_states;   //most distinct board states after one marble
+	bool state_limit;    //stopped because there were more than max_states
+};
+
+//runs all inputs of n bits at once. Only the inputs are symbolic, bit states are not:
+//each distinct state of the bits is followed on its own, so a board whose bits depend
+//on the input, like a counter, can need up to 2^n states. Returns true if a marble
+//did not leave the board within max_ticks, or if more than max_states states were
+//reached after some marble, which sets state_limit
+bool SymbolicRun(const FlatBoard& board, int n, BddManager& manager, symbolic_result& result, uint64_t max_ticks = 10000000,
+	size_t max_states = SIZE_MAX);
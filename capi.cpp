@@ -0,0 +1,128 @@
+#include <cstring>
+#include <cstdio>
+#include "tumble.h"
+#include "tumble.hpp"
+#include "flat.hpp"
+
+using namespace std;
+
+//boards run on FlatRunner, with the same ticks as Grid
+struct tumble_board {
+	FlatBoard board;
+	uint64_t hash; //ContentHash() of the text, snapshots are only restored on the same board
+};
+
+struct tumble_machine {
+	const tumble_board* board;
+	FlatRunner runner;
+	vector<bool> outputs;
+	size_t read = 0; //outputs before this were read
+	
+	explicit tumble_machine(const tumble_board* board) : board(board), runner(board->board) {}
+};
+
+static void SetError(tumble_error* err, int line, int column, const string& message) {
+	if (err == nullptr) return;
+	err->line = line, err->column = column;
+	snprintf(err->message, sizeof(err->message), "%s", message.c_str());
+}
+
+int tumble_api_version(void) {
+	return TUMBLE_API_VERSION;
+}
+
+
+// Boards
+
+tumble_board* tumble_board_load(const char* text, size_t size, tumble_error* err) {
+	Grid g;
+	Scanner in(text, text + size);
+	if (g.Deserialize(in)) {
+		SetError(err, in.error.line, in.error.column, in.error.message);
+		return nullptr;
+	}
+	
+	tumble_board* board = new tumble_board;
+	board->board.Build(g);
+	board->hash = ContentHash(string(text, size));
+	return board;
+}
+
+tumble_board* tumble_board_load_file(const char* path, tumble_error* err) {
+	string text;
+	if (ReadBoardFile(path, text)) {
+		SetError(err, 0, 0, string("could not read \"") + path + "\"");
+		return nullptr;
+	}
+	return tumble_board_load(text.data(), text.size(), err);
+}
+
+void tumble_board_free(tumble_board* board) {
+	delete board;
+}
+
+
+// Machines
+
+tumble_machine* tumble_machine_new(const tumble_board* board) {
+	return new tumble_machine(board);
+}
+
+void tumble_machine_free(tumble_machine* m) {
+	delete m;
+}
+
+void tumble_machine_reset(tumble_machine* m) {
+	m->runner.Reset();
+	m->outputs.clear();
+	m->read = 0;
+}
+
+int tumble_machine_feed(tumble_machine* m, const uint8_t* bits, size_t count, uint64_t max_ticks) {
+	uint64_t ticks = max_ticks;
+	for (size_t i = 0; i < count; i++)
+		if (!m->runner.Drop(bits[i] != 0, m->outputs, ticks)) return 1;
+	return 0;
+}
+
+size_t tumble_machine_pending(const tumble_machine* m) {
+	return m->outputs.size() - m->read;
+}
+
+size_t tumble_machine_read(tumble_machine* m, uint8_t* out, size_t size) {
+	size_t n = 0;
+	for (; n < size && m->read < m->outputs.size(); n++)
+		out[n] = m->outputs[m->read++];
+	
+	if (m->read == m->outputs.size()) {
+		m->outputs.clear();
+		m->read = 0;
+	}
+	return n;
+}
+
+
+// Snapshots
+
+//host byte order: magic and board hash, then FlatRunner::Save()
+static const uint32_t snapshot_magic = 0x54545331; //"TTS1"
+static const size_t snapshot_header = 4 + 8;
+
+size_t tumble_machine_snapshot(const tumble_machine* m, void* buf, size_t size) {
+	string data;
+	data.append(reinterpret_cast<const char*>(&snapshot_magic), sizeof(snapshot_magic));
+	data.append(reinterpret_cast<const char*>(&m->board->hash), sizeof(m->board->hash));
+	m->runner.Save(data);
+	if (size >= data.size()) memcpy(buf, data.data(), data.size());
+	return data.size();
+}
+
+int tumble_machine_restore(tumble_machine* m, const void* buf, size_t size) {
+	if (size < snapshot_header) return 1;
+	uint32_t magic;
+	uint64_t hash;
+	memcpy(&magic, buf, sizeof(magic));
+	memcpy(&hash, static_cast<const uint8_t*>(buf) + sizeof(magic), sizeof(hash));
+	if (magic != snapshot_magic || hash != m->board->hash) return 1;
+	return m->runner.Load(static_cast<const uint8_t*>(buf) + snapshot_header, size - snapshot_header) ? 1 : 0;
+}
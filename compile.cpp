@@ -0,0 +1,272 @@
+// ttsim-compile: turns a board into a self-contained C++ source file
+//
+// Every grid instance becomes a function with a switch over marble positions,
+// tile behavior and gear turns are resolved here so the generated code only
+// moves the marble and flips bits. The generated file exports
+//
+//   extern "C" int <prefix>_run(const uint8_t* input, size_t n, uint8_t* output,
+//                               size_t* n_output, uint64_t max_ticks);
+//
+// which behaves like Grid::Run(). n_output holds the capacity of output on
+// entry and the number of outputs on return, which can be more than the
+// capacity: only that many are stored and the caller runs again with more room.
+// The result is 0 if max_ticks was reached. Compiling it with -DTTSIM_MAIN adds
+// a main() reading one input per line from stdin.
+
+#include <iostream>
+#include <fstream>
+#include <map>
+#include "tumble.hpp"
+#include "flat.hpp"
+
+using namespace std;
+
+static void EmitFlips(ostream& out, const FlatBoard& b, int32_t turn, const string& indent) {
+	const flat_turn& t = b.turns[turn];
+	
+	//flips of the same word are merged into one xor
+	map<uint32_t, uint64_t> masks;
+	for (uint32_t i = t.begin; i < t.end; i++) {
+		const uint32_t bit = b.turn_bits[i];
+		masks[bit / 64] ^= 1ull << (bit % 64);
+	}
+	for (auto [word, mask] : masks)
+		if (mask) out << indent << "s.bits[" << word << "] ^= 0x" << hex << mask << dec << "ull;\n";
+	if (t.parent) out << indent << "r.turn_parent = true;\n";
+}
+
+static void EmitBitCollide(ostream& out, const flat_tile& t, const string& indent) {
+	if (t.arg < 0) {
+		out << indent << "m.dir = " << int(t.dir) << ";\n";
+		return;
+	}
+	const uint32_t word = t.arg / 64, shift = t.arg % 64;
+	out << indent << "m.dir = (s.bits[" << word << "] >> " << shift << " & 1) ? 1 : -1;\n";
+	out << indent << "s.bits[" << word << "] ^= 1ull << " << shift << ";\n";
+}
+
+static void EmitTile(ostream& out, const FlatBoard& b, const flat_tile& t) {
+	const string in = "\t\t\t";
+	
+	switch (t.type) {
+		case TILE_RAMP:
+			out << in << "m.dir = " << int(t.dir) << ";\n";
+			out << in << "return !m.active;\n";
+			break;
+		case TILE_OUTPUT_VALUE:
+			out << in << "r.output = (m.color == " << COLOR_BLUE << " ? 0 : m.color == " << COLOR_RED << " ? 1 : -1);\n";
+			out << in << "return !m.active;\n";
+			break;
+		case TILE_OUTPUT_DIRECTION:
+			out << in << "r.output = (m.dir > 0 ? 1 : 0);\n";
+			out << in << "return !m.active;\n";
+			break;
+		case TILE_EXIT:
+			out << in << "r.exit_tile = true;\n";
+			out << in << "return true;\n";
+			break;
+		case TILE_LOOP:
+			out << in << "r.marble_reset = true;\n";
+			out << in << "tt_start(m, m.dir, " << t.color << ");\n";
+			out << in << "return !root;\n";
+			break;
+		case TILE_BIT:
+			EmitBitCollide(out, t, in);
+			out << in << "return !m.active;\n";
+			break;
+		case TILE_GEARBIT:
+			EmitBitCollide(out, t, in);
+			out << in << "if (!m.active) return true;\n";
+			EmitFlips(out, b, t.turn, in);
+			out << in << "return false;\n";
+			break;
+		case TILE_GRID:
+			out << in << "tt_marble& inner = s.m[" << t.arg << "];\n";
+			out << in << "r.inside_tile = true;\n";
+			out << in << "if (!inner.inside) {\n";
+			out << in << "\tinner.inside = true;\n";
+			out << in << "\ttt_start(inner, m.dir, m.color);\n";
+			out << in << "}\n";
+			out << in << "tt_result ir;\n";
+			out << in << "bool done = tt_update_" << t.arg << "(s, ir, false);\n";
+			out << in << "if (done) {\n";
+			out << in << "\tif (ir.exit_tile) done = false;\n";
+			out << in << "\tr.inside_tile = false;\n";
+			out << in << "\tinner.inside = false;\n";
+			out << in << "\tm.color = inner.color;\n";
+			out << in << "\tm.dir = (inner.dir >= 0 ? 1 : -1);\n";
+			out << in << "\tm.active = true;\n";
+			out << in << "}\n";
+			out << in << "if (ir.marble_reset) {\n";
+			out << in << "\tr.marble_reset = true;\n";
+			out << in << "\ttt_start(m, inner.dir, inner.color);\n";
+			out << in << "}\n";
+			out << in << "r.output = ir.output;\n";
+			out << in << "if (!m.active && !r.inside_tile) return true;\n";
+			out << in << "if (r.inside_tile) m.active = false;\n";
+			out << in << "if (ir.turn_parent) {\n";
+			out << in << "\tr.turn = true;\n";
+			EmitFlips(out, b, t.turn, in + "\t");
+			out << in << "}\n";
+			out << in << "if (r.marble_reset && root) done = false;\n";
+			out << in << "return done;\n";
+			break;
+		default: //drop, cross and gear do nothing
+			out << in << "return !m.active;\n";
+			break;
+	}
+}
+
+static void Emit(ostream& out, const FlatBoard& b, const string& source, const string& prefix) {
+	const size_t words = max<size_t>(1, (b.initial_bits.size() + 63) / 64);
+	
+	out << "// Generated by ttsim-compile from \"" << source << "\", do not edit\n";
+	out << "#include <cstdint>\n#include <cstddef>\n\n";
+	out << "namespace {\n\n";
+	out << "struct tt_marble { int x, y, dir; short color; bool active, inside; };\n";
+	out << "struct tt_result { int output; bool marble_reset, turn, turn_parent, inside_tile, exit_tile; };\n";
+	out << "struct tt_state { uint64_t bits[" << words << "]; tt_marble m[" << b.grids.size() << "]; };\n\n";
+	
+	out << "const uint64_t tt_initial[" << words << "] = {";
+	for (size_t w = 0; w < words; w++) {
+		uint64_t v = 0;
+		for (size_t i = w * 64; i < min(b.initial_bits.size(), (w + 1) * 64); i++)
+			if (b.initial_bits[i] > 0) v |= 1ull << (i % 64);
+		out << (w ? ", " : "") << "0x" << hex << v << dec << "ull";
+	}
+	out << "};\n\n";
+	
+	out << "inline void tt_start(tt_marble& m, int dir, short color) {\n";
+	out << "\tm.active = true;\n\tm.dir = dir;\n\tm.color = color;\n\tm.x = 0, m.y = 0;\n}\n\n";
+	
+	for (size_t gi = 0; gi < b.grids.size(); gi++)
+		out << "bool tt_update_" << gi << "(tt_state& s, tt_result& r, bool root);\n";
+	out << "\n";
+	
+	for (size_t gi = 0; gi < b.grids.size(); gi++) {
+		const flat_grid& g = b.grids[gi];
+		out << "bool tt_update_" << gi << "(tt_state& s, tt_result& r, bool root) {\n";
+		out << "\tr.output = -1;\n";
+		out << "\tr.marble_reset = r.turn = r.turn_parent = r.inside_tile = r.exit_tile = false;\n";
+		out << "\ttt_marble& m = s.m[" << gi << "];\n";
+		out << "\tif (m.active) m.x += m.dir, m.y++;\n\n";
+		
+		//the tile positions are not kept in flat_tile, recover them from the table
+		vector<pair<pair<int, int>, uint32_t>> placed;
+		for (uint32_t si = g.slot_begin; si <= g.slot_begin + g.slot_mask; si++)
+			if (b.slots[si].tile >= 0)
+				placed.push_back({{b.slots[si].y, b.slots[si].x}, static_cast<uint32_t>(b.slots[si].tile)});
+		sort(placed.begin(), placed.end());
+		
+		out << "\tswitch (m.y) {\n";
+		for (size_t i = 0; i < placed.size(); ) {
+			const int y = placed[i].first.first;
+			out << "\tcase " << y << ":\n\t\tswitch (m.x) {\n";
+			for (; i < placed.size() && placed[i].first.first == y; i++) {
+				out << "\t\tcase " << placed[i].first.second << ": {\n";
+				EmitTile(out, b, b.tiles[placed[i].second]);
+				out << "\t\t}\n";
+			}
+			out << "\t\tdefault:\n\t\t\treturn true;\n\t\t}\n";
+		}
+		out << "\tdefault:\n\t\treturn true;\n\t}\n}\n\n";
+	}
+	out << "} //namespace\n\n";
+	
+	out << "extern \"C\" int " << prefix << "_run(const uint8_t* input, size_t n, uint8_t* output, size_t* n_output, uint64_t max_ticks) {\n";
+	out << "\ttt_state s;\n";
+	out << "\tfor (size_t i = 0; i < " << words << "; i++) s.bits[i] = tt_initial[i];\n";
+	out << "\tfor (tt_marble& m : s.m) m = {0, 0, -1, " << COLOR_WHITE << ", false, false};\n";
+	out << "\tconst size_t capacity = *n_output;\n";
+	out << "\tsize_t count = 0, next = 0;\n";
+	out << "\t*n_output = 0;\n";
+	out << "\tif (n == 0) return 1;\n\n";
+	out << "\ttt_start(s.m[0], input[0] ? 1 : -1, input[0] ? " << COLOR_RED << " : " << COLOR_BLUE << ");\n";
+	out << "\tnext = 1;\n";
+	out << "\tfor (uint64_t tick = 0; tick < max_ticks; tick++) {\n";
+	out << "\t\ttt_result r;\n";
+	out << "\t\tconst bool add_marble = tt_update_0(s, r, true);\n";
+	out << "\t\tif (r.output >= 0) {\n";
+	out << "\t\t\tif (count < capacity) output[count] = (r.output > 0);\n";
+	out << "\t\t\tcount++;\n";
+	out << "\t\t}\n";
+	out << "\t\tif (add_marble) {\n";
+	out << "\t\t\tif (next >= n) {\n";
+	out << "\t\t\t\t*n_output = count;\n";
+	out << "\t\t\t\treturn 1;\n";
+	out << "\t\t\t}\n";
+	out << "\t\t\ttt_start(s.m[0], input[next] ? 1 : -1, input[next] ? " << COLOR_RED << " : " << COLOR_BLUE << ");\n";
+	out << "\t\t\tnext++;\n";
+	out << "\t\t}\n";
+	out << "\t}\n";
+	out << "\t*n_output = count;\n";
+	out << "\treturn 0;\n";
+	out << "}\n\n";
+	
+	out << "#ifdef TTSIM_MAIN\n";
+	out << "#include <iostream>\n#include <string>\n#include <vector>\n\n";
+	out << "int main() {\n";
+	out << "\tstd::string line;\n";
+	out << "\twhile (std::getline(std::cin, line)) {\n";
+	out << "\t\tstd::vector<uint8_t> input;\n";
+	out << "\t\tfor (char c : line)\n";
+	out << "\t\t\tif (c == '0' || c == '1') input.push_back(c == '1');\n";
+	out << "\t\tstd::vector<uint8_t> output(1 << 16);\n";
+	out << "\t\tsize_t n_output = output.size();\n";
+	out << "\t\tint finished = " << prefix << "_run(input.data(), input.size(), output.data(), &n_output, 10000000);\n";
+	out << "\t\tif (n_output > output.size()) {\n";
+	out << "\t\t\t//the run is deterministic, run it again with room for every output\n";
+	out << "\t\t\toutput.resize(n_output);\n";
+	out << "\t\t\tfinished = " << prefix << "_run(input.data(), input.size(), output.data(), &n_output, 10000000);\n";
+	out << "\t\t}\n";
+	out << "\t\tfor (size_t i = 0; i < n_output; i++) std::cout << (output[i] ? '1' : '0');\n";
+	out << "\t\tstd::cout << (finished ? \"\" : \" (tick limit)\") << std::endl;\n";
+	out << "\t}\n";
+	out << "\treturn 0;\n";
+	out << "}\n";
+	out << "#endif\n";
+}
+
+int main(int argc, char** argv) {
+	string input, output, prefix = "ttsim";
+	
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "-o" && i + 1 < argc)
+			output = argv[++i];
+		else if (arg == "-p" && i + 1 < argc)
+			prefix = argv[++i];
+		else if (input.empty() && arg[0] != '-')
+			input = arg;
+		else {
+			input.clear();
+			break;
+		}
+	}
+	if (input.empty()) {
+		cerr << "usage: " << argv[0] << " board.ttsim [-o out.cpp] [-p prefix]" << endl;
+		return 1;
+	}
+	
+	Grid g;
+	parse_error err;
+	if (LoadGrid(g, input, err)) {
+		cerr << input << ":" << err.line << ":" << err.column << ": " << err.message << endl;
+		return 1;
+	}
+	
+	FlatBoard board(g);
+	
+	if (output.empty()) {
+		Emit(cout, board, input, prefix);
+		return 0;
+	}
+	
+	ofstream out(output);
+	if (!out.is_open()) {
+		cerr << "Could not open \"" << output << "\"" << endl;
+		return 1;
+	}
+	Emit(out, board, input, prefix);
+	return out.fail() ? 1 : 0;
+}
@@ -0,0 +1,297 @@
+// ttsim-daemon: keeps boards loaded in memory and evaluates them for local clients
+//
+// Protocol (host byte order, one request/reply pair at a time per connection):
+//   request: uint8 op, uint32 payload size, payload
+//   reply:   uint8 status (0 = ok, 1 = error), uint32 payload size, payload
+//
+//   'L' load:   payload = .ttsim text          -> reply uint64 board id
+//   'E' eval:   payload = uint64 board id,
+//               uint32 bit count, packed bits -> reply uint32 bit count, packed bits
+//   'D' drop:   payload = uint64 board id      -> empty reply
+//
+// Bits are packed LSB first. Error replies carry a message as payload.
+// A request with a payload over -m megabytes (64 by default) gets an error reply and
+// the connection is closed, before anything is allocated for it.
+// The board id is the content hash of the board text, loading the same
+// text twice returns the same id without parsing again.
+//
+// The -j workers serve requests, not connections: an idle connection costs no
+// worker, and a client that stops halfway through a request is dropped after 10 s.
+
+#include <iostream>
+#include <cstring>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <csignal>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include "tumble.hpp"
+
+using namespace std;
+
+//loaded board with a pool of ready to run copies
+struct board_entry {
+	Grid prototype;
+	mutex pool_lock;
+	vector<unique_ptr<Grid>> idle;
+	
+	unique_ptr<Grid> Acquire(void) {
+		lock_guard<mutex> lock(pool_lock);
+		if (idle.empty())
+			return make_unique<Grid>(prototype);
+		unique_ptr<Grid> g = move(idle.back());
+		idle.pop_back();
+		return g;
+	}
+	void Release(unique_ptr<Grid> g) {
+		lock_guard<mutex> lock(pool_lock);
+		idle.push_back(move(g));
+	}
+};
+
+static shared_mutex boards_lock;
+static unordered_map<uint64_t, shared_ptr<board_entry>> boards;
+static uint64_t max_ticks = 10000000;
+static uint32_t max_payload = 64u << 20;
+
+
+// Socket helpers
+
+static bool ReadAll(int fd, void* buf, size_t n) {
+	char* p = static_cast<char*>(buf);
+	while (n > 0) {
+		ssize_t r = read(fd, p, n);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return false;
+		p += r, n -= r;
+	}
+	return true;
+}
+
+static bool WriteAll(int fd, const void* buf, size_t n) {
+	const char* p = static_cast<const char*>(buf);
+	while (n > 0) {
+		ssize_t r = write(fd, p, n);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return false;
+		p += r, n -= r;
+	}
+	return true;
+}
+
+static bool Reply(int fd, uint8_t status, const string& payload) {
+	string msg(5 + payload.size(), '\0');
+	uint32_t size = payload.size();
+	msg[0] = static_cast<char>(status);
+	memcpy(&msg[1], &size, 4);
+	memcpy(&msg[5], payload.data(), payload.size());
+	return WriteAll(fd, msg.data(), msg.size());
+}
+
+
+// Request handlers
+
+static shared_ptr<board_entry> FindBoard(uint64_t id) {
+	shared_lock<shared_mutex> lock(boards_lock);
+	auto it = boards.find(id);
+	return it == boards.end() ? nullptr : it->second;
+}
+
+static bool HandleLoad(int fd, const string& text) {
+	const uint64_t id = ContentHash(text);
+	string reply(reinterpret_cast<const char*>(&id), 8);
+	
+	if (FindBoard(id)) return Reply(fd, 0, reply);
+	
+	auto entry = make_shared<board_entry>();
+	Scanner in(text.data(), text.data() + text.size());
+	if (entry->prototype.Deserialize(in))
+		return Reply(fd, 1, "line " + to_string(in.error.line) + ", column "
+			+ to_string(in.error.column) + ": " + in.error.message);
+	entry->prototype.Reset();
+	
+	unique_lock<shared_mutex> lock(boards_lock);
+	boards.emplace(id, entry);
+	return Reply(fd, 0, reply);
+}
+
+static bool HandleEval(int fd, const string& payload) {
+	uint64_t id;
+	uint32_t count;
+	if (payload.size() < 12) return Reply(fd, 1, "malformed eval request");
+	memcpy(&id, &payload[0], 8);
+	memcpy(&count, &payload[8], 4);
+	if (payload.size() < 12 + (static_cast<size_t>(count) + 7) / 8)
+		return Reply(fd, 1, "malformed eval request");
+	
+	shared_ptr<board_entry> entry = FindBoard(id);
+	if (!entry) return Reply(fd, 1, "unknown board");
+	
+	vector<bool> input(count), output;
+	for (uint32_t i = 0; i < count; i++)
+		input[i] = (payload[12 + i / 8] >> (i % 8)) & 1;
+	
+	unique_ptr<Grid> g = entry->Acquire();
+	bool finished = g->Run(input, output, max_ticks);
+	entry->Release(move(g));
+	
+	if (!finished) return Reply(fd, 1, "tick limit reached");
+	
+	count = output.size();
+	string reply(4 + (output.size() + 7) / 8, '\0');
+	memcpy(&reply[0], &count, 4);
+	for (size_t i = 0; i < output.size(); i++)
+		if (output[i]) reply[4 + i / 8] |= static_cast<char>(1 << (i % 8));
+	return Reply(fd, 0, reply);
+}
+
+static bool HandleDrop(int fd, const string& payload) {
+	uint64_t id;
+	if (payload.size() != 8) return Reply(fd, 1, "malformed drop request");
+	memcpy(&id, payload.data(), 8);
+	
+	unique_lock<shared_mutex> lock(boards_lock);
+	if (boards.erase(id) == 0) return Reply(fd, 1, "unknown board");
+	return Reply(fd, 0, "");
+}
+
+//serves one request of a client that has sent something, returns false if the
+//connection is to be closed
+static bool Serve(int fd) {
+	char header[5];
+	uint32_t size;
+	if (!ReadAll(fd, header, 5)) return false;
+	memcpy(&size, &header[1], 4);
+	if (size > max_payload) {
+		Reply(fd, 1, "request too large");
+		return false;
+	}
+	
+	string payload(size, '\0');
+	if (!ReadAll(fd, payload.data(), size)) return false;
+	
+	switch (header[0]) {
+		case 'L': return HandleLoad(fd, payload);
+		case 'E': return HandleEval(fd, payload);
+		case 'D': return HandleDrop(fd, payload);
+		default:  return Reply(fd, 1, "unknown request");
+	}
+}
+
+
+// Worker pool
+
+//idle connections wait in epoll, one shot, and a worker takes a connection only for
+//the request it has sent, so any number of clients share the -j workers
+static int poller = -1;
+static mutex ready_lock;
+static condition_variable ready_cv;
+static deque<int> ready;
+
+static void Worker(void) {
+	while (true) {
+		int fd;
+		{
+			unique_lock<mutex> lock(ready_lock);
+			ready_cv.wait(lock, [] { return !ready.empty(); });
+			fd = ready.front();
+			ready.pop_front();
+		}
+		
+		epoll_event ev = {};
+		ev.events = EPOLLIN | EPOLLONESHOT;
+		ev.data.fd = fd;
+		if (!Serve(fd) || epoll_ctl(poller, EPOLL_CTL_MOD, fd, &ev) != 0)
+			close(fd);
+	}
+}
+
+int main(int argc, char** argv) {
+	string path = "/tmp/ttsim.sock";
+	unsigned workers = max(1u, thread::hardware_concurrency());
+	
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "-s" && i + 1 < argc)
+			path = argv[++i];
+		else if (arg == "-j" && i + 1 < argc)
+			workers = max(1, atoi(argv[++i]));
+		else if (arg == "-t" && i + 1 < argc)
+			max_ticks = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-m" && i + 1 < argc)
+			max_payload = static_cast<uint32_t>(min(4095, max(1, atoi(argv[++i])))) << 20;
+		else {
+			cerr << "usage: " << argv[0] << " [-s socket] [-j workers] [-t max_ticks] [-m max_request_megabytes]" << endl;
+			return 1;
+		}
+	}
+	
+	signal(SIGPIPE, SIG_IGN);
+	
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path)) {
+		cerr << "Socket path too long" << endl;
+		return 1;
+	}
+	strcpy(addr.sun_path, path.c_str());
+	
+	int server = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(path.c_str());
+	if (server < 0 || bind(server, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(server, 64) < 0) {
+		cerr << "Could not listen on \"" << path << "\": " << strerror(errno) << endl;
+		return 1;
+	}
+	
+	poller = epoll_create1(EPOLL_CLOEXEC);
+	epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.fd = server;
+	if (poller < 0 || epoll_ctl(poller, EPOLL_CTL_ADD, server, &ev) != 0) {
+		cerr << "epoll: " << strerror(errno) << endl;
+		return 1;
+	}
+	
+	for (unsigned i = 0; i < workers; i++)
+		thread(Worker).detach();
+	
+	//a client that stops in the middle of a request only holds its worker this long
+	const timeval request_timeout = {10, 0};
+	epoll_event events[64];
+	while (true) {
+		int n = epoll_wait(poller, events, 64, -1);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			cerr << "epoll_wait: " << strerror(errno) << endl;
+			break;
+		}
+		for (int i = 0; i < n; i++) {
+			const int fd = events[i].data.fd;
+			if (fd != server) {
+				lock_guard<mutex> lock(ready_lock);
+				ready.push_back(fd);
+				ready_cv.notify_one();
+				continue;
+			}
+			
+			int client = accept4(server, nullptr, nullptr, SOCK_CLOEXEC);
+			if (client < 0) continue;
+			setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &request_timeout, sizeof(request_timeout));
+			ev.events = EPOLLIN | EPOLLONESHOT;
+			ev.data.fd = client;
+			if (epoll_ctl(poller, EPOLL_CTL_ADD, client, &ev) != 0)
+				close(client);
+		}
+	}
+	
+	close(server);
+	unlink(path.c_str());
+	return 1;
+}
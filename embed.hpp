@@ -0,0 +1,829 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include "tumble.hpp"
+
+using namespace std;
+
+//Boards built into a program. The text of a .ttsim file, given as a string literal,
+//is parsed and lowered while compiling into tables like FlatBoard's: one instance per
+//nested grid, the tile a marble lands on from each tile and the gear trains a turn
+//spreads through. EmbedRunner steps a board with a function specialized for each of
+//its tiles, so running it needs no loading and no heap. A board that does not parse
+//stops the build in EmbedCheck, whose template arguments are the error and its line
+//and column:
+//
+//	TTSIM_EMBED(adder, "0 0 Drop\n1 1 Bit 1\n...");
+//	EmbedRunner<adder> runner;
+//	runner.Run(input, [&](bool value) { ... });
+//
+//Boards are expanded like FlatBoard, one copy of a grid per tile holding it, and are
+//limited to embed_max_tiles tiles after that.
+
+static constexpr size_t embed_max_tiles = 1 << 16;
+
+
+// Parsing
+
+enum embed_error : uint8_t {
+	EMBED_OK,
+	EMBED_EXPECTED_NUMBER,
+	EMBED_NUMBER_OUT_OF_RANGE,
+	EMBED_EXPECTED_TILE_TYPE,
+	EMBED_UNKNOWN_TILE_TYPE,
+	EMBED_BAD_RUN_LENGTH,
+	EMBED_EXPECTED_OPEN_BRACE,
+	EMBED_UNEXPECTED_CLOSE_BRACE,
+	EMBED_MISSING_CLOSE_BRACE,
+	EMBED_UNKNOWN_DIRECTIVE,
+	EMBED_COMPONENT_IN_GRID,
+	EMBED_COMPONENT_TWICE,
+	EMBED_EXPECTED_COMPONENT_NAME,
+	EMBED_UNKNOWN_COMPONENT,
+	EMBED_TOO_BIG
+};
+
+//Scanner for constant expressions, keeps the first error like Scanner::Fail()
+struct embed_scanner {
+	const char* begin;
+	const char* pos;
+	const char* end;
+	const char* line_start;
+	int line;
+	embed_error error;
+	int error_line, error_column;
+	
+	constexpr embed_scanner(const char* begin, const char* end)
+		: begin(begin), pos(begin), end(end), line_start(begin), line(1), error(EMBED_OK), error_line(0), error_column(0) {}
+	
+	constexpr bool fail() const { return error != EMBED_OK; }
+	constexpr int Column() const { return static_cast<int>(pos - line_start) + 1; }
+	constexpr uint32_t Offset() const { return static_cast<uint32_t>(pos - begin); }
+	
+	constexpr void SkipSpace(void) {
+		for (; pos != end; pos++) {
+			if (*pos == '\n') {
+				line++;
+				line_start = pos + 1;
+			} else if (*pos != ' ' && *pos != '\t' && *pos != '\r') {
+				break;
+			}
+		}
+	}
+	constexpr bool AtEnd(void) { SkipSpace(); return pos == end; }
+	constexpr char Peek(void) { SkipSpace(); return pos == end ? '\0' : *pos; }
+	
+	constexpr bool Fail(embed_error e, int l = 0, int c = 0) {
+		if (!fail()) {
+			error = e;
+			error_line = (l > 0 ? l : line);
+			error_column = (c > 0 ? c : Column());
+		}
+		return false;
+	}
+	constexpr bool Expect(char c, embed_error e) {
+		if (Peek() != c) return Fail(e);
+		pos++;
+		return true;
+	}
+	
+	constexpr int Int(void) {
+		if (fail()) return 0;
+		SkipSpace();
+		
+		const char* p = pos;
+		const bool negative = (p != end && *p == '-');
+		if (negative) p++;
+		if (p == end || *p < '0' || *p > '9') {
+			Fail(EMBED_EXPECTED_NUMBER);
+			return 0;
+		}
+		
+		int64_t value = 0;
+		for (; p != end && *p >= '0' && *p <= '9'; p++) {
+			value = value * 10 + (*p - '0');
+			if (value > INT32_MAX) {
+				Fail(EMBED_NUMBER_OUT_OF_RANGE);
+				return 0;
+			}
+		}
+		pos = p;
+		return static_cast<int>(negative ? -value : value);
+	}
+	constexpr int Short(void) {
+		const int value = Int();
+		if (value < INT16_MIN || value > INT16_MAX) Fail(EMBED_NUMBER_OUT_OF_RANGE);
+		return value;
+	}
+	
+	//a word made of letters, returns where it starts
+	constexpr const char* Word(size_t& size) {
+		size = 0;
+		if (fail()) return pos;
+		SkipSpace();
+		const char* start = pos;
+		while (pos != end && ((*pos >= 'A' && *pos <= 'Z') || (*pos >= 'a' && *pos <= 'z'))) pos++;
+		size = pos - start;
+		if (size == 0) Fail(EMBED_EXPECTED_TILE_TYPE);
+		return start;
+	}
+	//a component name made of letters, digits, '_' and '-'
+	constexpr const char* Name(size_t& size) {
+		size = 0;
+		if (fail()) return pos;
+		SkipSpace();
+		const char* start = pos;
+		while (pos != end && ((*pos >= 'A' && *pos <= 'Z') || (*pos >= 'a' && *pos <= 'z') || (*pos >= '0' && *pos <= '9') || *pos == '_' || *pos == '-')) pos++;
+		size = pos - start;
+		if (size == 0) Fail(EMBED_EXPECTED_COMPONENT_NAME);
+		return start;
+	}
+};
+
+constexpr bool EmbedEquals(const char* p, size_t size, const char* word) {
+	size_t i = 0;
+	for (; i < size; i++)
+		if (word[i] != p[i]) return false;
+	return word[i] == '\0';
+}
+
+//same names as MakeTile(), returns false for unknown ones
+constexpr bool EmbedTileType(const char* p, size_t size, tile_type& type) {
+	const pair<const char*, tile_type> names[] = {
+		{"Drop", TILE_DROP}, {"OutputValue", TILE_OUTPUT_VALUE}, {"OutputDirection", TILE_OUTPUT_DIRECTION},
+		{"Exit", TILE_EXIT}, {"Loop", TILE_LOOP}, {"Ramp", TILE_RAMP}, {"Cross", TILE_CROSS}, {"Bit", TILE_BIT},
+		{"Gear", TILE_GEAR}, {"GearBit", TILE_GEARBIT}, {"Grid", TILE_GRID}
+	};
+	for (auto& name : names)
+		if (EmbedEquals(p, size, name.first)) {
+			type = name.second;
+			return true;
+		}
+	return false;
+}
+
+struct embed_bound {
+	size_t tiles, blocks;
+};
+
+//sizes for EmbedParse(): a tile per line, a run's tiles and a drop per block at most
+template<size_t N>
+constexpr embed_bound EmbedBound(const char (&text)[N]) {
+	embed_bound b = {1, 1};
+	for (size_t i = 0; i + 1 < N; i++) {
+		if (text[i] == '\n') {
+			b.tiles++;
+		} else if (text[i] == '{') {
+			b.tiles++, b.blocks++;
+		} else if (text[i] == '*') {
+			size_t j = i + 1, run = 0;
+			while (j + 1 < N && (text[j] == ' ' || text[j] == '\t')) j++;
+			for (; j + 1 < N && text[j] >= '0' && text[j] <= '9' && run <= embed_max_tiles; j++)
+				run = run * 10 + (text[j] - '0');
+			b.tiles += run;
+		}
+		//larger boards fail to parse, see EmbedParse()
+		if (b.tiles > embed_max_tiles) b.tiles = embed_max_tiles;
+	}
+	return b;
+}
+
+struct embed_raw_tile {
+	int32_t x, y;
+	uint32_t block; //block holding the tile
+	uint32_t order; //place in the text, later tiles replace earlier ones at the same position
+	tile_type type;
+	int32_t param;
+	int32_t child;  //grids: block of the contents
+};
+
+struct embed_block {
+	uint32_t tile_begin, tile_end; //sorted by row once parsed
+	uint32_t name, name_size;      //text offset of a component's name, size 0 for other blocks
+	uint32_t end;                  //text offset of a component's closing brace
+	bool defined;                  //a component can be referred to once its block is closed
+};
+
+//a board's text split into blocks, the root grid, nested grids and components
+template<size_t R, size_t K>
+struct embed_text {
+	embed_raw_tile tiles[R] = {};
+	embed_block blocks[K] = {};
+	uint32_t tile_count = 0, block_count = 0;
+	//size of the board with every grid copied into the tiles holding it
+	size_t instance_tiles = 1, instances = 1;
+	embed_error error = EMBED_OK;
+	int line = 0, column = 0;
+};
+
+template<size_t R, size_t K>
+constexpr bool EmbedLess(const embed_text<R, K>& text, uint32_t a, uint32_t b) {
+	const embed_raw_tile& l = text.tiles[a];
+	const embed_raw_tile& r = text.tiles[b];
+	if (l.block != r.block) return l.block < r.block;
+	if (l.y != r.y) return l.y < r.y;
+	if (l.x != r.x) return l.x < r.x;
+	return l.order < r.order;
+}
+
+//heap sort, std::sort cannot be used in constant expressions before C++20
+template<size_t R, size_t K>
+constexpr void EmbedSort(embed_text<R, K>& text) {
+	const uint32_t n = text.tile_count;
+	auto Sift = [&text](uint32_t i, uint32_t size) {
+		while (true) {
+			uint32_t largest = i;
+			const uint32_t l = 2 * i + 1, r = 2 * i + 2;
+			if (l < size && EmbedLess(text, largest, l)) largest = l;
+			if (r < size && EmbedLess(text, largest, r)) largest = r;
+			if (largest == i) return;
+			const embed_raw_tile t = text.tiles[i];
+			text.tiles[i] = text.tiles[largest];
+			text.tiles[largest] = t;
+			i = largest;
+		}
+	};
+	for (uint32_t i = n / 2; i-- > 0;)
+		Sift(i, n);
+	for (uint32_t end = n; end-- > 1;) {
+		const embed_raw_tile t = text.tiles[0];
+		text.tiles[0] = text.tiles[end];
+		text.tiles[end] = t;
+		Sift(0, end);
+	}
+}
+
+//tiles and instances of a block with its nested grids, saturating above the limit
+template<size_t R, size_t K>
+constexpr void EmbedExpand(const embed_text<R, K>& text, uint32_t block, size_t* tiles, size_t* instances, bool* done) {
+	if (done[block]) return;
+	const embed_block& b = text.blocks[block];
+	size_t t = b.tile_end - b.tile_begin, g = 1;
+	for (uint32_t i = b.tile_begin; i < b.tile_end; i++) {
+		const int32_t child = text.tiles[i].child;
+		if (child < 0) continue;
+		EmbedExpand(text, child, tiles, instances, done);
+		t += tiles[child], g += instances[child];
+		if (t > embed_max_tiles) t = embed_max_tiles + 1;
+		if (g > embed_max_tiles) g = embed_max_tiles + 1;
+	}
+	tiles[block] = t, instances[block] = g;
+	done[block] = true;
+}
+
+//reads a board like Grid::Deserialize(), in a constant expression
+template<size_t R, size_t K, size_t N>
+constexpr embed_text<R, K> EmbedParse(const char (&str)[N]) {
+	embed_text<R, K> text;
+	embed_scanner in(str, str + N - 1);
+	
+	struct level {
+		uint32_t block;
+		int px, py; //previous position for delta coding
+	};
+	level stack[K] = {};
+	size_t depth = 0;
+	
+	auto AddTile = [&](uint32_t block, int x, int y, tile_type type, int param, int32_t child) {
+		if (text.tile_count == R) return in.Fail(EMBED_TOO_BIG);
+		text.tiles[text.tile_count] = {x, y, block, text.tile_count, type, param, child};
+		text.tile_count++;
+		return true;
+	};
+	//a new grid only holds its drop
+	auto NewBlock = [&](void) -> int32_t {
+		if (text.block_count == K) return in.Fail(EMBED_TOO_BIG), -1;
+		const uint32_t b = text.block_count++;
+		text.blocks[b] = {0, 0, 0, 0, 0, false};
+		AddTile(b, 0, 0, TILE_DROP, 0, -1);
+		stack[depth++] = {b, 0, 0};
+		return b;
+	};
+	NewBlock();
+	
+	//block of a component, -1 if there is none
+	auto Component = [&](const char* name, size_t size) -> int32_t {
+		for (uint32_t b = 0; b < text.block_count; b++) {
+			const embed_block& c = text.blocks[b];
+			if (c.name_size != size) continue;
+			bool same = true;
+			for (size_t i = 0; i < size; i++)
+				if (str[c.name + i] != name[i]) same = false;
+			if (same) return b;
+		}
+		return -1;
+	};
+	
+	//compact files start with a marker, other directives are read with the tiles
+	bool compact = false;
+	if (in.Peek() == '%') {
+		const embed_scanner start = in;
+		size_t size = 0;
+		in.pos++;
+		const char* marker = in.Word(size);
+		compact = (!in.fail() && EmbedEquals(marker, size, "compact"));
+		if (!compact && !in.fail()) in = start;
+	}
+	
+	while (!in.fail() && !in.AtEnd()) {
+		if (in.Peek() == '}') {
+			if (depth == 1) {
+				in.Fail(EMBED_UNEXPECTED_CLOSE_BRACE);
+				break;
+			}
+			embed_block& b = text.blocks[stack[depth - 1].block];
+			if (b.name_size > 0) {
+				b.end = in.Offset();
+				b.defined = true;
+			}
+			in.pos++;
+			depth--;
+			continue;
+		}
+		
+		//component definition, read like a nested grid that is not placed anywhere
+		if (in.Peek() == '%') {
+			const int line = in.line, column = in.Column();
+			size_t size = 0, name_size = 0;
+			in.pos++;
+			const char* word = in.Word(size);
+			if (!in.fail() && !EmbedEquals(word, size, "component"))
+				in.Fail(EMBED_UNKNOWN_DIRECTIVE, line, column);
+			else if (!in.fail() && depth > 1)
+				in.Fail(EMBED_COMPONENT_IN_GRID, line, column);
+			const char* name = in.Name(name_size);
+			in.Expect('{', EMBED_EXPECTED_OPEN_BRACE);
+			if (in.fail()) break;
+			
+			if (Component(name, name_size) >= 0) {
+				in.Fail(EMBED_COMPONENT_TWICE, line, column);
+				break;
+			}
+			const int32_t b = NewBlock();
+			if (b < 0) break;
+			text.blocks[b].name = static_cast<uint32_t>(name - str);
+			text.blocks[b].name_size = static_cast<uint32_t>(name_size);
+			continue;
+		}
+		
+		int x = in.Int();
+		int y = in.Int();
+		in.SkipSpace();
+		const int line = in.line, column = in.Column();
+		size_t size = 0;
+		const char* word = in.Word(size);
+		if (in.fail()) break;
+		
+		tile_type type = TILE_DROP;
+		if (!EmbedTileType(word, size, type)) {
+			in.Fail(EMBED_UNKNOWN_TILE_TYPE, line, column);
+			break;
+		}
+		int param = 0;
+		switch (type) {
+			case TILE_RAMP:
+			case TILE_BIT:
+			case TILE_GEARBIT:
+				param = in.Int();
+				break;
+			case TILE_LOOP:
+			case TILE_GRID:
+				param = in.Short();
+				break;
+			default:
+				break;
+		}
+		if (in.fail()) break;
+		
+		level& l = stack[depth - 1];
+		const bool nested = (type == TILE_GRID);
+		int run = 1;
+		if (compact) {
+			x += l.px, y += l.py;
+			if (!nested && in.Peek() == '*') {
+				in.pos++;
+				run = in.Int();
+				if (!in.fail() && run < 1) in.Fail(EMBED_BAD_RUN_LENGTH);
+				if (in.fail()) break;
+			}
+			l.px = x + run - 1, l.py = y;
+		}
+		
+		int32_t child = -1;
+		const uint32_t block = l.block;
+		if (nested && in.Peek() == '@') {
+			in.pos++;
+			in.SkipSpace();
+			const int name_line = in.line, name_column = in.Column();
+			size_t name_size = 0;
+			const char* name = in.Name(name_size);
+			if (in.fail()) break;
+			
+			//a reference is only valid after the end of the definition
+			child = Component(name, name_size);
+			if (child >= 0 && (!text.blocks[child].defined || text.blocks[child].end > in.Offset())) child = -1;
+			if (child < 0) {
+				in.Fail(EMBED_UNKNOWN_COMPONENT, name_line, name_column);
+				break;
+			}
+		} else if (nested) {
+			if (!in.Expect('{', EMBED_EXPECTED_OPEN_BRACE)) break;
+			child = NewBlock();
+		}
+		
+		for (int i = 0; i < run && !in.fail(); i++)
+			AddTile(block, x + i, y, type, param, child);
+	}
+	if (!in.fail() && depth > 1) in.Fail(EMBED_MISSING_CLOSE_BRACE);
+	
+	if (in.fail()) {
+		text.error = in.error;
+		text.line = in.error_line, text.column = in.error_column;
+		return text;
+	}
+	
+	//blocks in order, each sorted by row, and only the last tile at a position
+	EmbedSort(text);
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < text.tile_count; i++) {
+		const embed_raw_tile& t = text.tiles[i];
+		if (i + 1 < text.tile_count) {
+			const embed_raw_tile& next = text.tiles[i + 1];
+			if (next.block == t.block && next.x == t.x && next.y == t.y) continue;
+		}
+		text.tiles[kept++] = t;
+	}
+	text.tile_count = kept;
+	for (uint32_t i = text.tile_count; i-- > 0;)
+		text.blocks[text.tiles[i].block].tile_begin = i;
+	for (uint32_t i = 0; i < text.tile_count; i++)
+		text.blocks[text.tiles[i].block].tile_end = i + 1;
+	
+	size_t tiles[K] = {}, instances[K] = {};
+	bool done[K] = {};
+	EmbedExpand(text, 0, tiles, instances, done);
+	if (tiles[0] > embed_max_tiles) {
+		text.error = EMBED_TOO_BIG;
+		text.line = 1, text.column = 1;
+		return text;
+	}
+	text.instance_tiles = tiles[0];
+	text.instances = instances[0];
+	return text;
+}
+
+//fails the build for a board that does not parse, the template arguments tell where
+template<embed_error Error, int Line, int Column>
+constexpr bool EmbedCheck(void) {
+	static_assert(Error == EMBED_OK, "embedded board does not parse, see the arguments of EmbedCheck");
+	return true;
+}
+
+
+// Lowering
+
+struct embed_tile {
+	tile_type type;
+	int8_t dir;      //ramp and bit direction, normalized to +1 / -1
+	short color;     //loop marble color
+	int32_t arg;     //bits: state index, -1 for bits that never flip. grids: child instance
+	int32_t next[2]; //tile a marble leaving to the left / right lands on, -1 when it falls off
+	int32_t train;   //gears, gear bits and grids: gear train of the tile, -1 otherwise
+};
+
+struct embed_grid {
+	uint32_t tile_begin, tile_end;
+	uint32_t origin;       //tile at (0, 0), where marbles start
+	int32_t drop_trains[4]; //trains next to the origin, turned when a parent turns the grid. -1 if unused
+};
+
+//gears, gear bits and grids connected to each other. A turn started at one of them
+//turns all the others, see Grid::TurnConnected()
+struct embed_train {
+	uint32_t begin, end; //range of train_tiles
+	bool parent;         //next to a drop or exit, so a turn is passed to the parent grid
+};
+
+template<size_t T, size_t G>
+struct embed_board {
+	embed_tile tiles[T] = {};
+	embed_grid grids[G] = {}; //instance 0 is the root
+	embed_train trains[T] = {};
+	uint32_t train_tiles[T] = {};
+	int8_t initial_bits[T] = {}; //bit states after Reset()
+	uint32_t tile_count = 0, grid_count = 0, train_count = 0, bit_count = 0;
+};
+
+//lowers a parsed board, numbering instances and bits like FlatBoard::Build()
+template<size_t T, size_t G, size_t R, size_t K>
+constexpr embed_board<T, G> EmbedLower(const embed_text<R, K>& text) {
+	embed_board<T, G> board;
+	if (text.error != EMBED_OK) {
+		//never run, EmbedCheck already failed
+		board.tiles[0] = {TILE_DROP, 1, 0, -1, {-1, -1}, -1};
+		board.grids[0] = {0, 1, 0, {-1, -1, -1, -1}};
+		board.tile_count = board.grid_count = 1;
+		return board;
+	}
+	
+	uint32_t sources[G] = {};
+	int32_t xs[T] = {}, ys[T] = {};
+	uint32_t owner[T] = {};
+	board.grid_count = 1;
+	
+	for (uint32_t gi = 0; gi < board.grid_count; gi++) {
+		embed_grid& gr = board.grids[gi];
+		const embed_block& b = text.blocks[sources[gi]];
+		gr.tile_begin = board.tile_count;
+		
+		for (uint32_t ri = b.tile_begin; ri < b.tile_end; ri++) {
+			const embed_raw_tile& r = text.tiles[ri];
+			embed_tile t = {r.type, 1, 0, -1, {-1, -1}, -1};
+			switch (r.type) {
+				case TILE_RAMP:
+					t.dir = (r.param >= 0 ? 1 : -1);
+					break;
+				case TILE_BIT:
+				case TILE_GEARBIT:
+					t.dir = (r.param >= 0 ? 1 : -1);
+					//a direction of 0 negates to itself, so the bit never changes
+					if (r.param != 0) {
+						t.arg = board.bit_count;
+						board.initial_bits[board.bit_count++] = t.dir;
+					}
+					break;
+				case TILE_LOOP:
+					t.color = static_cast<short>(r.param);
+					break;
+				case TILE_GRID:
+					t.arg = board.grid_count;
+					sources[board.grid_count++] = r.child;
+					break;
+				default:
+					break;
+			}
+			
+			const uint32_t ti = board.tile_count++;
+			board.tiles[ti] = t;
+			xs[ti] = r.x, ys[ti] = r.y;
+			owner[ti] = gi;
+		}
+		gr.tile_end = board.tile_count;
+	}
+	
+	//tiles of an instance are sorted by row
+	auto Find = [&](uint32_t grid, int x, int y) -> int32_t {
+		uint32_t lo = board.grids[grid].tile_begin, hi = board.grids[grid].tile_end;
+		while (lo < hi) {
+			const uint32_t mid = lo + (hi - lo) / 2;
+			if (ys[mid] < y || (ys[mid] == y && xs[mid] < x)) lo = mid + 1;
+			else hi = mid;
+		}
+		return (lo < board.grids[grid].tile_end && xs[lo] == x && ys[lo] == y) ? static_cast<int32_t>(lo) : -1;
+	};
+	auto Propagates = [](tile_type type) {
+		return type == TILE_GEAR || type == TILE_GEARBIT || type == TILE_GRID;
+	};
+	const int directions[4][2] = {{1,0}, {0,1}, {-1,0}, {0,-1}};
+	
+	for (uint32_t ti = 0; ti < board.tile_count; ti++) {
+		board.tiles[ti].next[0] = Find(owner[ti], xs[ti] - 1, ys[ti] + 1);
+		board.tiles[ti].next[1] = Find(owner[ti], xs[ti] + 1, ys[ti] + 1);
+	}
+	
+	//same traversal as Grid::TurnConnected(), which turns a tile's whole train but the tile itself
+	uint32_t stack[T] = {};
+	for (uint32_t ti = 0; ti < board.tile_count; ti++) {
+		if (!Propagates(board.tiles[ti].type) || board.tiles[ti].train >= 0) continue;
+		
+		const int32_t id = board.train_count++;
+		embed_train& train = board.trains[id];
+		train.begin = train.end = (id == 0 ? 0 : board.trains[id - 1].end);
+		board.tiles[ti].train = id;
+		board.train_tiles[train.end++] = ti;
+		size_t size = 0;
+		stack[size++] = ti;
+		
+		while (size > 0) {
+			const uint32_t cur = stack[--size];
+			for (auto& dir : directions) {
+				const int32_t n = Find(owner[cur], xs[cur] + dir[0], ys[cur] + dir[1]);
+				if (n < 0) continue;
+				embed_tile& t = board.tiles[n];
+				if (t.type == TILE_DROP || t.type == TILE_EXIT) train.parent = true;
+				if (!Propagates(t.type) || t.train >= 0) continue;
+				t.train = id;
+				board.train_tiles[train.end++] = n;
+				stack[size++] = n;
+			}
+		}
+	}
+	
+	//see RecursiveTile::Turn()
+	for (uint32_t gi = 0; gi < board.grid_count; gi++) {
+		embed_grid& gr = board.grids[gi];
+		gr.origin = Find(gi, 0, 0);
+		size_t count = 0;
+		for (auto& dir : directions) {
+			const int32_t n = Find(gi, dir[0], dir[1]);
+			if (n < 0 || !Propagates(board.tiles[n].type)) continue;
+			const int32_t train = board.tiles[n].train;
+			bool seen = false;
+			for (size_t i = 0; i < count; i++)
+				if (gr.drop_trains[i] == train) seen = true;
+			if (!seen) gr.drop_trains[count++] = train;
+		}
+		for (; count < 4; count++)
+			gr.drop_trains[count] = -1;
+	}
+	return board;
+}
+
+#define TTSIM_EMBED(name, text) \
+	static constexpr auto name##_text = EmbedParse<EmbedBound(text).tiles, EmbedBound(text).blocks>(text); \
+	static_assert(EmbedCheck<name##_text.error, name##_text.line, name##_text.column>(), "embedded board " #name); \
+	static constexpr auto name = EmbedLower<name##_text.instance_tiles, name##_text.instances>(name##_text)
+
+
+// Simulation
+
+struct embed_marble {
+	int32_t tile; //-1 after falling off
+	int8_t dir;
+	short color;
+	bool active;
+	bool inside; //RecursiveTile::active of the tile holding this instance
+};
+
+//simulation state for an embedded board, same semantics as Grid::Update. Each tile
+//gets its own Collide() with the tile's constants folded in
+template<const auto& Board>
+class EmbedRunner {
+private:
+	int8_t bits[Board.bit_count > 0 ? Board.bit_count : 1];
+	embed_marble marbles[Board.grid_count];
+	
+	void Start(uint32_t grid, int dir, short color) {
+		embed_marble& m = marbles[grid];
+		m.active = true;
+		m.dir = static_cast<int8_t>(dir);
+		m.color = color;
+		m.tile = Board.grids[grid].origin;
+	}
+	
+	void TurnTrain(int32_t train, uint32_t except) {
+		const embed_train& tr = Board.trains[train];
+		for (uint32_t i = tr.begin; i < tr.end; i++) {
+			const uint32_t ti = Board.train_tiles[i];
+			if (ti == except) continue;
+			const embed_tile& t = Board.tiles[ti];
+			if (t.type == TILE_GEARBIT && t.arg >= 0) bits[t.arg] = -bits[t.arg];
+			else if (t.type == TILE_GRID) TurnGrid(t.arg);
+		}
+	}
+	void TurnGrid(uint32_t grid) {
+		const embed_grid& gr = Board.grids[grid];
+		for (int32_t train : gr.drop_trains)
+			if (train >= 0) TurnTrain(train, gr.origin);
+	}
+	
+	template<uint32_t Grid, uint32_t Tile>
+	bool Collide(embed_marble& m, collision_result& result, bool root) {
+		constexpr embed_tile t = Board.tiles[Tile];
+		bool done = false;
+		
+		if constexpr (t.type == TILE_OUTPUT_VALUE) {
+			if (m.color == COLOR_BLUE) result.output = 0;
+			else if (m.color == COLOR_RED) result.output = 1;
+		} else if constexpr (t.type == TILE_OUTPUT_DIRECTION) {
+			result.output = (m.dir > 0 ? 1 : 0);
+		} else if constexpr (t.type == TILE_EXIT) {
+			result.exit_tile = true;
+			done = true;
+		} else if constexpr (t.type == TILE_LOOP) {
+			result.marble_reset = true;
+			Start(Grid, m.dir, t.color);
+			done = true;
+		} else if constexpr (t.type == TILE_RAMP) {
+			m.dir = t.dir;
+		} else if constexpr (t.type == TILE_BIT || t.type == TILE_GEARBIT) {
+			if constexpr (t.arg >= 0) {
+				int8_t& b = bits[t.arg];
+				m.dir = b;
+				b = -b;
+			} else {
+				m.dir = t.dir;
+			}
+			if constexpr (t.type == TILE_GEARBIT) result.turn = true;
+		} else if constexpr (t.type == TILE_GRID) {
+			//same as RecursiveTile::Collide()
+			constexpr uint32_t child = t.arg;
+			embed_marble& inner = marbles[child];
+			result.inside_tile = true;
+			if (!inner.inside) {
+				inner.inside = true;
+				Start(child, m.dir, m.color);
+			}
+			
+			collision_result internal;
+			done = Update<child>(internal, false);
+			
+			if (done) {
+				if (internal.exit_tile) done = false;
+				result.inside_tile = false;
+				inner.inside = false;
+				m.color = inner.color;
+				m.dir = (inner.dir >= 0 ? 1 : -1);
+				m.active = true;
+			}
+			if (internal.turn_parent) result.turn = true;
+			if (internal.marble_reset) {
+				result.marble_reset = true;
+				Start(Grid, inner.dir, inner.color);
+			}
+			result.output = internal.output;
+		}
+		
+		if (!m.active && !result.inside_tile) return true;
+		if (result.inside_tile) m.active = false;
+		if constexpr (t.type == TILE_GEARBIT || t.type == TILE_GRID)
+			if (result.turn) {
+				TurnTrain(t.train, Tile);
+				if (Board.trains[t.train].parent) result.turn_parent = true;
+			}
+		if (result.marble_reset && root) done = false;
+		
+		return done;
+	}
+	
+	template<uint32_t Grid, uint32_t... I>
+	bool Dispatch(integer_sequence<uint32_t, I...>, uint32_t index, collision_result& result, bool root) {
+		typedef bool (EmbedRunner::*collide)(embed_marble&, collision_result&, bool);
+		static constexpr collide table[] = {&EmbedRunner::Collide<Grid, Board.grids[Grid].tile_begin + I>...};
+		return (this->*table[index])(marbles[Grid], result, root);
+	}
+	
+public:
+	EmbedRunner() { Reset(); }
+	
+	void Reset(void) {
+		for (uint32_t i = 0; i < Board.bit_count; i++)
+			bits[i] = Board.initial_bits[i];
+		for (embed_marble& m : marbles)
+			m = {-1, -1, COLOR_WHITE, false, false};
+	}
+	
+	void AddMarble(int direction = -1, short color = COLOR_BLUE) {
+		Start(0, direction, color);
+	}
+	
+	template<uint32_t Grid = 0>
+	bool Update(collision_result& result, bool root = true) {
+		result.Reset();
+		
+		embed_marble& m = marbles[Grid];
+		if (m.active && m.tile >= 0) m.tile = Board.tiles[m.tile].next[m.dir > 0];
+		if (m.tile < 0) return true;
+		
+		constexpr embed_grid gr = Board.grids[Grid];
+		return Dispatch<Grid>(make_integer_sequence<uint32_t, gr.tile_end - gr.tile_begin>(), m.tile - gr.tile_begin, result, root);
+	}
+	
+	//drops one marble and runs it until it leaves the board, ticks is the remaining budget.
+	//output is called with each output value. Returns false if the budget ran out
+	template<class Output>
+	bool Drop(bool value, Output&& output, uint64_t& ticks) {
+		AddMarble(value ? 1 : -1, static_cast<short>(value ? COLOR_RED : COLOR_BLUE));
+		
+		while (ticks > 0) {
+			ticks--;
+			collision_result result;
+			bool done = Update(result);
+			
+			if (result.output >= 0)
+				output(result.output > 0);
+			if (done) return true;
+		}
+		return false;
+	}
+	
+	template<class Input, class Output>
+	bool Run(const Input& input, Output&& output, uint64_t max_ticks = 10000000) {
+		Reset();
+		
+		uint64_t ticks = max_ticks;
+		bool finished = true;
+		for (bool value : input)
+			if (!Drop(value, output, ticks)) {
+				finished = false;
+				break;
+			}
+		
+		Reset();
+		return finished;
+	}
+	
+	const int8_t* Bits(void) const { return bits; }
+};
@@ -0,0 +1,253 @@
+// ttsim-equiv: checks that two boards give the same outputs for the same inputs
+//
+// Every input of up to -n marbles is checked by walking the tree of inputs depth
+// first, so each prefix is simulated once and the boards are compared after every
+// marble. Subtrees are shared out between -j threads. Longer inputs, up to -l
+// marbles, are covered by -r random runs. A difference is reported as the shortest
+// input after which the outputs differ, inputs of up to -n marbles are searched
+// completely so no shorter one exists there.
+//
+// A marble that does not leave the board within -t ticks counts as stuck, the
+// boards differ if only one of them gets stuck.
+//
+// Exit status is 0 if no difference was found, 1 if the boards differ and 2 on errors.
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <cstdio>
+#include "tumble.hpp"
+
+using namespace std;
+
+struct equiv_options {
+	int exhaustive = 16;
+	int max_length = 64;
+	uint64_t runs = 100000;
+	unsigned workers = max(1u, thread::hardware_concurrency());
+	uint64_t max_ticks = 1000000;
+	uint64_t seed = 1;
+};
+
+//shortest difference found so far, shared by all workers
+class Counterexample {
+private:
+	mutex lock;
+	vector<bool> input;
+	atomic<size_t> length;
+	
+public:
+	Counterexample() : length(SIZE_MAX) {}
+	
+	bool Found(void) const { return length != SIZE_MAX; }
+	//inputs longer than this cannot improve the result
+	size_t Length(void) const { return length; }
+	
+	//keeps the shorter input, equal lengths keep the smaller one so results do not depend on timing
+	void Report(const vector<bool>& candidate) {
+		lock_guard<mutex> guard(lock);
+		if (candidate.size() > input.size() && Found()) return;
+		if (candidate.size() == input.size() && !(candidate < input)) return;
+		input = candidate;
+		length = input.size();
+	}
+	
+	const vector<bool>& Input(void) const { return input; }
+};
+
+//drops one marble on both boards. Returns true if they disagree, stuck is set when
+//both ran out of ticks and the input cannot be continued
+static bool Step(Grid& a, Grid& b, bool value, uint64_t max_ticks, bool& stuck) {
+	vector<bool> out_a, out_b;
+	uint64_t ticks_a = max_ticks, ticks_b = max_ticks;
+	const bool done_a = a.Drop(value, out_a, ticks_a);
+	const bool done_b = b.Drop(value, out_b, ticks_b);
+	
+	stuck = !done_a;
+	return done_a != done_b || out_a != out_b;
+}
+
+
+// Exhaustive search
+
+static void Explore(Grid& a, Grid& b, vector<bool>& prefix, const equiv_options& opt, Counterexample& found) {
+	const size_t length = prefix.size() + 1;
+	if (length > static_cast<size_t>(opt.exhaustive) || length > found.Length()) return;
+	
+	for (bool value : {false, true}) {
+		//the second branch continues on the boards themselves
+		Grid copy_a, copy_b;
+		Grid* pa = &a;
+		Grid* pb = &b;
+		if (!value) {
+			copy_a = a, copy_b = b;
+			pa = &copy_a, pb = &copy_b;
+		}
+		
+		prefix.push_back(value);
+		bool stuck;
+		if (Step(*pa, *pb, value, opt.max_ticks, stuck))
+			found.Report(prefix);
+		else if (!stuck)
+			Explore(*pa, *pb, prefix, opt, found);
+		prefix.pop_back();
+	}
+}
+
+static void Exhaustive(const Grid& a, const Grid& b, const equiv_options& opt, Counterexample& found) {
+	//enough subtrees to keep every worker busy until the end
+	int split = 0;
+	while (split < opt.exhaustive && (1u << split) < 16 * opt.workers) split++;
+	
+	atomic<uint64_t> next(0);
+	const uint64_t tasks = 1ull << split;
+	
+	auto Worker = [&](void) {
+		for (uint64_t task = next++; task < tasks; task = next++) {
+			Grid ga = a, gb = b;
+			vector<bool> prefix;
+			
+			//replay the subtree's prefix, most significant bit first
+			bool stopped = false;
+			for (int i = split - 1; i >= 0 && !stopped; i--) {
+				prefix.push_back((task >> i) & 1);
+				bool stuck;
+				if (Step(ga, gb, prefix.back(), opt.max_ticks, stuck)) {
+					found.Report(prefix);
+					stopped = true;
+				}
+				stopped = stopped || stuck;
+			}
+			if (!stopped) Explore(ga, gb, prefix, opt, found);
+		}
+	};
+	
+	vector<thread> workers;
+	for (unsigned i = 0; i < opt.workers; i++)
+		workers.emplace_back(Worker);
+	for (thread& t : workers)
+		t.join();
+}
+
+
+// Random testing
+
+static void Random(const Grid& a, const Grid& b, const equiv_options& opt, Counterexample& found) {
+	atomic<uint64_t> next(0);
+	const int min_length = opt.exhaustive + 1;
+	
+	auto Worker = [&](unsigned index) {
+		mt19937_64 rng(opt.seed * 1000003 + index);
+		uniform_int_distribution<int> lengths(min_length, opt.max_length);
+		Grid ga = a, gb = b;
+		vector<bool> input;
+		
+		while (next++ < opt.runs && !found.Found()) {
+			ga.Reset();
+			gb.Reset();
+			input.clear();
+			
+			const int length = lengths(rng);
+			for (int i = 0; i < length; i++) {
+				input.push_back(rng() & 1);
+				bool stuck;
+				if (Step(ga, gb, input.back(), opt.max_ticks, stuck)) {
+					found.Report(input);
+					break;
+				}
+				if (stuck) break;
+			}
+		}
+	};
+	
+	vector<thread> workers;
+	for (unsigned i = 0; i < opt.workers; i++)
+		workers.emplace_back(Worker, i);
+	for (thread& t : workers)
+		t.join();
+}
+
+static string Bits(const vector<bool>& bits) {
+	string s;
+	for (bool b : bits)
+		s += b ? '1' : '0';
+	return s;
+}
+
+static void PrintRun(Grid& g, const string& name, const vector<bool>& input, uint64_t max_ticks) {
+	vector<bool> output;
+	bool finished = true;
+	g.Reset();
+	for (bool value : input) {
+		uint64_t ticks = max_ticks;
+		if (!g.Drop(value, output, ticks)) {
+			finished = false;
+			break;
+		}
+	}
+	g.Reset();
+	cout << name << ": " << Bits(output) << (finished ? "" : " (stuck)") << endl;
+}
+
+int main(int argc, char** argv) {
+	vector<string> files;
+	equiv_options opt;
+	bool usage = false;
+	
+	for (int i = 1; i < argc && !usage; i++) {
+		string arg = argv[i];
+		const bool has_value = (i + 1 < argc);
+		if (arg == "-n" && has_value)
+			opt.exhaustive = max(0, min(40, atoi(argv[++i])));
+		else if (arg == "-l" && has_value)
+			opt.max_length = atoi(argv[++i]);
+		else if (arg == "-r" && has_value)
+			opt.runs = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-j" && has_value)
+			opt.workers = max(1, atoi(argv[++i]));
+		else if (arg == "-t" && has_value)
+			opt.max_ticks = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-s" && has_value)
+			opt.seed = strtoull(argv[++i], nullptr, 10);
+		else if (arg[0] != '-' && files.size() < 2)
+			files.push_back(arg);
+		else
+			usage = true;
+	}
+	if (usage || files.size() != 2) {
+		cerr << "usage: " << argv[0] << " a.ttsim b.ttsim [-n exhaustive_length] [-l max_length] [-r random_runs] [-j workers] [-t max_ticks] [-s seed]" << endl;
+		return 2;
+	}
+	
+	Grid boards[2];
+	for (int i = 0; i < 2; i++) {
+		parse_error err;
+		if (LoadGrid(boards[i], files[i], err)) {
+			cerr << files[i] << ":" << err.line << ":" << err.column << ": " << err.message << endl;
+			return 2;
+		}
+	}
+	
+	Counterexample found;
+	Exhaustive(boards[0], boards[1], opt, found);
+	if (!found.Found()) {
+		if (opt.exhaustive > 0)
+			cout << "No difference in " << ((2ull << opt.exhaustive) - 2) << " inputs of 1 to " << opt.exhaustive << " marbles" << endl;
+		if (opt.max_length <= opt.exhaustive || opt.runs == 0) return 0;
+		
+		Random(boards[0], boards[1], opt, found);
+		if (!found.Found()) {
+			cout << "No difference in " << opt.runs << " random inputs of " << (opt.exhaustive + 1) << " to " << opt.max_length << " marbles" << endl;
+			return 0;
+		}
+	}
+	
+	const vector<bool>& input = found.Input();
+	cout << "Boards differ after input " << Bits(input) << " (" << input.size() << " marbles)" << endl;
+	for (int i = 0; i < 2; i++)
+		PrintRun(boards[i], files[i], input, opt.max_ticks);
+	return 1;
+}
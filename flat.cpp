@@ -0,0 +1,775 @@
+#include "flat.hpp"
+#include <set>
+#include <tuple>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Building
+
+void FlatBoard::Build(const Grid& g) {
+	grids.clear();
+	tiles.clear();
+	slots.clear();
+	turns.clear();
+	turn_bits.clear();
+	initial_bits.clear();
+	jumps.clear();
+	positions.clear();
+	parents.clear();
+	drop_turns.clear();
+	slot_use.clear();
+	dead_turn_bits = 0;
+	
+	Lower(g, {-1, -1});
+}
+
+flat_tile FlatBoard::LowerTile(const BaseTile& t) {
+	flat_tile ft = {t.GetType(), 1, 0, -1, -1};
+	const int param = t.GetParameter();
+	
+	switch (ft.type) {
+		case TILE_RAMP:
+			ft.dir = (param >= 0 ? 1 : -1);
+			break;
+		case TILE_BIT:
+		case TILE_GEARBIT:
+			ft.dir = (param >= 0 ? 1 : -1);
+			//a direction of 0 negates to itself, so the bit never changes
+			if (param != 0) {
+				ft.arg = initial_bits.size();
+				initial_bits.push_back(ft.dir);
+			}
+			break;
+		case TILE_LOOP:
+			ft.color = static_cast<short>(param);
+			break;
+		default:
+			break;
+	}
+	return ft;
+}
+
+uint32_t FlatBoard::Lower(const Grid& g, pair<int32_t, int32_t> parent) {
+	//instances are numbered breadth first, tiles of an instance in row order
+	const uint32_t first = grids.size();
+	vector<pair<const Grid*, pair<int32_t, int32_t>>> sources = {{&g, parent}};
+	
+	for (size_t i = 0; i < sources.size(); i++) {
+		const uint32_t gi = first + i;
+		flat_grid gr;
+		gr.tile_begin = tiles.size();
+		
+		for (auto& [pos, t] : sources[i].first->SortedTiles()) {
+			flat_tile ft = LowerTile(*t);
+			if (ft.type == TILE_GRID) {
+				ft.arg = first + sources.size();
+				sources.push_back({t->GetGrid(), {gi, static_cast<int32_t>(tiles.size())}});
+			}
+			tiles.push_back(ft);
+			positions.push_back(pos);
+		}
+		gr.tile_end = tiles.size();
+		
+		//position table at most half full
+		uint32_t size = 2;
+		while (size < 2 * (gr.tile_end - gr.tile_begin)) size *= 2;
+		gr.slot_begin = slots.size();
+		gr.slot_mask = size - 1;
+		slots.resize(slots.size() + size, {0, 0, -1});
+		
+		for (uint32_t ti = gr.tile_begin; ti < gr.tile_end; ti++) {
+			auto [x, y] = positions[ti];
+			uint32_t s = flat_view::Hash(x, y) & gr.slot_mask;
+			while (slots[gr.slot_begin + s].tile >= 0)
+				s = (s + 1) & gr.slot_mask;
+			slots[gr.slot_begin + s] = {x, y, static_cast<int32_t>(ti)};
+		}
+		
+		grids.push_back(gr);
+		parents.push_back(sources[i].second);
+		slot_use.push_back(gr.tile_end - gr.tile_begin);
+	}
+	
+	//bits flipped when a parent turns a nested grid, see RecursiveTile::Turn(). Nested
+	//instances come after their parents, so these are worked out backwards
+	drop_turns.resize(grids.size());
+	for (uint32_t gi = grids.size(); gi-- > first;) {
+		bool ignored = false;
+		Collect(gi, 0, 0, drop_turns[gi], ignored);
+	}
+	
+	for (uint32_t gi = first; gi < grids.size(); gi++)
+		for (uint32_t ti = grids[gi].tile_begin; ti < grids[gi].tile_end; ti++)
+			if (tiles[ti].type == TILE_GEARBIT || tiles[ti].type == TILE_GRID)
+				SetTurn(gi, ti);
+	
+	if (!jumps.empty()) {
+		jumps.resize(2 * tiles.size());
+		for (uint32_t gi = first; gi < grids.size(); gi++)
+			for (uint32_t ti = grids[gi].tile_begin; ti < grids[gi].tile_end; ti++)
+				for (int dir : {-1, 1})
+					jumps[2 * ti + (dir > 0)] = Jump(gi, positions[ti].first, positions[ti].second, dir);
+	}
+	return first;
+}
+
+void FlatBoard::Collect(uint32_t grid, int x, int y, vector<uint32_t>& bits, bool& parent) const {
+	const int directions[4][2] = {{1,0}, {0,1}, {-1,0}, {0,-1}};
+	unordered_set<pair<int, int>, IntPairHash> visited = {{x, y}};
+	vector<pair<int, int>> stack = {{x, y}};
+	
+	while (!stack.empty()) {
+		auto [cx, cy] = stack.back();
+		stack.pop_back();
+		
+		for (auto& dir : directions) {
+			const int i = cx + dir[0], j = cy + dir[1];
+			if (visited.find({i, j}) != visited.end()) continue;
+			
+			const int32_t ti = Find(grid, i, j);
+			if (ti < 0) continue;
+			visited.insert({i, j});
+			
+			const flat_tile& t = tiles[ti];
+			switch (t.type) {
+				case TILE_GEARBIT:
+					if (t.arg >= 0) bits.push_back(t.arg);
+					stack.push_back({i, j});
+					break;
+				case TILE_GEAR:
+					stack.push_back({i, j});
+					break;
+				case TILE_GRID:
+					bits.insert(bits.end(), drop_turns[t.arg].begin(), drop_turns[t.arg].end());
+					stack.push_back({i, j});
+					break;
+				case TILE_DROP:
+				case TILE_EXIT:
+					parent = true;
+					break;
+				default:
+					break;
+			}
+		}
+	}
+}
+
+void FlatBoard::SetTurn(uint32_t grid, uint32_t tile) {
+	flat_turn turn = {static_cast<uint32_t>(turn_bits.size()), 0, false};
+	Collect(grid, positions[tile].first, positions[tile].second, turn_bits, turn.parent);
+	turn.end = turn_bits.size();
+	
+	if (tiles[tile].turn < 0) {
+		tiles[tile].turn = turns.size();
+		turns.push_back(turn);
+		return;
+	}
+	flat_turn& old = turns[tiles[tile].turn];
+	dead_turn_bits += old.end - old.begin;
+	old = turn;
+}
+
+//tiles a compressed jump passes
+static bool Steers(const flat_tile& t) {
+	switch (t.type) {
+		case TILE_DROP:
+		case TILE_CROSS:
+		case TILE_GEAR:
+		case TILE_RAMP:
+			return true;
+		case TILE_BIT:
+			return t.arg < 0;
+		default:
+			return false;
+	}
+}
+
+flat_jump FlatBoard::Jump(uint32_t grid, int x, int y, int dir) const {
+	flat_jump j = {x, y, -1, static_cast<int8_t>(dir), 0};
+	//y grows every cell, so this always ends
+	while (true) {
+		j.x += j.dir, j.y++, j.cells++;
+		j.tile = Find(grid, j.x, j.y);
+		if (j.tile < 0 || !Steers(tiles[j.tile])) break;
+		if (tiles[j.tile].type == TILE_RAMP || tiles[j.tile].type == TILE_BIT)
+			j.dir = tiles[j.tile].dir;
+	}
+	return j;
+}
+
+void FlatBoard::Compress(void) {
+	jumps.assign(2 * tiles.size(), {0, 0, -1, 1, 1});
+	
+	for (uint32_t gi = 0; gi < grids.size(); gi++) {
+		const flat_grid& gr = grids[gi];
+		for (uint32_t s = gr.slot_begin; s <= gr.slot_begin + gr.slot_mask; s++) {
+			if (slots[s].tile < 0) continue;
+			for (int dir : {-1, 1})
+				jumps[2 * slots[s].tile + (dir > 0)] = Jump(gi, slots[s].x, slots[s].y, dir);
+		}
+	}
+}
+
+
+// Patching
+
+bool FlatBoard::Apply(const Grid& g, const grid_path& path, const grid_edit& e) {
+	if (grids.empty()) return true;
+	uint32_t grid = 0;
+	for (auto [x, y] : path) {
+		const int32_t ti = Find(grid, x, y);
+		if (ti < 0 || tiles[ti].type != TILE_GRID) return true;
+		grid = tiles[ti].arg;
+	}
+	
+	const int32_t old = Find(grid, e.x, e.y);
+	const tile t = g.GetTile(e.x, e.y);
+	
+	//directions and colors change in place, turns only depend on where gears are
+	if (e.type == GRID_EDIT_INTERRACT && old >= 0 && t != nullptr && t->GetType() == tiles[old].type) {
+		flat_tile& ft = tiles[old];
+		const int param = t->GetParameter();
+		switch (ft.type) {
+			case TILE_RAMP:
+			case TILE_BIT:
+			case TILE_GEARBIT:
+				ft.dir = (param >= 0 ? 1 : -1);
+				if (ft.arg >= 0) initial_bits[ft.arg] = ft.dir;
+				break;
+			case TILE_LOOP:
+				ft.color = static_cast<short>(param);
+				break;
+			default:
+				break;
+		}
+		if (!jumps.empty()) RefreshJumps(grid, e.x, e.y);
+		return false;
+	}
+	
+	//the old tile is left unused, with its turn emptied so compacting drops its bits
+	if (old >= 0) {
+		EraseSlot(grid, e.x, e.y);
+		if (tiles[old].turn >= 0) {
+			flat_turn& turn = turns[tiles[old].turn];
+			dead_turn_bits += turn.end - turn.begin;
+			turn.begin = turn.end = 0;
+		}
+	}
+	if (t != nullptr) {
+		const BaseTile& bt = *t;
+		const uint32_t ti = tiles.size();
+		tiles.push_back(LowerTile(bt));
+		positions.push_back({e.x, e.y});
+		if (!jumps.empty()) jumps.resize(2 * tiles.size(), {0, 0, -1, 1, 1});
+		InsertSlot(grid, e.x, e.y, ti);
+		if (bt.GetType() == TILE_GRID) tiles[ti].arg = Lower(*bt.GetGrid(), {grid, ti});
+	}
+	
+	Refresh(grid, e.x, e.y);
+	if (!jumps.empty()) RefreshJumps(grid, e.x, e.y);
+	
+	//drop the bits of replaced turns once they are most of the array
+	if (dead_turn_bits > 4096 && dead_turn_bits > turn_bits.size() / 2) {
+		vector<uint32_t> live;
+		live.reserve(turn_bits.size() - dead_turn_bits);
+		for (flat_turn& turn : turns) {
+			const uint32_t begin = live.size();
+			live.insert(live.end(), turn_bits.begin() + turn.begin, turn_bits.begin() + turn.end);
+			turn.begin = begin;
+			turn.end = live.size();
+		}
+		turn_bits = move(live);
+		dead_turn_bits = 0;
+	}
+	return false;
+}
+
+void FlatBoard::InsertSlot(uint32_t grid, int x, int y, int32_t tile) {
+	flat_grid& gr = grids[grid];
+	//keep the table at most half full, a bigger one goes at the end
+	if (2 * (slot_use[grid] + 1) > gr.slot_mask + 1) {
+		const uint32_t begin = gr.slot_begin, size = gr.slot_mask + 1;
+		gr.slot_begin = slots.size();
+		gr.slot_mask = 2 * size - 1;
+		slots.resize(slots.size() + 2 * size, {0, 0, -1});
+		slot_use[grid] = 0;
+		for (uint32_t s = begin; s < begin + size; s++)
+			if (slots[s].tile >= 0) InsertSlot(grid, slots[s].x, slots[s].y, slots[s].tile);
+	}
+	
+	uint32_t s = flat_view::Hash(x, y) & gr.slot_mask;
+	while (slots[gr.slot_begin + s].tile >= 0)
+		s = (s + 1) & gr.slot_mask;
+	slots[gr.slot_begin + s] = {x, y, tile};
+	slot_use[grid]++;
+}
+
+void FlatBoard::EraseSlot(uint32_t grid, int x, int y) {
+	const flat_grid& gr = grids[grid];
+	uint32_t i = flat_view::Hash(x, y) & gr.slot_mask;
+	while (slots[gr.slot_begin + i].x != x || slots[gr.slot_begin + i].y != y)
+		i = (i + 1) & gr.slot_mask;
+	
+	//moves later entries of the probe sequence back so Find() still reaches them
+	for (uint32_t j = (i + 1) & gr.slot_mask; slots[gr.slot_begin + j].tile >= 0; j = (j + 1) & gr.slot_mask) {
+		const flat_slot& s = slots[gr.slot_begin + j];
+		const uint32_t home = flat_view::Hash(s.x, s.y) & gr.slot_mask;
+		//entries whose home is cyclically in (i, j] stay
+		if (((j - home) & gr.slot_mask) < ((j - i) & gr.slot_mask)) continue;
+		slots[gr.slot_begin + i] = s;
+		i = j;
+	}
+	slots[gr.slot_begin + i].tile = -1;
+	slot_use[grid]--;
+}
+
+void FlatBoard::Refresh(uint32_t grid, int x, int y) {
+	const int directions[4][2] = {{1,0}, {0,1}, {-1,0}, {0,-1}};
+	auto Gear = [this](int32_t ti) {
+		return ti >= 0 && (tiles[ti].type == TILE_GEARBIT || tiles[ti].type == TILE_GEAR || tiles[ti].type == TILE_GRID);
+	};
+	
+	while (true) {
+		//a component the edit split or joined touches the cell or one of its neighbors
+		unordered_set<pair<int, int>, IntPairHash> visited;
+		const pair<int, int> seeds[5] = {{x, y}, {x + 1, y}, {x, y + 1}, {x - 1, y}, {x, y - 1}};
+		for (auto [sx, sy] : seeds) {
+			if (visited.count({sx, sy}) || !Gear(Find(grid, sx, sy))) continue;
+			visited.insert({sx, sy});
+			vector<pair<int, int>> stack = {{sx, sy}};
+			vector<uint32_t> component;
+			
+			while (!stack.empty()) {
+				auto [cx, cy] = stack.back();
+				stack.pop_back();
+				const int32_t ti = Find(grid, cx, cy);
+				if (tiles[ti].type != TILE_GEAR) component.push_back(ti);
+				
+				for (auto& dir : directions) {
+					const int i = cx + dir[0], j = cy + dir[1];
+					if (visited.count({i, j}) || !Gear(Find(grid, i, j))) continue;
+					visited.insert({i, j});
+					stack.push_back({i, j});
+				}
+			}
+			for (uint32_t ti : component)
+				SetTurn(grid, ti);
+		}
+		
+		//a parent turning this grid flips its drop turns, which the parent's turns include
+		vector<uint32_t> drop;
+		bool ignored = false;
+		Collect(grid, 0, 0, drop, ignored);
+		if (drop == drop_turns[grid]) return;
+		drop_turns[grid] = move(drop);
+		
+		const auto [parent, tile] = parents[grid];
+		if (parent < 0) return;
+		grid = parent;
+		tie(x, y) = positions[tile];
+	}
+}
+
+void FlatBoard::RefreshJumps(uint32_t grid, int x, int y) {
+	const int32_t own = Find(grid, x, y);
+	if (own >= 0)
+		for (int dir : {-1, 1})
+			jumps[2 * own + (dir > 0)] = Jump(grid, x, y, dir);
+	
+	//walks up from the cell: (x, y, dir) is reached by a marble moving in direction dir
+	set<tuple<int, int, int>> visited;
+	vector<tuple<int, int, int>> stack = {{x, y, -1}, {x, y, 1}};
+	while (!stack.empty()) {
+		auto [cx, cy, dir] = stack.back();
+		stack.pop_back();
+		const int px = cx - dir, py = cy - 1;
+		const int32_t ti = Find(grid, px, py);
+		if (ti < 0 || !visited.insert({px, py, dir}).second) continue;
+		
+		jumps[2 * ti + (dir > 0)] = Jump(grid, px, py, dir);
+		const flat_tile& t = tiles[ti];
+		if (!Steers(t)) continue;
+		//ramps and fixed bits send every marble one way, the other tiles keep its direction
+		if (t.type == TILE_RAMP || t.type == TILE_BIT) {
+			if (t.dir != dir) continue;
+			stack.push_back({px, py, -1});
+			stack.push_back({px, py, 1});
+		} else {
+			stack.push_back({px, py, dir});
+		}
+	}
+}
+
+
+// Simulation
+
+static inline void StartMarble(flat_marble& m, int dir, short color) {
+	m.active = true;
+	m.dir = dir;
+	m.color = color;
+	m.x = 0, m.y = 0;
+	m.tile = -1;
+}
+
+void FlatRunner::Reset(void) {
+	bits.assign(board.initial_bits.begin(), board.initial_bits.end());
+	marbles.assign(board.grids.size(), {0, 0, -1, COLOR_WHITE, false, false, -1});
+}
+
+void FlatRunner::AddMarble(int direction, short color) {
+	StartMarble(marbles[0], direction, color);
+}
+
+void FlatRunner::Turn(int32_t turn, collision_result& result) {
+	const flat_turn& t = board.turns[turn];
+	for (uint32_t i = t.begin; i < t.end; i++) {
+		int8_t& b = bits[board.turn_bits[i]];
+		b = -b;
+	}
+	if (t.parent) result.turn_parent = true;
+}
+
+bool FlatRunner::Update(uint32_t grid, collision_result& result, bool root) {
+	result.Reset();
+	
+	flat_marble& m = marbles[grid];
+	int32_t ti = m.tile;
+	if (m.active) {
+		if (ti >= 0 && !board.jumps.empty()) {
+			const flat_jump& j = board.jumps[2 * ti + (m.dir > 0)];
+			m.x = j.x, m.y = j.y, m.dir = j.dir;
+			ti = j.tile;
+		} else {
+			m.x += m.dir, m.y++;
+			ti = board.Find(grid, m.x, m.y);
+		}
+	} else if (ti < 0) {
+		ti = board.Find(grid, m.x, m.y);
+	}
+	m.tile = ti;
+	if (ti < 0) return true;
+	const flat_tile& t = board.tiles[ti];
+	
+	bool done = false;
+	switch (t.type) {
+		case TILE_OUTPUT_VALUE:
+			if (m.color == COLOR_BLUE) result.output = 0;
+			else if (m.color == COLOR_RED) result.output = 1;
+			break;
+		case TILE_OUTPUT_DIRECTION:
+			result.output = (m.dir > 0 ? 1 : 0);
+			break;
+		case TILE_EXIT:
+			result.exit_tile = true;
+			done = true;
+			break;
+		case TILE_LOOP:
+			result.marble_reset = true;
+			StartMarble(m, m.dir, t.color);
+			done = true;
+			break;
+		case TILE_RAMP:
+			m.dir = t.dir;
+			break;
+		case TILE_BIT:
+		case TILE_GEARBIT:
+			if (t.arg >= 0) {
+				int8_t& b = bits[t.arg];
+				m.dir = b;
+				b = -b;
+			} else {
+				m.dir = t.dir;
+			}
+			if (t.type == TILE_GEARBIT) result.turn = true;
+			break;
+		case TILE_GRID: {
+			//same as RecursiveTile::Collide()
+			flat_marble& inner = marbles[t.arg];
+			result.inside_tile = true;
+			if (!inner.inside) {
+				inner.inside = true;
+				StartMarble(inner, m.dir, m.color);
+			}
+			
+			collision_result internal;
+			done = Update(t.arg, internal, false);
+			
+			if (done) {
+				if (internal.exit_tile) done = false;
+				result.inside_tile = false;
+				inner.inside = false;
+				m.color = inner.color;
+				m.dir = (inner.dir >= 0 ? 1 : -1);
+				m.active = true;
+			}
+			if (internal.turn_parent) result.turn = true;
+			if (internal.marble_reset) {
+				result.marble_reset = true;
+				StartMarble(m, inner.dir, inner.color);
+			}
+			result.output = internal.output;
+			break;
+		}
+		default:
+			break;
+	}
+	
+	if (!m.active && !result.inside_tile) return true;
+	if (result.inside_tile) m.active = false;
+	if (result.turn) Turn(t.turn, result);
+	if (result.marble_reset && root) done = false;
+	
+	return done;
+}
+
+bool FlatRunner::Drop(bool value, vector<bool>& output, uint64_t& ticks) {
+	AddMarble(value ? 1 : -1, static_cast<short>(value ? COLOR_RED : COLOR_BLUE));
+	return Continue(output, ticks);
+}
+
+bool FlatRunner::Continue(vector<bool>& output, uint64_t& ticks) {
+	while (ticks > 0) {
+		ticks--;
+		collision_result result;
+		bool done = Update(0, result);
+		
+		if (result.output >= 0)
+			output.push_back(result.output > 0);
+		if (done) return true;
+	}
+	return false;
+}
+
+bool FlatRunner::Run(const vector<bool>& input, vector<bool>& output, uint64_t max_ticks) {
+	Reset();
+	
+	uint64_t ticks = max_ticks;
+	bool finished = true;
+	for (bool value : input)
+		if (!Drop(value, output, ticks)) {
+			finished = false;
+			break;
+		}
+	
+	Reset();
+	return finished;
+}
+
+//bit and marble counts, one byte per bit, then per marble x, y, dir, color, active, inside and tile
+static const size_t flat_marble_size = 4 + 4 + 1 + 2 + 1 + 1 + 4;
+
+void FlatRunner::Save(string& out) const {
+	auto Put = [&out](const auto& v) {
+		out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+	};
+	out.reserve(out.size() + 8 + bits.size() + marbles.size() * flat_marble_size);
+	Put(static_cast<uint32_t>(bits.size()));
+	Put(static_cast<uint32_t>(marbles.size()));
+	for (int8_t b : bits)
+		Put(b);
+	for (const flat_marble& m : marbles) {
+		Put(static_cast<int32_t>(m.x));
+		Put(static_cast<int32_t>(m.y));
+		Put(static_cast<int8_t>(m.dir));
+		Put(m.color);
+		Put(static_cast<uint8_t>(m.active));
+		Put(static_cast<uint8_t>(m.inside));
+		Put(m.tile);
+	}
+}
+
+bool FlatRunner::Load(const void* data, size_t size) {
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	const uint8_t* end = p + size;
+	auto Get = [&p, end](auto& v) {
+		if (static_cast<size_t>(end - p) < sizeof(v)) return false;
+		memcpy(&v, p, sizeof(v));
+		p += sizeof(v);
+		return true;
+	};
+	
+	uint32_t bit_count = 0, marble_count = 0;
+	if (!Get(bit_count) || !Get(marble_count)) return true;
+	if (bit_count != board.initial_bits.size() || marble_count != board.grids.size()) return true;
+	if (static_cast<size_t>(end - p) != bit_count + marble_count * flat_marble_size) return true;
+	
+	vector<int8_t> new_bits(bit_count);
+	vector<flat_marble> new_marbles(marble_count);
+	for (int8_t& b : new_bits) {
+		Get(b);
+		if (b != 1 && b != -1) return true;
+	}
+	for (flat_marble& m : new_marbles) {
+		int32_t x = 0, y = 0;
+		int8_t dir = 0;
+		uint8_t active = 0, inside = 0;
+		Get(x), Get(y), Get(dir), Get(m.color), Get(active), Get(inside), Get(m.tile);
+		m.x = x, m.y = y, m.dir = dir;
+		m.active = active, m.inside = inside;
+		if (m.tile < -1 || m.tile >= static_cast<int32_t>(board.tiles.size())) return true;
+	}
+	Restore(new_bits, new_marbles);
+	return false;
+}
+
+
+// Images
+
+static const uint32_t image_magic = 0x49465454; //"TTFI"
+static const uint32_t image_version = 1;
+
+struct image_header {
+	uint32_t magic, version;
+	uint64_t offset[7], count[7]; //grids, tiles, slots, turns, turn_bits, initial_bits, jumps
+};
+
+template<typename T>
+static span<const T> ImageArray(const char* base, const image_header& h, int i) {
+	return span<const T>(reinterpret_cast<const T*>(base + h.offset[i]), h.count[i]);
+}
+
+bool WriteFlatImage(const FlatBoard& board, int fd) {
+	const pair<const void*, size_t> arrays[7] = {
+		{board.grids.data(), board.grids.size() * sizeof(flat_grid)},
+		{board.tiles.data(), board.tiles.size() * sizeof(flat_tile)},
+		{board.slots.data(), board.slots.size() * sizeof(flat_slot)},
+		{board.turns.data(), board.turns.size() * sizeof(flat_turn)},
+		{board.turn_bits.data(), board.turn_bits.size() * sizeof(uint32_t)},
+		{board.initial_bits.data(), board.initial_bits.size() * sizeof(int8_t)},
+		{board.jumps.data(), board.jumps.size() * sizeof(flat_jump)},
+	};
+	const size_t counts[7] = {
+		board.grids.size(), board.tiles.size(), board.slots.size(), board.turns.size(),
+		board.turn_bits.size(), board.initial_bits.size(), board.jumps.size()
+	};
+	
+	image_header h = {image_magic, image_version, {}, {}};
+	string data(sizeof(h), '\0');
+	for (int i = 0; i < 7; i++) {
+		data.resize((data.size() + 7) & ~size_t(7), '\0');
+		h.offset[i] = data.size();
+		h.count[i] = counts[i];
+		data.append(static_cast<const char*>(arrays[i].first), arrays[i].second);
+	}
+	memcpy(data.data(), &h, sizeof(h));
+	
+	const char* p = data.data();
+	size_t n = data.size();
+	while (n > 0) {
+		const ssize_t w = write(fd, p, n);
+		if (w < 0 && errno == EINTR) continue;
+		if (w <= 0) return true;
+		p += w;
+		n -= w;
+	}
+	return false;
+}
+
+void FlatImage::Unmap(void) {
+	if (data != nullptr) munmap(data, size);
+	data = nullptr;
+	size = 0;
+	view = {};
+}
+
+bool FlatImage::Map(int fd) {
+	Unmap();
+	struct stat st;
+	if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(image_header)) return true;
+	
+	void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) return true;
+	data = p;
+	size = st.st_size;
+	
+	image_header h;
+	memcpy(&h, data, sizeof(h));
+	if (h.magic != image_magic || h.version != image_version) {
+		Unmap();
+		return true;
+	}
+	
+	const size_t sizes[7] = {
+		sizeof(flat_grid), sizeof(flat_tile), sizeof(flat_slot), sizeof(flat_turn),
+		sizeof(uint32_t), sizeof(int8_t), sizeof(flat_jump)
+	};
+	for (int i = 0; i < 7; i++)
+		if (h.offset[i] % 8 != 0 || h.offset[i] > size || h.count[i] > (size - h.offset[i]) / sizes[i]) {
+			Unmap();
+			return true;
+		}
+	
+	const char* base = static_cast<const char*>(data);
+	view.grids = ImageArray<flat_grid>(base, h, 0);
+	view.tiles = ImageArray<flat_tile>(base, h, 1);
+	view.slots = ImageArray<flat_slot>(base, h, 2);
+	view.turns = ImageArray<flat_turn>(base, h, 3);
+	view.turn_bits = ImageArray<uint32_t>(base, h, 4);
+	view.initial_bits = ImageArray<int8_t>(base, h, 5);
+	view.jumps = ImageArray<flat_jump>(base, h, 6);
+	
+	if (Check()) {
+		Unmap();
+		return true;
+	}
+	return false;
+}
+
+bool FlatImage::Open(const string& path) {
+	const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return true;
+	const bool failed = Map(fd);
+	close(fd);
+	return failed;
+}
+
+bool FlatImage::Check(void) const {
+	const flat_view& v = view;
+	const size_t tiles = v.tiles.size(), bits = v.initial_bits.size();
+	if (v.grids.empty() || (!v.jumps.empty() && v.jumps.size() != 2 * tiles)) return true;
+	
+	//tiles are reached through the position tables, a patched board has unused ones
+	for (uint32_t gi = 0; gi < v.grids.size(); gi++) {
+		const flat_grid& gr = v.grids[gi];
+		if ((gr.slot_mask & (gr.slot_mask + 1)) != 0 || gr.slot_begin + uint64_t(gr.slot_mask) >= v.slots.size()) return true;
+		
+		//Find() stops at an empty slot, there has to be one
+		bool empty = false;
+		for (uint32_t s = gr.slot_begin; s <= gr.slot_begin + gr.slot_mask; s++) {
+			const int32_t ti = v.slots[s].tile;
+			if (ti < 0) {
+				empty = true;
+				continue;
+			}
+			if (ti >= int64_t(tiles)) return true;
+			
+			const flat_tile& t = v.tiles[ti];
+			if (t.turn < -1 || t.turn >= int64_t(v.turns.size())) return true;
+			switch (t.type) {
+				case TILE_BIT:
+				case TILE_GEARBIT:
+					if (t.arg < -1 || t.arg >= int64_t(bits)) return true;
+					break;
+				case TILE_GRID:
+					//nested instances come after their parents, so nesting cannot loop
+					if (t.arg <= int64_t(gi) || t.arg >= int64_t(v.grids.size())) return true;
+					break;
+				default:
+					break;
+			}
+			if ((t.type == TILE_GEARBIT || t.type == TILE_GRID) && t.turn < 0) return true;
+		}
+		if (!empty) return true;
+	}
+	for (const flat_turn& t : v.turns)
+		if (t.begin > t.end || t.end > v.turn_bits.size()) return true;
+	for (uint32_t b : v.turn_bits)
+		if (b >= bits) return true;
+	for (const flat_jump& j : v.jumps)
+		if (j.tile < -1 || j.tile >= int64_t(tiles)) return true;
+	return false;
+}
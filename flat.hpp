@@ -0,0 +1,206 @@
+#pragma once
+
+#include <vector>
+#include <span>
+#include <string>
+#include <cstdint>
+#include "tumble.hpp"
+
+using namespace std;
+
+//Grid lowered into flat arrays: every nested grid gets its own instance, tile
+//behavior is reduced to a type and constants, and the tiles flipped by a gear
+//turn are worked out ahead of time. Simulation state lives in FlatRunner.
+
+struct flat_tile {
+	tile_type type;
+	int8_t dir;    //ramp and bit direction, normalized to +1 / -1
+	short color;   //loop marble color
+	int32_t arg;   //bits: state index, -1 for bits that never flip. grids: child instance
+	int32_t turn;  //gear bits and grids: turn set started from this tile, -1 otherwise
+};
+
+//open addressing slot of an instance's position table
+struct flat_slot {
+	int32_t x, y;
+	int32_t tile; //-1 when empty
+};
+
+struct flat_grid {
+	uint32_t slot_begin;
+	uint32_t slot_mask;
+	uint32_t tile_begin, tile_end;
+};
+
+//where a marble leaving a tile next collides, after passing tiles that only steer it
+struct flat_jump {
+	int32_t x, y;
+	int32_t tile;   //-1 when the marble falls off
+	int8_t dir;     //direction on arrival
+	uint32_t cells; //cells moved, 1 if nothing was skipped
+};
+
+//bits flipped by one TurnConnected() call, including the ones inside nested grids
+struct flat_turn {
+	uint32_t begin, end; //range of turn_bits
+	bool parent;         //turn reached a drop or exit and is passed to the parent grid
+};
+
+//the arrays of a FlatBoard without owning them, over the board itself or over an
+//image mapped by FlatImage. This is all FlatRunner reads
+struct flat_view {
+	span<const flat_grid> grids;
+	span<const flat_tile> tiles;
+	span<const flat_slot> slots;
+	span<const flat_turn> turns;
+	span<const uint32_t> turn_bits;
+	span<const int8_t> initial_bits;
+	span<const flat_jump> jumps;
+	
+	//tile index at a position of an instance, -1 if empty
+	int32_t Find(uint32_t grid, int x, int y) const {
+		const flat_grid& gr = grids[grid];
+		uint32_t i = Hash(x, y) & gr.slot_mask;
+		while (true) {
+			const flat_slot& s = slots[gr.slot_begin + i];
+			if (s.tile < 0 || (s.x == x && s.y == y)) return s.tile;
+			i = (i + 1) & gr.slot_mask;
+		}
+	}
+	
+	static uint32_t Hash(int x, int y) {
+		uint32_t h = static_cast<uint32_t>(x) * 0x9E3779B1u ^ static_cast<uint32_t>(y) * 0x85EBCA77u;
+		return h ^ (h >> 15);
+	}
+};
+
+class FlatBoard {
+private:
+	//kept for Apply(), which patches the arrays in place
+	vector<pair<int, int>> positions;        //per tile
+	vector<pair<int32_t, int32_t>> parents;  //per instance, instance and grid tile holding it, -1 for the root
+	vector<vector<uint32_t>> drop_turns;     //per instance, bits flipped when the parent turns it
+	vector<uint32_t> slot_use;               //per instance, tiles in its position table
+	size_t dead_turn_bits = 0;               //turn_bits no turn refers to anymore
+	
+	//appends the instances of g and its nested grids and returns g's
+	uint32_t Lower(const Grid& g, pair<int32_t, int32_t> parent);
+	//the tile without its nested grid, bits get a state index
+	flat_tile LowerTile(const BaseTile& t);
+	//same traversal as Grid::TurnConnected()
+	void Collect(uint32_t grid, int x, int y, vector<uint32_t>& bits, bool& parent) const;
+	//works out the turn started from a gear bit or grid tile again
+	void SetTurn(uint32_t grid, uint32_t tile);
+	flat_jump Jump(uint32_t grid, int x, int y, int dir) const;
+	
+	void InsertSlot(uint32_t grid, int x, int y, int32_t tile);
+	void EraseSlot(uint32_t grid, int x, int y);
+	//turns of the gear components at and around a changed cell, then of the parents while drop turns change
+	void Refresh(uint32_t grid, int x, int y);
+	//jumps that start at, pass or end at a changed cell
+	void RefreshJumps(uint32_t grid, int x, int y);
+	
+public:
+	vector<flat_grid> grids; //instance 0 is the root
+	vector<flat_tile> tiles;
+	vector<flat_slot> slots;
+	vector<flat_turn> turns;
+	vector<uint32_t> turn_bits;
+	vector<int8_t> initial_bits; //bit states after Reset()
+	vector<flat_jump> jumps;     //two per tile, indexed by 2 * tile + (dir > 0). Empty unless compressed
+	
+	FlatBoard() = default;
+	explicit FlatBoard(const Grid& g) { Build(g); }
+	
+	void Build(const Grid& g);
+	//lets marbles pass ramps, crosses, gears, drops and fixed bits in a single tick.
+	//Outputs are unchanged but a tick can cover several cells
+	void Compress(void);
+	
+	//patches the board after the edit e of g, the grid path leads to from the root, in
+	//time that depends on the gear components around the edited cell and not on the
+	//board. Removed tiles are left unused, so after a patch tile ranges of instances
+	//and the numbering of bits no longer follow Build(). Runners on the board have to
+	//be made again. Returns true if path does not lead to a grid of this board
+	bool Apply(const Grid& g, const grid_path& path, const grid_edit& e);
+	
+	flat_view View(void) const { return {grids, tiles, slots, turns, turn_bits, initial_bits, jumps}; }
+	//tile index at a position of an instance, -1 if empty
+	int32_t Find(uint32_t grid, int x, int y) const { return View().Find(grid, x, y); }
+};
+
+struct flat_marble {
+	int x, y;
+	int dir;
+	short color;
+	bool active;
+	bool inside; //RecursiveTile::active of the tile holding this instance
+	int32_t tile; //tile at the marble's position, -1 if not looked up yet
+};
+
+//simulation state for a FlatBoard, same semantics as Grid::Update
+class FlatRunner {
+private:
+	flat_view board;
+	vector<int8_t> bits;
+	vector<flat_marble> marbles;
+	
+	void Turn(int32_t turn, collision_result& result);
+	
+public:
+	explicit FlatRunner(const FlatBoard& board) : FlatRunner(board.View()) {}
+	explicit FlatRunner(const flat_view& board) : board(board) { Reset(); }
+	
+	void Reset(void);
+	void AddMarble(int direction = -1, short color = COLOR_BLUE);
+	bool Update(uint32_t grid, collision_result& result, bool root = true);
+	//drops one marble and runs it until it leaves the board, ticks is the remaining budget.
+	//Returns false if the budget ran out
+	bool Drop(bool value, vector<bool>& output, uint64_t& ticks);
+	//same as Drop() for the marble already on the board, to go on after the budget ran out
+	bool Continue(vector<bool>& output, uint64_t& ticks);
+	bool Run(const vector<bool>& input, vector<bool>& output, uint64_t max_ticks = 10000000);
+	
+	const vector<int8_t>& Bits(void) const { return bits; }
+	const vector<flat_marble>& Marbles(void) const { return marbles; }
+	//continues from the Bits() and Marbles() of a runner on the same board
+	void Restore(const vector<int8_t>& bits, const vector<flat_marble>& marbles) {
+		this->bits = bits;
+		this->marbles = marbles;
+	}
+	//appends the bits and marbles to out, in host byte order
+	void Save(string& out) const;
+	//restores what Save() wrote, returns true and changes nothing if it does not fit this board
+	bool Load(const void* data, size_t size);
+};
+
+
+// Images
+
+//a FlatBoard written as one block that other processes map read-only and run
+//without parsing: a header with the offset and length of each array, then the
+//arrays, 8 byte aligned. Read back only on machines with the same byte order
+class FlatImage {
+private:
+	void* data = nullptr;
+	size_t size = 0;
+	flat_view view;
+	
+	void Unmap(void);
+	//checks that every index in the arrays is in range, so a runner cannot leave them
+	bool Check(void) const;
+	
+public:
+	FlatImage() = default;
+	FlatImage(const FlatImage&) = delete;
+	FlatImage& operator=(const FlatImage&) = delete;
+	~FlatImage() { Unmap(); }
+	
+	//maps the image in fd, which can be closed afterwards. Returns true if it is not a valid image
+	bool Map(int fd);
+	bool Open(const string& path);
+	const flat_view& View(void) const { return view; }
+};
+
+//writes the image of board to fd, returns true on error
+bool WriteFlatImage(const FlatBoard& board, int fd);
@@ -0,0 +1,705 @@
+// ttsim-fuzz: differential fuzzing of the simulation engines
+//
+// Each fuzz input is turned into a random board, using every tile type with nested
+// grids, gears and loops, and a row of input marbles. The board runs on Grid as the
+// reference and on every other engine:
+//
+//   copy       deep copy of the Grid
+//   text       Grid read back from Serialize()
+//   compact    Grid read back from compact Serialize()
+//   lazy       Grid read back from Serialize() by DeserializeLazy()
+//   flat       FlatRunner
+//   compressed FlatRunner on a compressed FlatBoard, only finished marbles compared
+//   image      FlatRunner on a FlatImage mapped from WriteFlatImage()
+//   patched    FlatRunner on a FlatBoard built without about half the tiles, at every
+//              depth, which FlatBoard::Apply() then adds back one by one
+//   bdd        SymbolicRun() evaluated at the input, for inputs of up to 8 marbles
+//
+// Before the random inputs, -e boards (300 by default) go through -m random edits each
+// (120 by default): tiles added, removed or clicked in grids at any depth, as in the
+// editor. After every edit a FlatBoard and a compressed one patched with Apply() since
+// the board was built have to run like a FlatBoard built from the edited board. A
+// failure prints and saves the board before the edit, with the edit.
+//
+// Outputs and bit states are compared after every marble. A board that makes an
+// engine disagree is shrunk tile by tile and marble by marble while it still fails,
+// then printed and saved, to $TMPDIR/ttsim-fuzz-failure.ttsim or the file given with -o.
+//
+// Built normally it first checks the boards built in with TTSIM_EMBED against Grid on
+// every input of up to 8 marbles, then runs -n random inputs or replays the files given.
+// Built with -DTTSIM_LIBFUZZER it only defines LLVMFuzzerTestOneInput, see the makefile.
+
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <random>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "tumble.hpp"
+#include "flat.hpp"
+#include "bdd.hpp"
+#include "embed.hpp"
+
+using namespace std;
+
+//ticks a marble may take before it counts as stuck
+static const uint64_t max_ticks = 5000;
+static const size_t max_bdd_inputs = 8;
+
+//failing boards are saved in $TMPDIR unless -o names a file
+static string DefaultFailurePath(void) {
+	const char* dir = getenv("TMPDIR");
+	return string(dir && *dir ? dir : "/tmp") + "/ttsim-fuzz-failure.ttsim";
+}
+
+static string failure_path = DefaultFailurePath();
+
+
+// Generating boards
+
+//fuzz input read as a stream of choices, zeros once it runs out
+class ByteSource {
+private:
+	const uint8_t* pos;
+	const uint8_t* end;
+	
+public:
+	ByteSource(const uint8_t* data, size_t size) : pos(data), end(data + size) {}
+	
+	uint8_t Next(void) { return pos < end ? *pos++ : 0; }
+	int Below(int n) { return Next() % n; }
+	bool Chance(int percent) { return Below(100) < percent; }
+};
+
+static void GenerateGrid(ostream& out, ByteSource& in, int depth) {
+	static const int bit_directions[] = {1, -1, 1, -1, 0, 2};
+	static const int loop_colors[] = {COLOR_BLUE, COLOR_RED, COLOR_GREEN};
+	
+	out << "0 0 Drop\n";
+	const int rows = 2 + in.Below(depth == 0 ? 7 : 3);
+	
+	//only cells a marble can reach from the drop, plus gears next to them
+	for (int y = 1; y <= rows; y++)
+		for (int x = -y; x <= y; x += 2) {
+			if (in.Chance(30)) continue;
+			
+			out << x << " " << y << " ";
+			switch (in.Below(12)) {
+				case 0:
+					out << "Ramp " << (in.Chance(50) ? 1 : -1) << "\n";
+					break;
+				case 1:
+				case 2:
+					out << "Bit " << bit_directions[in.Below(6)] << "\n";
+					break;
+				case 3:
+				case 4:
+					out << "GearBit " << bit_directions[in.Below(6)] << "\n";
+					break;
+				case 5:
+					out << "Gear\n";
+					break;
+				case 6:
+					out << "Cross\n";
+					break;
+				case 7:
+					out << (in.Chance(50) ? "OutputValue\n" : "OutputDirection\n");
+					break;
+				case 8:
+					out << (depth > 0 && in.Chance(60) ? "Exit\n" : "Drop\n");
+					break;
+				case 9:
+					out << "Loop " << loop_colors[in.Below(3)] << "\n";
+					break;
+				default:
+					if (depth >= 2) {
+						out << "Gear\n";
+						break;
+					}
+					out << "Grid " << loop_colors[in.Below(3)] << " {\n";
+					GenerateGrid(out, in, depth + 1);
+					out << "}\n";
+					break;
+			}
+			
+			if (in.Chance(25)) out << (x + 1) << " " << y << " Gear\n";
+		}
+}
+
+static void Generate(ByteSource& in, string& text, vector<bool>& input) {
+	ostringstream out;
+	GenerateGrid(out, in, 0);
+	text = out.str();
+	
+	input.resize(1 + in.Below(10));
+	for (size_t i = 0; i < input.size(); i++)
+		input[i] = in.Chance(50);
+}
+
+
+// Engines
+
+struct marble_trace {
+	vector<bool> outputs;
+	vector<int8_t> bits; //bit states after the marble, in FlatBoard order
+	bool finished;
+	
+	bool operator==(const marble_trace& o) const {
+		return outputs == o.outputs && bits == o.bits && finished == o.finished;
+	}
+};
+
+typedef vector<marble_trace> run_trace;
+
+//bit states of g in the order FlatBoard numbers them
+static void GridBits(const Grid& g, vector<int8_t>& bits) {
+	bits.clear();
+	vector<const Grid*> queue = {&g};
+	for (size_t i = 0; i < queue.size(); i++)
+		for (auto& [pos, t] : queue[i]->SortedTiles()) {
+			const tile_type type = t->GetType();
+			if ((type == TILE_BIT || type == TILE_GEARBIT) && t->GetParameter() != 0)
+				bits.push_back(t->GetState() >= 0 ? 1 : -1);
+			if (t->GetGrid()) queue.push_back(t->GetGrid());
+		}
+}
+
+static run_trace TraceGrid(Grid& g, const vector<bool>& input) {
+	run_trace trace;
+	g.Reset();
+	for (bool value : input) {
+		marble_trace m;
+		uint64_t ticks = max_ticks;
+		m.finished = g.Drop(value, m.outputs, ticks);
+		GridBits(g, m.bits);
+		trace.push_back(m);
+		if (!m.finished) break;
+	}
+	g.Reset();
+	return trace;
+}
+
+//bit states of a runner on board in the order FlatBoard::Build() numbers them, found by
+//following the tiles of g, so it also works after Apply() renumbered the bits
+static void FlatBits(const Grid& g, const FlatBoard& board, const vector<int8_t>& state, vector<int8_t>& bits) {
+	bits.clear();
+	vector<pair<const Grid*, uint32_t>> queue = {{&g, 0}};
+	for (size_t i = 0; i < queue.size(); i++)
+		for (auto& [pos, t] : queue[i].first->SortedTiles()) {
+			const int32_t ti = board.Find(queue[i].second, pos.first, pos.second);
+			if (ti < 0 || board.tiles[ti].type != t->GetType()) {
+				bits.push_back(0); //never a bit state, so the traces differ
+				continue;
+			}
+			const flat_tile& ft = board.tiles[ti];
+			if ((ft.type == TILE_BIT || ft.type == TILE_GEARBIT) && ft.arg >= 0)
+				bits.push_back(state[ft.arg]);
+			if (ft.type == TILE_GRID) queue.push_back({t->GetGrid(), static_cast<uint32_t>(ft.arg)});
+		}
+}
+
+//order and patched are given for runners on a board patched by Apply()
+static run_trace TraceFlat(FlatRunner& r, const vector<bool>& input, const Grid* order = nullptr, const FlatBoard* patched = nullptr) {
+	run_trace trace;
+	r.Reset();
+	for (bool value : input) {
+		marble_trace m;
+		uint64_t ticks = max_ticks;
+		m.finished = r.Drop(value, m.outputs, ticks);
+		if (order) FlatBits(*order, *patched, r.Bits(), m.bits);
+		else m.bits = r.Bits();
+		trace.push_back(m);
+		if (!m.finished) break;
+	}
+	r.Reset();
+	return trace;
+}
+
+//compressed ticks cover more cells, so only marbles that finished on the reference are compared
+static bool SameFinished(const run_trace& ref, const run_trace& other) {
+	for (size_t i = 0; i < ref.size() && ref[i].finished; i++)
+		if (i >= other.size() || !(ref[i] == other[i])) return false;
+	return true;
+}
+
+static bool SameBdd(const FlatBoard& board, const run_trace& ref, const vector<bool>& input) {
+	BddManager manager;
+	symbolic_result result;
+	//some input gets stuck, the functions are not defined
+	if (SymbolicRun(board, input.size(), manager, result, max_ticks)) return true;
+	
+	vector<bool> outputs;
+	for (const marble_trace& m : ref) {
+		if (!m.finished) return false;
+		outputs.insert(outputs.end(), m.outputs.begin(), m.outputs.end());
+	}
+	
+	for (size_t k = 0; k < max(outputs.size(), result.present.size()); k++) {
+		const bool present = k < result.present.size() && manager.Eval(result.present[k], input);
+		if (present != (k < outputs.size())) return false;
+		if (present && manager.Eval(result.value[k], input) != outputs[k]) return false;
+	}
+	return true;
+}
+
+static bool ReadBack(const Grid& g, bool compact, Grid& out, bool lazy = false) {
+	ostringstream text;
+	g.Serialize(text, compact);
+	if (lazy) {
+		parse_error err;
+		return out.DeserializeLazy(text.str(), err);
+	}
+	const string s = text.str();
+	Scanner in(s.data(), s.data() + s.size());
+	return out.Deserialize(in);
+}
+
+//maps the image of board from a memory file, returns true on error
+static bool MapImage(const FlatBoard& board, FlatImage& image) {
+	const int fd = memfd_create("ttsim-fuzz", MFD_CLOEXEC);
+	if (fd < 0) return true;
+	const bool failed = WriteFlatImage(board, fd) || image.Map(fd);
+	close(fd);
+	return failed;
+}
+
+struct removed_tile {
+	grid_path path;
+	int x, y;
+	tile t;
+};
+
+//removes about half of the tiles of g and of the grids it keeps, but not the drop of
+//the root, and lists them with the grid they were in
+static void RemoveSome(Grid& g, grid_path& path, mt19937& rng, vector<removed_tile>& removed) {
+	for (auto& [pos, unused] : g.SortedTiles()) {
+		auto [x, y] = pos;
+		tile t = g.GetTile(x, y);
+		if (!(path.empty() && x == 0 && y == 0) && rng() % 2 == 0) {
+			g.RemoveTile(x, y);
+			removed.push_back({path, x, y, t});
+			continue;
+		}
+		if (t->GetGrid() == nullptr) continue;
+		path.push_back(pos);
+		RemoveSome(*t->GetGrid(), path, rng, removed);
+		path.pop_back();
+	}
+}
+
+static Grid& GridAt(Grid& root, const grid_path& path) {
+	Grid* g = &root;
+	for (auto [x, y] : path)
+		g = g->GetTile(x, y)->GetGrid();
+	return *g;
+}
+
+//builds a FlatBoard for a copy of board without some tiles and adds them back with
+//Apply(), so patched ends up lowering board. Returns true if Apply() failed
+static bool PatchBack(const Grid& board, Grid& copy, FlatBoard& patched) {
+	copy = board;
+	mt19937 rng(1); //the same tiles for the same board, so failures can be minimized
+	vector<removed_tile> removed;
+	grid_path path;
+	RemoveSome(copy, path, rng, removed);
+	
+	patched.Build(copy);
+	for (const removed_tile& r : removed) {
+		Grid& g = GridAt(copy, r.path);
+		g.AddTile(r.x, r.y, r.t);
+		if (patched.Apply(g, r.path, {GRID_EDIT_ADD, r.x, r.y})) return true;
+	}
+	return false;
+}
+
+//runs board on every engine, returns the first one that disagrees with Grid or nullptr
+static const char* Check(Grid& board, const vector<bool>& input) {
+	Grid copy = board;
+	Grid text, compact, lazy;
+	const bool text_failed = ReadBack(board, false, text);
+	const bool compact_failed = ReadBack(board, true, compact);
+	const bool lazy_failed = ReadBack(board, false, lazy, true);
+	FlatBoard flat(board);
+	FlatBoard compressed(board);
+	compressed.Compress();
+	FlatImage image;
+	const bool image_failed = MapImage(flat, image);
+	Grid patched_grid;
+	FlatBoard patched;
+	const bool patch_failed = PatchBack(board, patched_grid, patched);
+	
+	const run_trace ref = TraceGrid(board, input);
+	
+	if (TraceGrid(copy, input) != ref) return "copy";
+	if (text_failed || TraceGrid(text, input) != ref) return "text";
+	if (compact_failed || TraceGrid(compact, input) != ref) return "compact";
+	if (lazy_failed || TraceGrid(lazy, input) != ref) return "lazy";
+	
+	FlatRunner flat_runner(flat);
+	if (TraceFlat(flat_runner, input) != ref) return "flat";
+	
+	FlatRunner compressed_runner(compressed);
+	if (!SameFinished(ref, TraceFlat(compressed_runner, input))) return "compressed";
+	
+	if (image_failed) return "image";
+	FlatRunner image_runner(image.View());
+	if (TraceFlat(image_runner, input) != ref) return "image";
+	
+	if (patch_failed) return "patched";
+	FlatRunner patched_runner(patched);
+	if (TraceFlat(patched_runner, input, &patched_grid, &patched) != ref) return "patched";
+	
+	if (input.size() <= max_bdd_inputs && !SameBdd(flat, ref, input)) return "bdd";
+	return nullptr;
+}
+
+
+// Minimizing
+
+static bool MinimizeGrid(Grid& root, Grid& g, const vector<bool>& input) {
+	bool changed = false;
+	
+	vector<pair<int, int>> positions;
+	for (auto& [pos, t] : g.SortedTiles())
+		positions.push_back(pos);
+	
+	for (auto [x, y] : positions) {
+		if (x == 0 && y == 0) continue;
+		
+		tile saved = g.GetTile(x, y);
+		g.RemoveTile(x, y);
+		if (Check(root, input)) {
+			changed = true;
+			continue;
+		}
+		g.AddTile(x, y, saved);
+		if (saved->GetGrid()) changed |= MinimizeGrid(root, *saved->GetGrid(), input);
+	}
+	return changed;
+}
+
+//shrinks a failing board and input while they keep failing
+static void Minimize(Grid& board, vector<bool>& input) {
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		
+		for (size_t i = input.size(); i-- > 0 && input.size() > 1;) {
+			vector<bool> shorter = input;
+			shorter.erase(shorter.begin() + i);
+			if (Check(board, shorter)) {
+				input = shorter;
+				changed = true;
+			}
+		}
+		
+		changed |= MinimizeGrid(board, board, input);
+	}
+}
+
+static string Bits(const vector<bool>& bits) {
+	string s;
+	for (bool b : bits)
+		s += b ? '1' : '0';
+	return s;
+}
+
+// Embedded boards
+
+//demo/running-xor.ttsim
+static constexpr char running_xor[] =
+	"0 0 Drop\n"
+	"-1 1 Ramp 1\n1 1 Ramp 1\n"
+	"0 2 GearBit 1\n2 2 Ramp -1\n"
+	"-1 3 Ramp 1\n0 3 Gear\n1 3 Ramp -1\n"
+	"0 4 GearBit 1\n"
+	"-1 5 OutputDirection\n1 5 OutputDirection\n";
+TTSIM_EMBED(running_xor_board, running_xor);
+
+//two copies of a component turning each other through a gear, in compact form
+static constexpr char gear_pair[] =
+	"%compact\n"
+	"%component 1 {\n"
+	"0 0 Drop\n-1 1 Ramp 1\n1 0 Gear\n1 0 Ramp -1\n-1 1 GearBit 1\n1 0 Gear\n-2 1 Exit\n2 0 Exit\n"
+	"}\n"
+	"0 0 Drop\n-1 1 Grid 4 @1\n1 0 Gear\n1 0 Grid 4 @1\n"
+	"-3 1 OutputDirection\n2 0 OutputValue\n2 0 OutputDirection\n"
+	"-5 1 Gear *3\n";
+TTSIM_EMBED(gear_pair_board, gear_pair);
+
+template<const auto& Board>
+static run_trace TraceEmbed(const vector<bool>& input) {
+	run_trace trace;
+	EmbedRunner<Board> runner;
+	for (bool value : input) {
+		marble_trace m;
+		uint64_t ticks = max_ticks;
+		m.finished = runner.Drop(value, [&m](bool out) { m.outputs.push_back(out); }, ticks);
+		m.bits.assign(runner.Bits(), runner.Bits() + Board.bit_count);
+		trace.push_back(m);
+		if (!m.finished) break;
+	}
+	return trace;
+}
+
+//returns true if the embedded board disagrees with Grid reading the same text
+template<const auto& Board, size_t N>
+static bool CheckEmbedded(const char (&text)[N], const char* name) {
+	Grid board;
+	Scanner in(text, text + N - 1);
+	if (board.Deserialize(in)) {
+		cerr << "Embedded board \"" << name << "\" does not parse: line " << in.error.line << ": " << in.error.message << endl;
+		return true;
+	}
+	
+	for (size_t length = 1; length <= max_bdd_inputs; length++)
+		for (uint64_t bits = 0; bits < (1ull << length); bits++) {
+			vector<bool> input(length);
+			for (size_t i = 0; i < length; i++)
+				input[i] = (bits >> i) & 1;
+			if (TraceEmbed<Board>(input) != TraceGrid(board, input)) {
+				cerr << "Embedded board \"" << name << "\" disagrees with Grid for input " << Bits(input) << endl;
+				return true;
+			}
+		}
+	return false;
+}
+
+
+//runs one fuzz input, returns true if an engine disagreed
+static bool FuzzOne(const uint8_t* data, size_t size) {
+	ByteSource in(data, size);
+	string text;
+	vector<bool> input;
+	Generate(in, text, input);
+	
+	Grid board;
+	Scanner scanner(text.data(), text.data() + text.size());
+	if (board.Deserialize(scanner)) {
+		cerr << "Generated board does not parse: line " << scanner.error.line << ": " << scanner.error.message << endl;
+		cerr << text;
+		return true;
+	}
+	
+	const char* engine = Check(board, input);
+	if (engine == nullptr) return false;
+	
+	Minimize(board, input);
+	engine = Check(board, input);
+	
+	cerr << "Engine \"" << (engine ? engine : "?") << "\" disagrees with Grid for input " << Bits(input) << " on:" << endl;
+	board.Serialize(cerr);
+	if (SaveGrid(board, failure_path))
+		cerr << "Could not write \"" << failure_path << "\"" << endl;
+	else
+		cerr << "Saved to \"" << failure_path << "\"" << endl;
+	return true;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+	if (FuzzOne(data, size)) abort();
+	return 0;
+}
+
+#ifndef TTSIM_LIBFUZZER
+
+
+// Editing
+
+//every grid of g, the root first, with the path that leads to it
+static void ListGrids(Grid& g, grid_path& path, vector<grid_path>& paths) {
+	paths.push_back(path);
+	for (auto& [pos, unused] : g.SortedTiles()) {
+		Grid* nested = g.GetTile(pos.first, pos.second)->GetGrid();
+		if (nested == nullptr) continue;
+		path.push_back(pos);
+		ListGrids(*nested, path, paths);
+		path.pop_back();
+	}
+}
+
+//a copy for g of a tile of a freshly generated board, nested grids included
+static tile RandomTile(const Grid& g, mt19937_64& rng) {
+	vector<uint8_t> data(64 + rng() % 192);
+	for (uint8_t& b : data)
+		b = rng();
+	ByteSource in(data.data(), data.size());
+	string text;
+	vector<bool> unused;
+	Generate(in, text, unused);
+	
+	Grid donor;
+	Scanner scanner(text.data(), text.data() + text.size());
+	if (donor.Deserialize(scanner)) return g.NewTile<GearTile>();
+	const auto sorted = donor.SortedTiles();
+	const auto [x, y] = sorted[rng() % sorted.size()].first;
+	return donor.GetTile(x, y)->Copy(g.Allocator());
+}
+
+//makes a random edit to a grid of board, at any depth, and returns it with the grid's
+//path. The drop of the root stays so marbles still enter the board
+static grid_edit RandomEdit(Grid& board, mt19937_64& rng, grid_path& path) {
+	vector<grid_path> paths;
+	grid_path root;
+	ListGrids(board, root, paths);
+	path = paths[rng() % paths.size()];
+	Grid& g = GridAt(board, path);
+	
+	vector<pair<int, int>> positions;
+	int rows = 1;
+	for (auto& [pos, unused] : g.SortedTiles()) {
+		if (!(path.empty() && pos == make_pair(0, 0))) positions.push_back(pos);
+		rows = max(rows, pos.second);
+	}
+	
+	const int choice = rng() % 4;
+	if (choice >= 2 && !positions.empty()) {
+		const auto [x, y] = positions[rng() % positions.size()];
+		if (choice == 2) g.RemoveTile(x, y);
+		else g.Interract(x, y);
+		return {choice == 2 ? GRID_EDIT_REMOVE : GRID_EDIT_INTERRACT, x, y};
+	}
+	
+	//around the cells a marble can reach from the drop, which may replace a tile
+	int x, y;
+	do {
+		y = 1 + rng() % (rows + 1);
+		x = -y - 1 + static_cast<int>(rng() % (2 * y + 3));
+	} while (path.empty() && x == 0 && y == 0);
+	g.AddTile(x, y, RandomTile(g, rng));
+	return {GRID_EDIT_ADD, x, y};
+}
+
+static const char* EditName(grid_edit_type type) {
+	switch (type) {
+		case GRID_EDIT_ADD: return "add";
+		case GRID_EDIT_REMOVE: return "remove";
+		default: return "click";
+	}
+}
+
+//edits boards generated from rng and checks the patched FlatBoards after every edit.
+//Returns true if one disagreed with a FlatBoard built from the edited board
+static bool CheckEdits(uint64_t boards, uint64_t edits, mt19937_64& rng) {
+	vector<uint8_t> data;
+	for (uint64_t i = 0; i < boards; i++) {
+		data.resize(64 + rng() % 448);
+		for (uint8_t& b : data)
+			b = rng();
+		ByteSource in(data.data(), data.size());
+		string text;
+		vector<bool> input;
+		Generate(in, text, input);
+		
+		Grid board;
+		Scanner scanner(text.data(), text.data() + text.size());
+		if (board.Deserialize(scanner)) continue; //reported by FuzzOne()
+		
+		FlatBoard patched(board);
+		FlatBoard compressed(board);
+		compressed.Compress();
+		for (uint64_t j = 0; j < edits; j++) {
+			ostringstream before;
+			board.Serialize(before);
+			
+			grid_path path;
+			const grid_edit e = RandomEdit(board, rng, path);
+			const Grid& g = GridAt(board, path);
+			const bool patch_failed = patched.Apply(g, path, e);
+			const bool compress_failed = compressed.Apply(g, path, e);
+			
+			FlatBoard fresh(board);
+			FlatRunner fresh_runner(fresh);
+			const run_trace ref = TraceFlat(fresh_runner, input);
+			
+			const char* engine = nullptr;
+			FlatRunner patched_runner(patched);
+			FlatRunner compressed_runner(compressed);
+			if (patch_failed || TraceFlat(patched_runner, input, &board, &patched) != ref)
+				engine = "plain";
+			else if (compress_failed || !SameFinished(ref, TraceFlat(compressed_runner, input, &board, &compressed)))
+				engine = "compressed";
+			if (engine == nullptr) continue;
+			
+			cerr << "Patched " << engine << " FlatBoard disagrees with a built one for input " << Bits(input)
+				<< " after " << EditName(e.type) << " at " << e.x << " " << e.y << " in the grid at";
+			for (auto [x, y] : path)
+				cerr << " " << x << " " << y;
+			cerr << (path.empty() ? " the root" : "") << ", edit " << j << " of board " << i << " on:" << endl;
+			cerr << before.str();
+			ofstream out(failure_path);
+			if (!(out << before.str()))
+				cerr << "Could not write \"" << failure_path << "\"" << endl;
+			else
+				cerr << "Saved to \"" << failure_path << "\"" << endl;
+			return true;
+		}
+	}
+	return false;
+}
+
+int main(int argc, char** argv) {
+	uint64_t iterations = 10000, seed = 1, edit_boards = 300, edits = 120;
+	vector<string> files;
+	
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		const bool has_value = (i + 1 < argc);
+		if (arg == "-n" && has_value)
+			iterations = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-s" && has_value)
+			seed = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-o" && has_value)
+			failure_path = argv[++i];
+		else if (arg == "-e" && has_value)
+			edit_boards = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-m" && has_value)
+			edits = strtoull(argv[++i], nullptr, 10);
+		else if (arg[0] != '-')
+			files.push_back(arg);
+		else {
+			cerr << "usage: " << argv[0] << " [-n iterations] [-s seed] [-e edit_boards] [-m edits] [-o failure.ttsim] [input files...]" << endl;
+			return 1;
+		}
+	}
+	
+	if (CheckEmbedded<running_xor_board>(running_xor, "running_xor")) return 1;
+	if (CheckEmbedded<gear_pair_board>(gear_pair, "gear_pair")) return 1;
+	
+	//replay saved fuzz inputs, e.g. crashes found by libFuzzer
+	if (!files.empty()) {
+		for (const string& file : files) {
+			ifstream f(file, ios::binary);
+			if (!f.is_open()) {
+				cerr << "Could not open \"" << file << "\"" << endl;
+				return 1;
+			}
+			const string data((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
+			if (FuzzOne(reinterpret_cast<const uint8_t*>(data.data()), data.size())) return 1;
+		}
+		cout << "No differences in " << files.size() << " inputs" << endl;
+		return 0;
+	}
+	
+	mt19937_64 rng(seed);
+	if (CheckEdits(edit_boards, edits, rng)) {
+		cerr << "Seed " << seed << endl;
+		return 1;
+	}
+	cout << "No differences after " << edits << " edits of " << edit_boards << " boards" << endl;
+	
+	vector<uint8_t> data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		data.resize(64 + rng() % 448);
+		for (uint8_t& b : data)
+			b = rng();
+		if (FuzzOne(data.data(), data.size())) {
+			cerr << "Iteration " << i << " with seed " << seed << endl;
+			return 1;
+		}
+	}
+	cout << "No differences in " << iterations << " boards" << endl;
+	return 0;
+}
+#endif
@@ -0,0 +1,175 @@
+#include "gui.hpp"
+
+// Grid
+
+void Grid::Render(render_info& info, int x, int y, bool blink, int mx, int my, short blink_color) const {
+	//render bounds
+	int start_x, start_y;
+	toWorldCoords(info, x, y, start_x, start_y);
+	const int end_x = start_x + info.w;
+	const int end_y = start_y + info.h;
+	
+	for (int j = start_y; j < end_y; j++)
+		for (int i = start_x; i < end_x; i++) {
+			tile t = GetTile(i, j);
+			
+			const int x = i - start_x;
+			const int y = j - start_y;
+			gfx_char c = {' ', COLOR_BLACK+8, COLOR_BLACK};
+			
+			bool isMarble = (marble.IsActive() && i == marble.x && j == marble.y);
+			
+			if (t == nullptr) {
+				//checkerboard pattern
+				if (!isOdd(i, j)) c.c = '.';
+			} else {
+				//get tile's graphic
+				c = t->GetGraphic(info);
+			}
+			
+			if (isMarble && blink) {
+				c = marble.GetGraphic();
+			}
+			
+			if (x == mx && y == my && blink) {
+				c.bg = blink_color;
+			}
+			
+			DrawChar(c, x, y, info.color);
+		}
+}
+
+
+// Panels
+
+void DrawChar(gfx_char c, int x, int y, bool color) {
+	if (color) {
+		short pair = c.fg + c.bg*16 + 1;
+		attron(COLOR_PAIR(pair));
+		mvaddch(y, x, c.c);
+		attroff(COLOR_PAIR(pair));
+		return;
+	}
+	mvaddch(y, x, c.c);
+}
+
+void DrawString(string& str, int x, int y, draw_params& p, bool color) {
+	attron(p.attr);
+	short pair = p.color + 1;
+	if (color) {
+		attron(COLOR_PAIR(pair));
+	}
+	
+	mvprintw(y, x, str.c_str());
+	
+	attroff(COLOR_PAIR(pair) | p.attr);
+}
+
+void DrawBox(int x1, int y1, int x2, int y2) {
+	//ensure correct order
+	if (x1 > x2) swap(x1, x2);
+	if (y1 > y2) swap(y1, y2);
+	
+	int dx = x2 - x1, dy = y2 - y1;
+	//sides
+	if (dx > 1 || dy > 1) {
+		mvhline(y1, x1+1, '-', dx-1);
+		mvhline(y2, x1+1, '-', dx-1);
+		mvvline(y1+1, x1, '|', dy-1);
+		mvvline(y1+1, x2, '|', dy-1);
+	}
+	
+	//corners
+	mvaddch(y1, x1, '+');  // Top-left corner
+	mvaddch(y1, x2, '+');  // Top-right corner
+	mvaddch(y2, x1, '+');  // Bottom-left corner
+	mvaddch(y2, x2, '+');  // Bottom-right corner
+	
+	//fill inside
+	for (int i = y1+1; i < y2; i++)
+		mvhline(i, x1+1, ' ', dx-1);
+}
+
+void Panel::AddString(int x, int y, string s, draw_params p) {
+	str.push_back(make_tuple(x, y, s, p));
+	Fit(x + s.length(), y + 1);
+}
+
+void Panel::EditString(int index, string s) {
+	if (index < 0 || index >= str.size()) return;
+	get<2>(str[index]) = s;
+	Fit(x + s.length(), y + 1);
+}
+
+void Panel::Render(render_info& info) {
+	if (hide) return;
+	
+	//border
+	DrawBox(x, y, x+w+1, y+h+1);
+	
+	//strings
+	for (auto it = str.begin(); it != str.end(); it++) {
+		DrawString(get<2>(*it), x+1+get<0>(*it), y+1+get<1>(*it), get<3>(*it), info.color);
+	}
+	
+	//call render function with offset and width,height
+	if (renderFunc) renderFunc(*this, info, x+1, y+1, w, h);
+	
+	//call character function for every pixel
+	if (charFunc)
+		for (int j = 0; j < h; j++)
+			for (int i = 0; i < w; i++) {
+				gfx_char c = charFunc(info, i, j);
+				if (c.c == '\0') continue;
+				DrawChar(c, i+x+1, j+y+1, info.color);
+			}
+}
+
+bool Panel::Inside(int x, int y, int& ox, int& oy) const {
+	int x1 = this->x + 1, y1 = this->y + 1;
+	int x2 = x1 + w - 1, y2 = y1 + h - 1;
+	
+	
+	if (x1-1 <= x && x <= x2+1 && y1-1 <= y && y <= y2+1) {
+		ox = -1;
+		oy = -1;
+		if (x1 <= x && x <= x2 && y1 <= y && y <= y2) {
+			ox = x - x1;
+			oy = y - y1;
+		}
+		return true;
+	}
+	
+	return false;
+}
+
+shared_ptr<Panel> Panels::Get(int id) const {
+	for (auto it = panels.begin(); it != panels.end(); it++)
+		if ((*it)->id == id)
+			return *it;
+	return nullptr;
+}
+
+void Panels::RemoveAll(int id) {
+	for (auto it = panels.begin(); it != panels.end(); )
+		if ((*it)->id == id) {
+			it = panels.erase(it);
+		} else {
+			it++;
+		}
+}
+
+bool Panels::Inside(int x, int y, int& ox, int& oy, shared_ptr<Panel>& p) const {
+	for (auto it = panels.rbegin(); it != panels.rend(); it++) {
+		if (!(*it)->IsHidden() && (*it)->Inside(x, y, ox, oy)) {
+			p = *it;
+			return true;
+		}
+	}
+	return false;
+}
+
+void Panels::Render(render_info& info) const {
+	for (auto it = panels.begin(); it != panels.end(); it++)
+		(*it)->Render(info);
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <ncurses.h>
+#include "tumble.hpp"
+
+using namespace std;
+
+//terminal drawing for the editor, the only code that needs ncurses
+
+struct draw_params {
+public:
+	int attr;
+	short color;
+	
+	draw_params() : attr(0), color(COLOR_WHITE) {}
+	
+	void SetColor(short clr) { color = clr; }
+	
+	void SetBold(bool v = true) {
+		attr &= ~(A_BOLD);
+		attr |= (v ? A_BOLD : 0);
+	}
+	void SetUnderline(bool v = true) {
+		attr &= ~(A_UNDERLINE);
+		attr |= (v ? A_UNDERLINE : 0);
+	}
+	void SetDim(bool v = true) {
+		attr &= ~(A_DIM);
+		attr |= (v ? A_DIM : 0);
+	}
+	
+	draw_params(short clr, bool bold = false, bool underline = false, bool dim = false) : color(clr) {
+		SetBold(bold);
+		SetUnderline(underline);
+		SetDim(dim);
+	}
+};
+
+void DrawChar(gfx_char c, int x, int y, bool color = false);
+void DrawString(string& str, int x, int y, draw_params& p, bool color = false);
+void DrawBox(int x1, int y1, int x2, int y2);
+
+class Panel {
+private:
+	int x, y;
+	int w, h;
+	bool hide;
+	
+	vector<tuple<int, int, string, draw_params>> str;
+	
+	//callback functions
+	typedef function<gfx_char(render_info&, int, int)> charFunction;
+	typedef function<void(Panel&, render_info&, int, int, int, int)> renderFunction;
+	
+	//return '\0' for nothing
+	charFunction charFunc;
+	renderFunction renderFunc;
+	
+public:
+	const int id;
+	
+	Panel(int id = -1, int x = 0, int y = 0, int w = 1, int h = 1)
+		: id(id), x(x), y(y), w(w), h(h), hide(false) {}
+	
+	void Resize(int w, int h) { this->w = w, this->h = h; }
+	void Fit(int w, int h) {
+		if (this->w < w) this->w = w;
+		if (this->h < h) this->h = h;
+	}
+	void Move(int x, int y) { this->x = x, this->y = y; }
+	void Hide(void) { hide = true; }
+	void Show(void) { hide = false; }
+	bool IsHidden(void) const { return hide; }
+	
+	void AddString(int x, int y, string s, draw_params p = draw_params());
+	void EditString(int index, string s);
+	
+	void SetCharacterCallback(charFunction cf) { charFunc = cf; }
+	void SetRenderCallback(renderFunction rf) { renderFunc = rf; }
+	
+	//convenience constructors
+	
+	Panel(string str, int id = -1, int x = 0, int y = 0) : Panel(id, x, y, str.length(), 1) {
+		AddString(0, 0, str);
+	}
+	
+	//if panel is touched, returns true and sets offset. Border returns an offset of (-1,-1)
+	bool Inside(int x, int y, int& ox, int& oy) const;
+	
+	void Render(render_info& info);
+};
+
+class Panels {
+private:
+	vector<shared_ptr<Panel>> panels;
+	
+public:
+	Panels() = default;
+	
+	void Add(shared_ptr<Panel> p) {
+		panels.push_back(p);
+	}
+	void Remove(shared_ptr<Panel> p) {
+		panels.erase(remove(panels.begin(), panels.end(), p), panels.end());
+	}
+	void RemoveAll(int id);
+	
+	shared_ptr<Panel> Get(int id) const;
+	
+	bool Inside(int x, int y, int& ox, int& oy, shared_ptr<Panel>& p) const;
+	
+	void Render(render_info& info) const;
+};
@@ -0,0 +1,356 @@
+#include "journal.hpp"
+#include "perf.hpp"
+#include <sstream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+//writes all of data, retrying short and interrupted writes. Returns true on error
+static bool WriteAll(int fd, const string& data) {
+	const char* p = data.data();
+	size_t n = data.size();
+	while (n > 0) {
+		ssize_t r = write(fd, p, n);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return true;
+		p += r, n -= r;
+	}
+	return false;
+}
+
+bool WriteFileAtomic(const string& path, const string& data) {
+	const string tmp = path + ".tmp";
+	int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return true;
+	
+	if (WriteAll(fd, data)) {
+		close(fd);
+		unlink(tmp.c_str());
+		return true;
+	}
+	
+	if (fsync(fd) != 0 || close(fd) != 0 || rename(tmp.c_str(), path.c_str()) != 0) {
+		unlink(tmp.c_str());
+		return true;
+	}
+	
+	//make the rename itself durable
+	const size_t slash = path.rfind('/');
+	const string dir = (slash == string::npos ? "." : path.substr(0, slash + 1));
+	int dfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+	if (dfd >= 0) {
+		fsync(dfd);
+		close(dfd);
+	}
+	return false;
+}
+
+//in-memory gzip, same format as SaveGrid() writes
+static string Gzip(const string& data) {
+	z_stream z = {};
+	deflateInit2(&z, 6, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+	
+	string out(deflateBound(&z, data.size()), '\0');
+	z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+	z.avail_in = data.size();
+	z.next_out = reinterpret_cast<Bytef*>(out.data());
+	z.avail_out = out.size();
+	deflate(&z, Z_FINISH);
+	out.resize(z.total_out);
+	deflateEnd(&z);
+	return out;
+}
+
+//serializes g the way it is stored at path, text is what the journal hash covers
+static string BoardFile(const Grid& g, const string& path, string& text) {
+	const bool compressed = EndsWith(path, ".gz");
+	ostringstream out;
+	g.Serialize(out, CompactPath(path));
+	text = out.str();
+	return compressed ? Gzip(text) : text;
+}
+
+//appends entries to the journal at path and syncs it. Returns true on error
+static bool AppendEntries(const string& path, const vector<string>& entries) {
+	string data;
+	for (const string& entry : entries)
+		data += entry;
+	
+	int fd = open(path.c_str(), O_WRONLY | O_APPEND);
+	if (fd < 0) return true;
+	const bool failed = WriteAll(fd, data) || (fsync(fd) != 0);
+	return (close(fd) != 0) || failed;
+}
+
+static string JournalHeader(uint64_t hash) {
+	char header[64];
+	snprintf(header, sizeof(header), "ttsim-journal %016llx\n", static_cast<unsigned long long>(hash));
+	return header;
+}
+
+
+// Journal
+
+bool Journal::Relative(const grid_path& path, grid_path& rel) const {
+	if (!bound || path.size() < root.size()) return false;
+	if (!equal(root.begin(), root.end(), path.begin())) return false;
+	rel.assign(path.begin() + root.size(), path.end());
+	return true;
+}
+
+void Journal::Invalidate(const grid_path& path) {
+	if (!bound || path.size() > root.size()) return;
+	if (!equal(path.begin(), path.end(), root.begin())) return;
+	Finish();
+	bound = false;
+	pending.clear();
+}
+
+void Journal::Record(char op, const grid_path& path, int x, int y, const string& payload) {
+	grid_path rel;
+	if (!Relative(path, rel)) return;
+	
+	string entry(1, op);
+	entry += " " + to_string(rel.size());
+	for (auto [px, py] : rel)
+		entry += " " + to_string(px) + " " + to_string(py);
+	entry += " " + to_string(x) + " " + to_string(y);
+	if (op == 'A')
+		entry += " " + to_string(payload.size()) + "\n" + payload;
+	else
+		entry += "\n";
+	
+	pending.push_back(move(entry));
+}
+
+void Journal::RecordAdd(const grid_path& path, int x, int y, const BaseTile& t) {
+	if (!bound) return;
+	//the tile is stored as a board holding only it, so nested contents come along
+	Grid single;
+	single.AddTile(x, y, t.Copy(single.Allocator()));
+	ostringstream out;
+	single.Serialize(out);
+	Record('A', path, x, y, out.str());
+}
+
+void Journal::RecordRemove(const grid_path& path, int x, int y) {
+	Record('R', path, x, y);
+}
+
+void Journal::RecordInterract(const grid_path& path, int x, int y) {
+	Record('I', path, x, y);
+}
+
+void Journal::Finish(void) {
+	if (compactor.joinable())
+		compactor.join();
+}
+
+bool Journal::Snapshot(const Grid& g, const string& path, const grid_path& at) {
+	Finish();
+	
+	string text;
+	const string data = BoardFile(g, path, text);
+	const uint64_t hash = ContentHash(text);
+	if (WriteFileAtomic(path, data) || WriteFileAtomic(PathFor(path), JournalHeader(hash)))
+		return true;
+	
+	board = path;
+	root = at;
+	bound = true;
+	entries = 0;
+	pending.clear();
+	return false;
+}
+
+bool Journal::Save(const Grid& g) {
+	if (!bound) return true;
+	
+	{
+		//edits saved during a compaction are appended by it once the new journal is written,
+		//at the latest when the journal is destroyed
+		lock_guard<mutex> lock(queue_lock);
+		if (compacting) {
+			queued.insert(queued.end(), make_move_iterator(pending.begin()), make_move_iterator(pending.end()));
+			pending.clear();
+			return false;
+		}
+	}
+	Finish();
+	if (compaction_failed) {
+		//the journal on disk may not match the board file anymore, the next save writes a snapshot
+		compaction_failed = false;
+		bound = false;
+		return true;
+	}
+	if (pending.empty()) return false;
+	
+	if (AppendEntries(PathFor(board), pending)) return true;
+	
+	entries += pending.size();
+	pending.clear();
+	
+	if (entries < compact_after) return false;
+	
+	//fold the journal into a new snapshot without blocking the editor
+	auto snapshot = make_shared<Grid>(g);
+	compacting = true;
+	compactor = thread([this, snapshot, path = board]() {
+		string text;
+		const string data = BoardFile(*snapshot, path, text);
+		const uint64_t hash = ContentHash(text);
+		//a crash between the two renames leaves a journal for the old hash, which is ignored
+		bool failed = WriteFileAtomic(path, data) || WriteFileAtomic(PathFor(path), JournalHeader(hash));
+		
+		lock_guard<mutex> lock(queue_lock);
+		if (!failed && !queued.empty())
+			failed = AppendEntries(PathFor(path), queued);
+		entries = (failed ? 0 : queued.size());
+		compaction_failed = failed;
+		queued.clear();
+		compacting = false;
+	});
+	return false;
+}
+
+bool Journal::Load(Grid& g, const string& path, const grid_path& at, parse_error& err) {
+	PerfScope perf(PERF_LOAD);
+	Finish();
+	bound = false;
+	pending.clear();
+	
+	string text;
+	if (ReadBoardFile(path, text)) {
+		err = {0, 0, "could not read file"};
+		return true;
+	}
+	
+	//the editor only reads the grids that are looked at or run
+	const uint64_t hash = ContentHash(text);
+	if (g.DeserializeLazy(move(text), err)) return true;
+	
+	const string header = JournalHeader(hash);
+	size_t replayed = 0;
+	
+	string journal;
+	ifstream jin(PathFor(path), ios::binary);
+	if (jin.is_open()) {
+		ostringstream buffer;
+		buffer << jin.rdbuf();
+		journal = buffer.str();
+	}
+	
+	if (journal.compare(0, header.size(), header) == 0) {
+		size_t pos = header.size();
+		
+		//replay until the end or until an entry cut short by a crash
+		while (pos < journal.size()) {
+			const size_t eol = journal.find('\n', pos);
+			if (eol == string::npos) break;
+			
+			istringstream line(journal.substr(pos, eol - pos));
+			char op;
+			size_t depth;
+			line >> op >> depth;
+			if (line.fail() || depth > journal.size()) break;
+			
+			grid_path rel(depth);
+			for (auto& [px, py] : rel)
+				line >> px >> py;
+			int x, y;
+			line >> x >> y;
+			
+			size_t next = eol + 1;
+			string payload;
+			if (op == 'A') {
+				size_t len;
+				line >> len;
+				if (line.fail() || next + len > journal.size()) break;
+				payload = journal.substr(next, len);
+				next += len;
+			}
+			if (line.fail()) break;
+			
+			//find the grid the edit was made in
+			Grid* target = &g;
+			for (auto [px, py] : rel) {
+				tile t = target->GetTile(px, py);
+				target = (t ? t->GetGrid() : nullptr);
+				if (target == nullptr) break;
+			}
+			if (target == nullptr) break;
+			
+			if (op == 'A') {
+				Grid single;
+				Scanner pin(payload.data(), payload.data() + payload.size());
+				if (single.Deserialize(pin) || !single.GetTile(x, y)) break;
+				target->AddTile(x, y, single.GetTile(x, y));
+			} else if (op == 'R') {
+				target->RemoveTile(x, y);
+			} else if (op == 'I') {
+				target->Interract(x, y);
+			} else {
+				break;
+			}
+			
+			pos = next;
+			replayed++;
+		}
+		
+		//drop a partial entry so later appends stay readable
+		if (pos < journal.size() && truncate(PathFor(path).c_str(), pos) != 0) {
+			err = {0, 0, "could not repair journal"};
+			return true;
+		}
+	} else if (WriteFileAtomic(PathFor(path), header)) {
+		//no journal for this snapshot yet
+		err = {0, 0, "could not write journal"};
+		return true;
+	}
+	
+	board = path;
+	root = at;
+	bound = true;
+	entries = replayed;
+	return false;
+}
+
+
+// Autosave
+
+void Autosave::Finish(void) {
+	if (writer.joinable())
+		writer.join();
+}
+
+void Autosave::SetPath(const string& path, uint64_t edits) {
+	Finish();
+	this->path = path;
+	written = 0;
+	saved = edits;
+}
+
+bool Autosave::Save(const Grid& g, uint64_t edits) {
+	if (edits == saved || writing) return false;
+	Finish();
+	const bool previous_failed = failed.exchange(false);
+	
+	//copying is all the editor waits for, serializing and syncing happen on the writer
+	auto snapshot = make_shared<Grid>(g);
+	saved = edits;
+	writing = true;
+	writer = thread([this, snapshot]() {
+		string text;
+		const string data = BoardFile(*snapshot, path, text);
+		const uint64_t hash = ContentHash(text);
+		if (hash != written) {
+			if (WriteFileAtomic(path, data))
+				failed = true;
+			else
+				written = hash;
+		}
+		writing = false;
+	});
+	return previous_failed;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include "tumble.hpp"
+
+using namespace std;
+
+//writes data to path.tmp, syncs it and renames it over path. Returns true on error
+bool WriteFileAtomic(const string& path, const string& data);
+
+//append-only log of edits made to a saved board, kept next to it as <board>.journal
+//saving appends the edits since the last save, the board file itself is only
+//rewritten by Snapshot() and by the background compaction
+class Journal {
+private:
+	//saved board and the position of its grid in the editor
+	string board;
+	grid_path root;
+	bool bound;
+	
+	//entries in the journal file
+	size_t entries;
+	
+	//edits not yet appended
+	vector<string> pending;
+	
+	thread compactor;
+	atomic<bool> compacting;
+	atomic<bool> compaction_failed;
+	//edits saved while compacting, the compactor appends them to the new journal
+	mutex queue_lock;
+	vector<string> queued;
+	
+	//path relative to root, false if the grid is not part of the saved board
+	bool Relative(const grid_path& path, grid_path& rel) const;
+	void Record(char op, const grid_path& path, int x, int y, const string& payload = "");
+	//waits for a running compaction
+	void Finish(void);
+	
+public:
+	//entries after which Save() rewrites the board in the background
+	static const size_t compact_after = 4096;
+	
+	Journal() : bound(false), entries(0), compacting(false), compaction_failed(false) {}
+	~Journal() { Finish(); }
+	
+	static string PathFor(const string& board) { return board + ".journal"; }
+	
+	//whether saving g at path would append to this journal
+	bool IsBound(const string& path, const grid_path& at) const {
+		return bound && board == path && root == at;
+	}
+	//forget the session if the grid at path is replaced or removed
+	void Invalidate(const grid_path& path);
+	
+	//edits made in the editor, path is the grid the edit happened in
+	void RecordAdd(const grid_path& path, int x, int y, const BaseTile& t);
+	void RecordRemove(const grid_path& path, int x, int y);
+	void RecordInterract(const grid_path& path, int x, int y);
+	
+	//writes a full snapshot of g and starts a new journal for it. Returns true on error
+	bool Snapshot(const Grid& g, const string& path, const grid_path& at);
+	//appends pending edits, g is the saved grid. Returns true on error, also for a failed
+	//background compaction, after which the next save writes a snapshot.
+	//Edits saved during a compaction are written when it ends
+	bool Save(const Grid& g);
+	//loads a snapshot and replays its journal on top. Returns true on error
+	bool Load(Grid& g, const string& path, const grid_path& at, parse_error& err);
+};
+
+//writes copies of a board to a file in the background, the caller only pays for
+//the copy. The caller counts the edits of the board, and nothing is copied while the
+//count is the one of the last copy
+class Autosave {
+private:
+	string path;
+	thread writer;
+	atomic<bool> writing;
+	atomic<bool> failed;
+	//hash of the last board written, only used by the writer
+	uint64_t written;
+	//edit count of the last board copied
+	uint64_t saved;
+	
+	//waits for a running write
+	void Finish(void);
+	
+public:
+	Autosave(const string& path) : path(path), writing(false), failed(false), written(0), saved(0) {}
+	~Autosave() { Finish(); }
+	
+	const string& Path(void) const { return path; }
+	uint64_t Saved(void) const { return saved; }
+	//writes to path from now on, the board as it is after edits is already in a file
+	void SetPath(const string& path, uint64_t edits);
+	
+	//starts writing a snapshot of g, skipped if edits did not change since the last one
+	//or while the last one is still being written. Returns true if the previous write failed
+	bool Save(const Grid& g, uint64_t edits);
+};
@@ -0,0 +1,73 @@
+#include "machine.hpp"
+
+// Runs
+
+MachineRun RunMachine(const FlatBoard& board, uint64_t max_ticks, uint32_t slice) {
+	FlatRunner runner(board);
+	uint64_t ticks = 0;
+	uint32_t marbles = 0;
+	uint32_t left = max(1u, slice);
+	
+	while (true) {
+		const int marble = co_yield machine_event{MACHINE_NEED_MARBLE, false, ticks, marbles};
+		if (marble < 0) break;
+		marbles++;
+		runner.AddMarble(marble ? 1 : -1, static_cast<short>(marble ? COLOR_RED : COLOR_BLUE));
+		
+		while (true) {
+			if (ticks == max_ticks) {
+				co_yield machine_event{MACHINE_DONE, false, ticks, marbles};
+				co_return;
+			}
+			ticks++;
+			collision_result result;
+			const bool done = runner.Update(0, result);
+			
+			if (result.output >= 0)
+				co_yield machine_event{MACHINE_OUTPUT, result.output > 0, ticks, marbles};
+			if (done) break;
+			if (--left == 0) {
+				left = max(1u, slice);
+				co_yield machine_event{MACHINE_SLICE, false, ticks, marbles};
+			}
+		}
+	}
+	co_yield machine_event{MACHINE_DONE, true, ticks, marbles};
+}
+
+
+// Scheduling
+
+uint64_t MachineScheduler::Add(const FlatBoard& board, vector<bool> input) {
+	const uint64_t id = next_id++;
+	ready.push_back({id, RunMachine(board, max_ticks, slice), move(input), 0});
+	return id;
+}
+
+void MachineScheduler::Run(const output_fn& output, const done_fn& done) {
+	while (!ready.empty()) {
+		task t = move(ready.front());
+		ready.pop_front();
+		
+		bool finished = false;
+		while (!finished) {
+			const machine_event& e = t.run.Next();
+			switch (e.type) {
+				case MACHINE_OUTPUT:
+					output(t.id, e.value);
+					break;
+				case MACHINE_NEED_MARBLE:
+					t.run.Give(t.next < t.input.size() ? t.input[t.next++] : -1);
+					break;
+				case MACHINE_SLICE:
+					ready.push_back(move(t));
+					finished = true;
+					break;
+				case MACHINE_DONE:
+					done(t.id, e);
+					finished = true;
+					break;
+			}
+		}
+	}
+}
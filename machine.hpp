@@ -0,0 +1,110 @@
+#pragma once
+
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include "flat.hpp"
+
+using namespace std;
+
+//Runs of a board as coroutines, so one thread can host thousands of them. A run
+//holds a FlatRunner on a shared FlatBoard and yields whenever its owner has to act:
+//for an output bit, for the next marble, at the end of a time slice and once at the
+//end. It never buffers outputs, so its memory is fixed by the board.
+
+enum machine_event_type : uint8_t {
+	MACHINE_OUTPUT,      //value is the output bit
+	MACHINE_NEED_MARBLE, //answer with Give() before resuming
+	MACHINE_SLICE,       //the time slice is used up
+	MACHINE_DONE         //value is false if the tick budget ran out
+};
+
+struct machine_event {
+	machine_event_type type;
+	bool value;
+	uint64_t ticks;   //ticks run so far
+	uint32_t marbles; //marbles dropped so far
+};
+
+class MachineRun {
+public:
+	struct promise_type {
+		machine_event event = {MACHINE_SLICE, false, 0, 0};
+		int marble = -1; //given for MACHINE_NEED_MARBLE, -1 when there are no more
+		
+		MachineRun get_return_object() { return MachineRun(coroutine_handle<promise_type>::from_promise(*this)); }
+		suspend_always initial_suspend() noexcept { return {}; }
+		suspend_always final_suspend() noexcept { return {}; }
+		void unhandled_exception() { terminate(); }
+		void return_void() {}
+		
+		//co_yield gives the marble handed over while suspended
+		auto yield_value(machine_event e) {
+			event = e;
+			struct awaiter {
+				promise_type& p;
+				bool await_ready() const noexcept { return false; }
+				void await_suspend(coroutine_handle<>) const noexcept {}
+				int await_resume() const noexcept { return p.marble; }
+			};
+			return awaiter{*this};
+		}
+	};
+	
+	MachineRun() = default;
+	MachineRun(MachineRun&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+	MachineRun& operator=(MachineRun&& other) noexcept {
+		if (this != &other) {
+			if (handle) handle.destroy();
+			handle = other.handle;
+			other.handle = nullptr;
+		}
+		return *this;
+	}
+	~MachineRun() { if (handle) handle.destroy(); }
+	
+	//runs until the next event, which stays valid until the next call. Not called after MACHINE_DONE
+	const machine_event& Next(void) {
+		handle.resume();
+		return handle.promise().event;
+	}
+	//the next marble after MACHINE_NEED_MARBLE, -1 to end the run
+	void Give(int marble) { handle.promise().marble = marble; }
+	bool Done(void) const { return handle.done(); }
+	
+private:
+	coroutine_handle<promise_type> handle;
+	
+	explicit MachineRun(coroutine_handle<promise_type> h) : handle(h) {}
+};
+
+//same semantics as FlatRunner::Run(), with at most slice ticks between yields
+MachineRun RunMachine(const FlatBoard& board, uint64_t max_ticks = 10000000, uint32_t slice = 1024);
+
+//round robin over runs on one thread, each run keeps going until its slice is used up
+class MachineScheduler {
+public:
+	typedef function<void(uint64_t id, bool value)> output_fn;
+	typedef function<void(uint64_t id, const machine_event& done)> done_fn;
+	
+	MachineScheduler(uint64_t max_ticks = 10000000, uint32_t slice = 1024) : max_ticks(max_ticks), slice(slice) {}
+	
+	//queues a run of board on input, returns its id. The board must outlive the run
+	uint64_t Add(const FlatBoard& board, vector<bool> input);
+	//runs until every run is done
+	void Run(const output_fn& output, const done_fn& done);
+	size_t Pending(void) const { return ready.size(); }
+	
+private:
+	struct task {
+		uint64_t id;
+		MachineRun run;
+		vector<bool> input;
+		size_t next; //input marbles given so far
+	};
+	
+	uint64_t max_ticks;
+	uint32_t slice;
+	uint64_t next_id = 0;
+	deque<task> ready;
+};
@@ -4,11 +4,17 @@
 #include <cmath>
 #include <deque>
 #include "tumble.hpp"
+#include "journal.hpp"
+#include "flat.hpp"
+#include "gui.hpp"
+#include "perf.hpp"
 //for graphics and input
 #include <ncurses.h>
-//for sleeping
-#include <thread>
-#include <chrono>
+//for waiting on input and timers
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
 
 using namespace std;
 
@@ -38,7 +44,30 @@ void ncurses_init(int& width, int& height, bool& color, bool& mouse) {
 	mouse = has_mouse();
 }
 
-int main() {
+//periodic timer, a period of 0 disarms it
+void timer_set(int fd, long period_ms) {
+	itimerspec spec = {};
+	spec.it_interval.tv_sec = period_ms / 1000;
+	spec.it_interval.tv_nsec = (period_ms % 1000) * 1000000;
+	spec.it_value = spec.it_interval;
+	timerfd_settime(fd, 0, &spec, nullptr);
+}
+
+//number of periods that passed since the last call
+uint64_t timer_expirations(int fd) {
+	uint64_t n = 0;
+	if (read(fd, &n, sizeof(n)) != sizeof(n)) return 0;
+	return n;
+}
+
+int main(int argc, char** argv) {
+	//-P counts hardware events per phase and prints them on exit
+	const bool profile = (argc > 1 && string(argv[1]) == "-P");
+	if (profile && PerfOpen()) {
+		cerr << "Hardware counters are not available, see /proc/sys/kernel/perf_event_paranoid" << endl;
+		return 1;
+	}
+	
 	render_info info;
 	bool hasmouse;
 	//start ncurses
@@ -95,13 +124,16 @@ int main() {
 	welcome.AddString(0,3, "F to recenter camera to (0,0)");
 	welcome.AddString(0,4, "Q to quit (without saving)");
 	welcome.AddString(0,5, "Enter to start simulation");
-	welcome.AddString(0,6, "Backspace to go back / abort");
-	welcome.AddString(0,7, "K / L to save or load the grid");
-	welcome.AddString(0,8, "right click to close menus");
-	welcome.AddString(0,9, "left click:", draw_params(COLOR_WHITE, true));
-	welcome.AddString(0,10, "- empty tile: open tile menu");
-	welcome.AddString(0,11, "- tile: interact");
-	welcome.AddString(0,12, "- tile + CTRL: open options");
+	welcome.AddString(0,6, "R instead to only show the output");
+	welcome.AddString(0,7, "Backspace to go back / pause / abort");
+	welcome.AddString(0,8, "K / L to save or load the grid");
+	welcome.AddString(0,9, "right click to close menus");
+	welcome.AddString(0,10, "left click:", draw_params(COLOR_WHITE, true));
+	welcome.AddString(0,11, "- empty tile: open tile menu");
+	welcome.AddString(0,12, "- tile: interact");
+	welcome.AddString(0,13, "- tile + CTRL: open options");
+	welcome.AddString(0,14, "+ / - to change simulation speed");
+	welcome.AddString(0,15, "edits are autosaved to <board>.autosave");
 	
 	
 	//tile grid
@@ -118,7 +150,11 @@ int main() {
 	// Constants
 	
 	const int move_amount = 1;
-	const int frames_per_tick = 5;
+	//milliseconds per tick for each simulation speed
+	const long tick_intervals[] = {1000, 500, 250, 100, 50, 20, 10, 5, 2, 1};
+	const int speeds = sizeof(tick_intervals) / sizeof(tick_intervals[0]);
+	const long blink_interval = 500;
+	const long autosave_interval = 30000;
 	
 	// Variables
 	
@@ -143,6 +179,18 @@ int main() {
 	int cx = 0, cy = 0;
 	Grid* g = &G;
 	vector<tuple<Grid*, int, int>> camera_stack;
+	//tiles entered to reach g, used to journal edits in nested grids
+	grid_path path;
+	Journal journal;
+	//next to the file the grid was last loaded from or saved to, in $TMPDIR before
+	const char* tmpdir = getenv("TMPDIR");
+	Autosave autosave(string(tmpdir && *tmpdir ? tmpdir : "/tmp") + "/ttsim-autosave.ttsim");
+	//changes of the grid, the autosave timer only runs while some are not autosaved
+	uint64_t edits = 0;
+	bool autosave_armed = false;
+	//G lowered for instant runs, patched on each edit once it was built
+	FlatBoard prepared;
+	bool prepared_valid = false;
 	//mouse and selected tile position
 	int mx, my, sx, sy;
 	bool selected = false;
@@ -151,9 +199,18 @@ int main() {
 	bool last_blink = false;
 	
 	//simulation variables
-	float time = 0;
-	int frame = 0, counter = 0;
-	bool running = false, start = false, stop = false;
+	int speed = 2;
+	bool running = false, start = false;
+	//a run stopped by backspace, which keeps its marbles, input and output
+	bool paused = false;
+	
+	//the loop sleeps until input arrives or one of the timers runs out
+	const int blink_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	const int tick_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	const int autosave_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	bool blink_on = false, blinking = false;
+	//redraw on the next pass
+	bool dirty = true;
 	
 	
 	//tile selection / deselection functions
@@ -172,6 +229,54 @@ int main() {
 		Panel pmsg(str, -1, x,y);
 		p.Add(make_shared<Panel>(pmsg));
 	};
+	//selection highlight starts dark and toggles every blink_interval
+	auto RestartBlink = [&blink_on, &blinking, blink_timer, blink_interval](void) -> void {
+		blink_on = false;
+		blinking = true;
+		timer_set(blink_timer, blink_interval);
+	};
+	
+	auto ShowOutput = [&p](const string& bits) -> void {
+		string out_str = "Output:";
+		Panel pout(-1, 0,0, max(bits.length(), out_str.length()),2);
+		pout.AddString(0,0, out_str);
+		pout.AddString(0,1, bits);
+		p.Add(make_shared<Panel>(pout));
+	};
+	
+	//counts an edit and starts the autosave timer if it is not running
+	auto Edited = [&edits, &autosave_armed, autosave_timer, autosave_interval](void) -> void {
+		edits++;
+		if (autosave_armed) return;
+		timer_set(autosave_timer, autosave_interval);
+		autosave_armed = true;
+	};
+	
+	//keeps prepared in step with the edits of grid, which path leads to
+	auto Watch = [&prepared, &prepared_valid, &Edited](Grid& grid, grid_path at) -> void {
+		grid.on_edit = [&prepared, &prepared_valid, &Edited, at](const Grid& edited, const grid_edit& e) {
+			Edited();
+			if (prepared_valid && prepared.Apply(edited, at, e))
+				prepared_valid = false;
+		};
+	};
+	Watch(G, {});
+	
+	//ends the run in progress or paused and shows its output
+	auto FinishRun = [&running, &paused, tick_timer, &G, &input_marbles, &output_marbles, &ShowOutput](void) -> void {
+		running = false;
+		paused = false;
+		timer_set(tick_timer, 0);
+		G.Reset();
+		input_marbles.clear();
+		
+		string out_str;
+		for (bool b : output_marbles)
+			out_str += (b ? '1' : '0');
+		output_marbles.clear();
+		ShowOutput(out_str);
+	};
+	
 	auto OpenStringInputBox = [&p, &input_string, &string_panel, &reading_string](int id, string str, int x = 0, int y = 0) -> void {
 		input_string = "";
 		Panel pinput(id, x,y, str.length(),2);
@@ -190,6 +295,7 @@ int main() {
 	while (true) {
 		//user input
 		while ((ch = getch()) != ERR) {
+			dirty = true;
 			//for string input panels
 			if (reading_string && ch != KEY_MOUSE) {
 				if (ch >= 32 && ch < 128) {
@@ -205,27 +311,30 @@ int main() {
 					reading_string = false;
 					p.RemoveAll(string_panel);
 					
-					ofstream save;
-					ifstream load;
+					string filename = input_string;
+					parse_error perr;
 					switch (string_panel) {
-						case 8: //save filename
-							save.open(input_string + ".ttsim");
-							if (!save.is_open()) {
-								ThrowMessage("Could not open \"" + input_string + "\"");
-								break;
-							}
-							g->Serialize(save);
-							save.close();
+						case 8: //save filename, .gz names are saved compressed
+							if (!EndsWith(filename, ".ttsim") && !EndsWith(filename, ".gz"))
+								filename += ".ttsim";
+							//saving the same board again only appends the edits
+							if (journal.IsBound(filename, path) ? journal.Save(*g) : journal.Snapshot(*g, filename, path))
+								ThrowMessage("Could not save \"" + filename + "\"");
+							else if (path.empty())
+								autosave.SetPath(filename + ".autosave", edits);
 							break;
 						case 9: //load filename
-							load.open(input_string);
-							if (!load.is_open()) {
-								ThrowMessage("Could not find \"" + input_string + "\"");
+							journal.Invalidate(path);
+							prepared_valid = false;
+							if (!journal.Load(*g, filename, path, perr)) {
+								if (path.empty()) autosave.SetPath(filename + ".autosave", edits);
 								break;
 							}
-							if (g->Deserialize(load))
-								ThrowMessage("Failed to parse \"" + input_string + "\"");
-							load.close();
+							if (perr.line == 0)
+								ThrowMessage("Could not load \"" + filename + "\": " + perr.message);
+							else
+								ThrowMessage("Failed to parse \"" + filename + "\" at line " + to_string(perr.line)
+									+ ", column " + to_string(perr.column) + ": " + perr.message);
 							break;
 						default:
 							ThrowMessage("Internal Error: Unsure what to do with this");
@@ -240,6 +349,7 @@ int main() {
 			switch (ch) {
 				case 'q':
 					endwin();
+					if (profile) cerr << PerfReport();
 					return 0;
 				case 'w':
 				case KEY_UP:
@@ -266,22 +376,61 @@ int main() {
 					cy = 0;
 					Deselect();
 					break;
-				//save / load
+				//simulation speed
+				case '+':
+				case '=':
+				case '-':
+					speed = max(0, min(speeds - 1, speed + (ch == '-' ? -1 : 1)));
+					if (running) timer_set(tick_timer, tick_intervals[speed]);
+					break;
+				//save / load, not with marbles on the board
 				case 'k':
-					if (!start_input && !reading_string) {
+					if (!start_input && !reading_string && !running && !paused) {
 						OpenStringInputBox(8, "Enter save filename");
 					}
 					break;
 				case 'l':
-					if (!start_input && !reading_string) {
+					if (!start_input && !reading_string && !running && !paused) {
 						OpenStringInputBox(9, "Enter load filename");
 					}
 					break;
+				//runs the input at once on the prepared board and shows only the output
+				case 'r':
+					if (running || !start_input) break;
+					start_input = false;
+					p.RemoveAll(1);
+					if (input_marbles.size() == 0) {
+						ThrowMessage("Error: No marbles specified");
+						break;
+					}
+					if (!prepared_valid) {
+						prepared.Build(G);
+						prepared.Compress();
+						prepared_valid = true;
+					}
+					{
+						vector<bool> input(input_marbles.begin(), input_marbles.end()), output;
+						const bool finished = FlatRunner(prepared).Run(input, output);
+						string out_str;
+						for (bool b : output)
+							out_str += (b ? '1' : '0');
+						ShowOutput(finished ? out_str : out_str + " (tick limit)");
+					}
+					break;
 				//input marble panel
 				case '0':
 				case '1':
 				case '\n':
 					if (running) break;
+					if (paused) {
+						//go on where the run was paused
+						if (ch != '\n') break;
+						p.RemoveAll(3);
+						paused = false;
+						running = true;
+						timer_set(tick_timer, tick_intervals[speed]);
+						break;
+					}
 					if (!start_input) {
 						p.RemoveAll(-1);
 						//clear input
@@ -315,7 +464,18 @@ int main() {
 						break;
 					}
 					if (running) {
-						stop = true;
+						running = false;
+						paused = true;
+						timer_set(tick_timer, 0);
+						Panel ppause(3, 0,0, 37,2);
+						ppause.AddString(0,0, "Paused, " + to_string(output_marbles.size()) + " outputs so far");
+						ppause.AddString(0,1, "Enter to continue, Backspace to abort");
+						p.Add(make_shared<Panel>(ppause));
+						break;
+					}
+					if (paused) {
+						p.RemoveAll(3);
+						FinishRun();
 						break;
 					}
 					if (!camera_stack.empty()) {
@@ -324,11 +484,12 @@ int main() {
 						cx = get<1>(b);
 						cy = get<2>(b);
 						camera_stack.pop_back();
+						path.pop_back();
 						break;
 					}
 					break;
 				case KEY_MOUSE:
-					if (running) break;
+					if (running || paused) break;
 					//process mouse input
 					if (getmouse(&mevent) == OK) {
 						//get mouse position
@@ -372,7 +533,9 @@ int main() {
 								const int off = oy * tmenu_size + ox;
 								if (off >= tiles.size()) break;
 								if (selt) break;
-								g->AddTile(wx, wy, tiles[off]->Copy());
+								tile nt = tiles[off]->Copy(g->Allocator());
+								g->AddTile(wx, wy, nt);
+								journal.RecordAdd(path, wx, wy, *nt);
 								Deselect();
 								break;
 							}
@@ -391,7 +554,9 @@ int main() {
 											break;
 										}
 										camera_stack.push_back({g, cx, cy});
+										path.push_back({wx, wy});
 										g = newg;
+										Watch(*g, path);
 										cx = 0;
 										cy = 0;
 										break;
@@ -409,12 +574,13 @@ int main() {
 							//interract with tile
 							if (t) {
 								if (!control_click) {
-									t->Interract();
+									g->Interract(wx, wy);
+									journal.RecordInterract(path, wx, wy);
 									Deselect();
 								} else {
 									//show tile options menu
 									Select(mx, my);
-									time = 0;
+									RestartBlink();
 									tile_opt_menu->Show();
 									tile_opt_menu->Move(mx+1, my+1);
 								}
@@ -422,19 +588,25 @@ int main() {
 							}
 							if (selected) {
 								if (copying) {
-									g->AddTile(wx, wy, selt->Copy());
+									tile nt = selt->Copy(g->Allocator());
+									g->AddTile(wx, wy, nt);
+									journal.RecordAdd(path, wx, wy, *nt);
 								}
 								Deselect();
 								break;
 							}
 							//select empty tile and show menu
 							Select(mx, my);
-							time = 0;
+							RestartBlink();
 							tile_menu->Show();
 							tile_menu->Move(mx+1, my+1);
 						} else {
 							//right click
 							if (!selected) {
+								grid_path removed = path;
+								removed.push_back({wx, wy});
+								journal.Invalidate(removed);
+								journal.RecordRemove(path, wx, wy);
 								g->RemoveTile(wx, wy);
 							}
 							Deselect();
@@ -445,29 +617,28 @@ int main() {
 		}
 		
 		
-		//Rendering
+		// Simulation
 		
-		bool blink = (time >= 0.5 || running);
-		short blink_color = (copying ? COLOR_BLUE+8 : COLOR_YELLOW+8);
-		g->Render(info, cx, cy, blink, selected ? sx : -1, sy, blink_color);
-		if (blink && !last_blink) {
-			for (auto it = tiles.begin(); it != tiles.end(); it++)
-				(*it)->Interract();
+		if (blinking && timer_expirations(blink_timer) % 2 == 1) {
+			blink_on = !blink_on;
+			dirty = true;
+		}
+		//stop the highlight timer once nothing is selected
+		if (blinking && !selected) {
+			blinking = false;
+			blink_on = false;
+			timer_set(blink_timer, 0);
 		}
-		last_blink = blink;
-		
-		
-		// Simulation
 		
-		if (running) {
-			counter++;
-			if (counter >= frames_per_tick) {
-				counter = 0;
-				
+		uint64_t ticks = (running ? timer_expirations(tick_timer) : 0);
+		if (ticks > 0) {
+			//one scope for all the ticks since the last frame, not one per tick
+			PerfScope perf(PERF_TICK);
+			for (; ticks > 0 && running; ticks--) {
+				dirty = true;
 				bool inside = false;
 				do {
 					//tick scene
-					frame++;
 					collision_result result;
 					bool add_marble = G.Update(result);
 					
@@ -477,62 +648,89 @@ int main() {
 					
 					inside = result.inside_tile;
 					
-					if (add_marble || stop) {
+					if (add_marble) {
 						inside = false;
-						if (input_marbles.size() > 0 && !stop) {
+						if (input_marbles.size() > 0) {
 							//get next input marble
 							bool m = input_marbles.front();
 							input_marbles.pop_front();
 							G.AddMarble(m ? 1 : -1, static_cast<short>(m ? COLOR_RED : COLOR_BLUE));
 						} else {
 							//simulation is done
-							running = false;
-							stop = false;
-							G.Reset();
-							
-							//print output on panel
-							string out_str = "Output:";
-							Panel pout(-1, 0,0, max(output_marbles.size(), out_str.length()),2);
-							pout.AddString(0,0, out_str);
-							
-							out_str = "";
-							for (bool b : output_marbles)
-								out_str += (b ? '1' : '0');
-							pout.AddString(0,1, out_str);
-							output_marbles.clear();
-							
-							p.Add(make_shared<Panel>(pout));
+							FinishRun();
 						}
 					}
 				} while (inside);
 			}
-		} else {
-			p.Render(info);
-			//start logic
-			if (start) {
-				start = false;
-				running = true;
-				Deselect();
-				p.RemoveAll(-1);
-				//ensure clean start
-				G.Reset();
-				output_marbles.clear();
-				//get next input marble
-				bool m = input_marbles.front();
-				input_marbles.pop_front();
-				G.AddMarble(m ? 1 : -1, static_cast<short>(m ? COLOR_RED : COLOR_BLUE));
+		}
+		
+		//the copy is cheap, the writing happens in the background. Once all edits are
+		//copied the timer stops, so an idle editor is not woken
+		if (timer_expirations(autosave_timer) > 0) {
+			if (autosave.Save(G, edits)) {
+				ThrowMessage("Could not autosave \"" + autosave.Path() + "\"");
+				dirty = true;
+			}
+			if (autosave.Saved() == edits) {
+				timer_set(autosave_timer, 0);
+				autosave_armed = false;
+			}
+		}
+		
+		//start logic
+		if (start) {
+			start = false;
+			running = true;
+			dirty = true;
+			Deselect();
+			p.RemoveAll(-1);
+			//ensure clean start
+			G.Reset();
+			output_marbles.clear();
+			//get next input marble
+			bool m = input_marbles.front();
+			input_marbles.pop_front();
+			G.AddMarble(m ? 1 : -1, static_cast<short>(m ? COLOR_RED : COLOR_BLUE));
+			timer_set(tick_timer, tick_intervals[speed]);
+		}
+		
+		
+		//Rendering
+		
+		if (dirty) {
+			PerfScope perf(PERF_RENDER);
+			dirty = false;
+			bool blink = (blink_on || running);
+			short blink_color = (copying ? COLOR_BLUE+8 : COLOR_YELLOW+8);
+			g->Render(info, cx, cy, blink, selected ? sx : -1, sy, blink_color);
+			if (blink && !last_blink) {
+				for (auto it = tiles.begin(); it != tiles.end(); it++)
+					(*it)->Interract();
 			}
+			last_blink = blink;
+			
+			if (!running) p.Render(info);
+			refresh();
 		}
 		
-		refresh();
 		
-		this_thread::sleep_for(chrono::milliseconds(49));
-		time += 0.05;
-		if (time > 1) time = 0;
+		// Waiting
+		
+		pollfd fds[4] = {
+			{STDIN_FILENO, POLLIN, 0},
+			{blink_timer, POLLIN, 0},
+			{tick_timer, POLLIN, 0},
+			{autosave_timer, POLLIN, 0},
+		};
+		//interrupted by SIGWINCH on resize, getch() then returns KEY_RESIZE
+		if (poll(fds, 4, -1) < 0 && errno != EINTR) break;
+		//terminal went away
+		if (fds[0].revents & (POLLHUP | POLLERR | POLLNVAL)) break;
 	}
 	
 	//stop ncurses
 	endwin();
 	
+	if (profile) cerr << PerfReport();
 	return 0;
 }
@@ -0,0 +1,252 @@
+// ttsim-opt: removes tiles that cannot affect a board's outputs
+//
+// A tile is kept if a marble can reach it or if it carries a gear turn. Reachability
+// is over-approximated: bits may send a marble either way and a marble may leave a
+// nested grid in either direction. Gear bits and nested grids that only pass a turn
+// along become gears. Marble paths in a grid are fixed by its geometry, so for fewer
+// ticks the board is also compressed into a FlatBoard whose marbles skip tiles that
+// only steer them. Both results are checked against the original board on random
+// inputs before anything is written, and the ticks per marble are reported.
+
+#include <iostream>
+#include <set>
+#include <tuple>
+#include <random>
+#include <cstdio>
+#include "tumble.hpp"
+#include "flat.hpp"
+
+using namespace std;
+
+struct opt_stats {
+	size_t removed = 0; //tiles removed, including the contents of removed grids
+	size_t geared = 0;  //gear bits and grids replaced by gears
+};
+
+static size_t CountTiles(const Grid& g) {
+	size_t n = 0;
+	for (auto& [pos, t] : g.SortedTiles()) {
+		n++;
+		if (t->GetGrid()) n += CountTiles(*t->GetGrid());
+	}
+	return n;
+}
+
+//cells a marble can enter, marbles start at the drop going either way
+static unordered_set<pair<int, int>, IntPairHash> Reachable(const Grid& g) {
+	unordered_set<pair<int, int>, IntPairHash> reached;
+	set<tuple<int, int, int>> visited = {{0, 0, -1}, {0, 0, 1}};
+	vector<tuple<int, int, int>> stack(visited.begin(), visited.end());
+	
+	while (!stack.empty()) {
+		auto [x, y, dir] = stack.back();
+		stack.pop_back();
+		
+		x += dir, y++;
+		tile t = g.GetTile(x, y);
+		if (t == nullptr) continue;
+		reached.insert({x, y});
+		
+		vector<int> next;
+		const int param = t->GetParameter();
+		switch (t->GetType()) {
+			case TILE_RAMP:
+				next = {param >= 0 ? 1 : -1};
+				break;
+			case TILE_BIT:
+			case TILE_GEARBIT:
+				next = (param == 0 ? vector<int>{1} : vector<int>{-1, 1});
+				break;
+			case TILE_GRID:
+				next = {-1, 1};
+				break;
+			case TILE_EXIT:
+			case TILE_LOOP:
+				//loops restart at the drop, which is already visited
+				break;
+			default:
+				next = {dir};
+				break;
+		}
+		
+		for (int d : next)
+			if (visited.insert({x, y, d}).second)
+				stack.push_back({x, y, d});
+	}
+	return reached;
+}
+
+//tiles whose Turn() has an effect and that a turn can get to. Turns start at
+//reached gear bits and grids, and at the drop when a parent turns this grid
+static unordered_set<pair<int, int>, IntPairHash> Turned(const Grid& g, const unordered_set<pair<int, int>, IntPairHash>& reached) {
+	const int directions[4][2] = {{1,0}, {0,1}, {-1,0}, {0,-1}};
+	auto Propagates = [](tile_type type) {
+		return type == TILE_GEAR || type == TILE_GEARBIT || type == TILE_GRID;
+	};
+	
+	unordered_set<pair<int, int>, IntPairHash> turned;
+	vector<pair<int, int>> stack = {{0, 0}};
+	for (auto& pos : reached) {
+		tile t = g.GetTile(pos.first, pos.second);
+		if (t->GetType() == TILE_GEARBIT || t->GetType() == TILE_GRID)
+			stack.push_back(pos);
+	}
+	
+	while (!stack.empty()) {
+		auto [x, y] = stack.back();
+		stack.pop_back();
+		
+		for (auto& dir : directions) {
+			const int i = x + dir[0], j = y + dir[1];
+			tile t = g.GetTile(i, j);
+			if (t == nullptr) continue;
+			
+			const tile_type type = t->GetType();
+			if (!Propagates(type) && type != TILE_DROP && type != TILE_EXIT) continue;
+			if (!turned.insert({i, j}).second) continue;
+			if (Propagates(type)) stack.push_back({i, j});
+		}
+	}
+	return turned;
+}
+
+static void Optimize(Grid& g, opt_stats& stats) {
+	const auto reached = Reachable(g);
+	const auto turned = Turned(g, reached);
+	
+	vector<pair<int, int>> positions;
+	for (auto& [pos, t] : g.SortedTiles())
+		positions.push_back(pos);
+	
+	for (auto [x, y] : positions) {
+		tile t = g.GetTile(x, y);
+		if (x == 0 && y == 0) continue;
+		
+		if (reached.count({x, y})) {
+			if (t->GetGrid()) Optimize(*t->GetGrid(), stats);
+			continue;
+		}
+		
+		if (!turned.count({x, y})) {
+			stats.removed += 1 + (t->GetGrid() ? CountTiles(*t->GetGrid()) : 0);
+			g.RemoveTile(x, y);
+			continue;
+		}
+		
+		//never collided with, so its state does not matter
+		if (t->GetType() == TILE_GEARBIT || t->GetType() == TILE_GRID) {
+			stats.geared++;
+			stats.removed += (t->GetGrid() ? CountTiles(*t->GetGrid()) : 0);
+			g.AddTile(x, y, g.NewTile<GearTile>());
+		}
+	}
+}
+
+static string Bits(const vector<bool>& bits) {
+	string s;
+	for (bool b : bits)
+		s += b ? '1' : '0';
+	return s;
+}
+
+int main(int argc, char** argv) {
+	string input, output;
+	uint64_t runs = 2000, max_ticks = 1000000, seed = 1;
+	int max_length = 32;
+	
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		const bool has_value = (i + 1 < argc);
+		if (arg == "-o" && has_value)
+			output = argv[++i];
+		else if (arg == "-r" && has_value)
+			runs = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-l" && has_value)
+			max_length = max(1, atoi(argv[++i]));
+		else if (arg == "-t" && has_value)
+			max_ticks = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-s" && has_value)
+			seed = strtoull(argv[++i], nullptr, 10);
+		else if (input.empty() && arg[0] != '-')
+			input = arg;
+		else {
+			input.clear();
+			break;
+		}
+	}
+	if (input.empty()) {
+		cerr << "usage: " << argv[0] << " board.ttsim [-o out.ttsim] [-r runs] [-l max_length] [-t max_ticks] [-s seed]" << endl;
+		return 1;
+	}
+	
+	Grid original;
+	parse_error err;
+	if (LoadGrid(original, input, err)) {
+		cerr << input << ":" << err.line << ":" << err.column << ": " << err.message << endl;
+		return 1;
+	}
+	
+	Grid optimized = original;
+	opt_stats stats;
+	Optimize(optimized, stats);
+	
+	FlatBoard board(optimized);
+	board.Compress();
+	FlatRunner runner(board);
+	
+	//differential runs, ticks are counted per marble
+	mt19937_64 rng(seed);
+	uniform_int_distribution<int> lengths(1, max_length);
+	uint64_t marbles = 0, stuck = 0, ticks_before = 0, ticks_after = 0;
+	
+	for (uint64_t run = 0; run < runs; run++) {
+		vector<bool> in(lengths(rng));
+		for (size_t i = 0; i < in.size(); i++)
+			in[i] = rng() & 1;
+		
+		vector<bool> out[3];
+		bool finished[3] = {true, true, true};
+		original.Reset();
+		optimized.Reset();
+		runner.Reset();
+		
+		for (bool value : in) {
+			uint64_t ticks[3] = {max_ticks, max_ticks, max_ticks};
+			finished[0] = original.Drop(value, out[0], ticks[0]);
+			finished[1] = optimized.Drop(value, out[1], ticks[1]);
+			finished[2] = runner.Drop(value, out[2], ticks[2]);
+			
+			if (!finished[0] || !finished[1] || !finished[2]) {
+				stuck++;
+				break;
+			}
+			marbles++;
+			ticks_before += max_ticks - ticks[0];
+			ticks_after += max_ticks - ticks[2];
+		}
+		
+		//a compressed tick covers more cells, so a stuck marble gets further there
+		const bool compare_compressed = finished[0] && finished[2];
+		if (out[0] != out[1] || finished[0] != finished[1] || (compare_compressed && out[0] != out[2])) {
+			cerr << "Optimized board differs for input " << Bits(in) << ": " << Bits(out[0]) << " / " << Bits(out[1]) << " / " << Bits(out[2]) << endl;
+			return 1;
+		}
+	}
+	original.Reset();
+	optimized.Reset();
+	
+	const size_t tiles = CountTiles(original);
+	printf("tiles: %zu -> %zu (%zu removed, %zu turned into gears)\n", tiles, CountTiles(optimized), stats.removed, stats.geared);
+	if (marbles > 0)
+		printf("ticks per marble: %.2f -> %.2f compressed\n", double(ticks_before) / marbles, double(ticks_after) / marbles);
+	if (stuck > 0)
+		printf("%llu marbles did not leave the board within %llu ticks\n", static_cast<unsigned long long>(stuck), static_cast<unsigned long long>(max_ticks));
+	printf("checked %llu random inputs of 1 to %d marbles, outputs identical\n", static_cast<unsigned long long>(runs), max_length);
+	
+	if (output.empty()) return 0;
+	if (SaveGrid(optimized, output)) {
+		cerr << "Could not write \"" << output << "\"" << endl;
+		return 1;
+	}
+	return 0;
+}
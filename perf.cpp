@@ -0,0 +1,195 @@
+#include "perf.hpp"
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+thread_local bool perf_enabled = false;
+
+static const char* const perf_phase_names[PERF_PHASES] = {"load", "tick", "turn", "render"};
+static const char* const perf_counter_names[PERF_COUNTERS] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+static const uint64_t perf_counter_configs[PERF_COUNTERS] = {
+	PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+};
+
+struct perf_state {
+	int fd[PERF_COUNTERS];      //-1 for counters the machine does not have
+	int slot[PERF_COUNTERS];    //position in the group read, -1 if not opened
+	bool counted[PERF_COUNTERS]; //opened by the last PerfOpen(), kept after closing for the report
+	int leader = -1;
+	int members = 0;
+	uint64_t last[PERF_COUNTERS];
+	uint64_t enabled_ns = 0, running_ns = 0; //running < enabled if the kernel multiplexed the group
+	vector<perf_phase> stack;
+	perf_counts phases[PERF_PHASES];
+	
+	perf_state() {
+		for (int i = 0; i < PERF_COUNTERS; i++)
+			fd[i] = slot[i] = -1;
+		Clear();
+	}
+	~perf_state() { Close(); }
+	
+	void Clear(void) {
+		memset(counted, 0, sizeof(counted));
+		memset(last, 0, sizeof(last));
+		memset(phases, 0, sizeof(phases));
+		stack.clear();
+	}
+	
+	void Close(void) {
+		for (int i = 0; i < PERF_COUNTERS; i++) {
+			if (fd[i] >= 0) close(fd[i]);
+			fd[i] = slot[i] = -1;
+		}
+		leader = -1;
+		members = 0;
+		stack.clear();
+	}
+	
+	//reads the whole group at once, returns true on error
+	bool Read(uint64_t now[PERF_COUNTERS]) {
+		//nr, time enabled, time running, then one value per member
+		uint64_t buf[3 + PERF_COUNTERS];
+		const ssize_t size = static_cast<ssize_t>((3 + members) * sizeof(uint64_t));
+		if (read(leader, buf, size) != size) return true;
+		
+		enabled_ns = buf[1];
+		running_ns = buf[2];
+		for (int i = 0; i < PERF_COUNTERS; i++)
+			now[i] = (slot[i] >= 0 ? buf[3 + slot[i]] : 0);
+		return false;
+	}
+	
+	//adds the counts since the last phase change to phase p
+	void Charge(perf_phase p, const uint64_t now[PERF_COUNTERS]) {
+		for (int i = 0; i < PERF_COUNTERS; i++) {
+			phases[p].value[i] += now[i] - last[i];
+			last[i] = now[i];
+		}
+	}
+};
+
+static thread_local perf_state perf_thread;
+
+bool PerfOpen(void) {
+	perf_state& s = perf_thread;
+	s.Close();
+	s.Clear();
+	
+	for (int i = 0; i < PERF_COUNTERS; i++) {
+		perf_event_attr attr = {};
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = perf_counter_configs[i];
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		//user space only, allowed at perf_event_paranoid 2 and leaves out the reads themselves
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		
+		const int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, s.leader, 0));
+		if (fd < 0) continue;
+		s.fd[i] = fd;
+		s.slot[i] = s.members++;
+		s.counted[i] = true;
+		if (s.leader < 0) s.leader = fd;
+	}
+	if (s.leader < 0) return true;
+	
+	if (s.Read(s.last)) {
+		s.Close();
+		s.Clear();
+		return true;
+	}
+	perf_enabled = true;
+	return false;
+}
+
+void PerfClose(void) {
+	perf_enabled = false;
+	perf_thread.Close();
+}
+
+void PerfEnter(perf_phase p) {
+	perf_state& s = perf_thread;
+	s.phases[p].calls++;
+	//entering the same phase again changes nothing, saves a read for nested turns and loads
+	if (!s.stack.empty() && s.stack.back() == p) {
+		s.stack.push_back(p);
+		return;
+	}
+	
+	uint64_t now[PERF_COUNTERS];
+	if (s.Read(now)) return PerfClose();
+	//the time before belongs to the enclosing phase, or to none
+	if (!s.stack.empty())
+		s.Charge(s.stack.back(), now);
+	else
+		memcpy(s.last, now, sizeof(now));
+	s.stack.push_back(p);
+}
+
+void PerfLeave(void) {
+	perf_state& s = perf_thread;
+	//closed inside the scope
+	if (s.stack.empty()) return;
+	
+	const perf_phase p = s.stack.back();
+	s.stack.pop_back();
+	if (!s.stack.empty() && s.stack.back() == p) return;
+	
+	uint64_t now[PERF_COUNTERS];
+	if (s.Read(now)) return PerfClose();
+	s.Charge(p, now);
+}
+
+const perf_counts& PerfCounts(perf_phase p) {
+	return perf_thread.phases[p];
+}
+
+string PerfReport(bool json) {
+	const perf_state& s = perf_thread;
+	ostringstream out;
+	
+	if (json) {
+		out << "{";
+		for (int p = 0; p < PERF_PHASES; p++) {
+			out << (p ? "," : "") << "\"" << perf_phase_names[p] << "\":{\"calls\":" << s.phases[p].calls;
+			for (int i = 0; i < PERF_COUNTERS; i++) {
+				out << ",\"" << perf_counter_names[i] << "\":";
+				if (s.counted[i]) out << s.phases[p].value[i];
+				else out << "null";
+			}
+			out << "}";
+		}
+		out << ",\"running_fraction\":" << (s.enabled_ns ? static_cast<double>(s.running_ns) / s.enabled_ns : 1.0) << "}\n";
+		return out.str();
+	}
+	
+	out << left << setw(8) << "phase" << right << setw(12) << "calls";
+	for (int i = 0; i < PERF_COUNTERS; i++)
+		out << setw(16) << perf_counter_names[i];
+	out << setw(8) << "ipc" << "\n";
+	
+	for (int p = 0; p < PERF_PHASES; p++) {
+		const perf_counts& c = s.phases[p];
+		out << left << setw(8) << perf_phase_names[p] << right << setw(12) << c.calls;
+		for (int i = 0; i < PERF_COUNTERS; i++) {
+			if (s.counted[i]) out << setw(16) << c.value[i];
+			else out << setw(16) << "-";
+		}
+		const uint64_t cycles = c.value[PERF_CYCLES];
+		if (s.counted[PERF_CYCLES] && s.counted[PERF_INSTRUCTIONS] && cycles > 0)
+			out << setw(8) << fixed << setprecision(2) << static_cast<double>(c.value[PERF_INSTRUCTIONS]) / cycles;
+		else
+			out << setw(8) << "-";
+		out << "\n";
+	}
+	if (s.running_ns < s.enabled_ns)
+		out << "counters were multiplexed and ran " << fixed << setprecision(1)
+			<< 100.0 * s.running_ns / s.enabled_ns << "% of the time, counts are not scaled\n";
+	return out.str();
+}
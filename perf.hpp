@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+using namespace std;
+
+//Hardware counters of the calling thread, read with perf_event_open and split by
+//phase. Opt-in: until PerfOpen() succeeds a PerfScope costs one test. Phases are
+//exclusive, a turn inside the tick loop counts for the turn and not for the tick.
+//Each phase change reads the counters with a system call, so the tick loop is
+//measured as a whole and only turns, which are rarer, get a scope of their own.
+//ttsim-run enters the tick phase once per marble, once for the whole run with -i and
+//every 65536 ticks with -c. The editor enters it once per frame, for all the ticks
+//since the last one.
+
+enum perf_phase : uint8_t {
+	PERF_LOAD,   //reading and parsing boards, including nested grids loaded on first use
+	PERF_TICK,   //the tick loop, without turns
+	PERF_TURN,   //Grid::TurnConnected()
+	PERF_RENDER, //drawing the editor
+	PERF_PHASES
+};
+
+enum perf_counter : uint8_t {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_COUNTERS
+};
+
+struct perf_counts {
+	uint64_t value[PERF_COUNTERS];
+	uint64_t calls; //times the phase was entered, nested entries included
+};
+
+//set while this thread is counting
+extern thread_local bool perf_enabled;
+
+void PerfEnter(perf_phase p);
+void PerfLeave(void);
+
+//starts counting on this thread, returns true if no counter could be opened
+bool PerfOpen(void);
+void PerfClose(void);
+//counts of this thread so far
+const perf_counts& PerfCounts(perf_phase p);
+//table of the counts per phase, or JSON with one object per phase
+string PerfReport(bool json = false);
+
+//counts the enclosing block as phase p
+class PerfScope {
+private:
+	bool active;
+	
+public:
+	explicit PerfScope(perf_phase p) : active(perf_enabled) {
+		if (active) PerfEnter(p);
+	}
+	~PerfScope() {
+		if (active) PerfLeave();
+	}
+	PerfScope(const PerfScope&) = delete;
+	PerfScope& operator=(const PerfScope&) = delete;
+};
@@ -0,0 +1,427 @@
+// ttsim-reach: searches the states a board can be put in by some input
+//
+// A state is what a board keeps between marbles: the direction of every bit and
+// gear bit, nested grids included, packed one bit each, plus the marbles of nested
+// grids still inside a tile, which is rare. From each state a blue and a red marble
+// lead to the next ones, and the states are searched breadth first from the start,
+// so the first input found for a question is a shortest one. Each level of the
+// search is shared out between -j threads, which insert the states they reach into
+// a set split in shards with a lock each. The order of the states does not depend
+// on the threads, so the answers do not either.
+//
+// The questions are:
+//   -s target.ttsim  can the bits be put in the states they have on target, which
+//                    must be the same board apart from bit states
+//   -o pattern       can the outputs contain pattern, for example 01 for a 1 after
+//                    a 0. The position in the pattern becomes part of the state
+// Without a question the search counts the reachable states.
+//
+// A marble that does not leave the board within -t ticks ends its branch, and the
+// answer is only a limit result when no input is found, as the branch may have gone
+// on. The search stops after inputs of -d marbles or when its states need more than
+// -m megabytes.
+//
+// Exit status is 0 if an input was found, or all states were counted, 1 if none
+// exists, 2 on errors and 3 if a limit stopped the search first or cut branches.
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <array>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+#include "tumble.hpp"
+#include "flat.hpp"
+
+using namespace std;
+
+struct reach_options {
+	unsigned workers = max(1u, thread::hardware_concurrency());
+	uint64_t max_ticks = 1000000;
+	uint64_t max_bytes = 1024ull << 20;
+	uint32_t max_depth = UINT32_MAX;
+	string target, pattern;
+};
+
+//how a state was first reached
+struct reach_state {
+	uint32_t parent; //index of the state before, UINT32_MAX for the start
+	uint32_t depth;
+	bool value;      //color of the marble from parent
+};
+
+typedef unordered_map<string, reach_state>::value_type reach_node;
+
+//states seen so far, split in shards so threads rarely wait on the same lock
+class StateSet {
+private:
+	static const int shard_count = 64;
+	struct shard {
+		mutex lock;
+		unordered_map<string, reach_state> states;
+	};
+	shard shards[shard_count];
+	
+public:
+	atomic<uint64_t> bytes{0}; //rough memory used by the states
+	
+	//adds key reached from parent with value, returns the node if the key is new.
+	//A key reached twice on the same level keeps the first parent in search order
+	reach_node* Insert(const string& key, const reach_state& s) {
+		shard& sh = shards[hash<string>()(key) % shard_count];
+		lock_guard<mutex> guard(sh.lock);
+		auto [it, added] = sh.states.try_emplace(key, s);
+		if (added) {
+			//the node with its hash, link and allocation header, a bucket and a place in the search order
+			bytes += sizeof(reach_node) + 6 * sizeof(void*) + (key.size() > 15 ? key.size() + 1 : 0);
+			return &*it;
+		}
+		reach_state& old = it->second;
+		if (old.depth == s.depth && make_pair(s.parent, s.value) < make_pair(old.parent, old.value))
+			old.parent = s.parent, old.value = s.value;
+		return nullptr;
+	}
+};
+
+
+// States
+
+//marbles are packed as they are, which needs them free of padding
+static_assert(sizeof(flat_marble) == 5 * sizeof(int32_t), "flat_marble has padding");
+
+//board state between marbles in a compact, comparable form
+class StatePacker {
+private:
+	flat_view board;
+	vector<flat_marble> idle; //marbles after Reset()
+	
+public:
+	explicit StatePacker(const flat_view& board) : board(board) {
+		FlatRunner r(board);
+		idle = r.Marbles();
+	}
+	
+	//one bit per bit state, the pattern position, then the nested marbles still inside a tile.
+	//The root marble and nested ones outside a tile are overwritten before they are read again
+	void Pack(const vector<int8_t>& bits, const vector<flat_marble>& marbles, uint8_t matched, string& key) const {
+		key.assign((bits.size() + 7) / 8, '\0');
+		for (size_t i = 0; i < bits.size(); i++)
+			if (bits[i] > 0) key[i / 8] |= static_cast<char>(1 << (i % 8));
+		key += static_cast<char>(matched);
+		
+		for (uint32_t i = 1; i < marbles.size(); i++) {
+			if (!marbles[i].inside) continue;
+			key.append(reinterpret_cast<const char*>(&i), sizeof(i));
+			key.append(reinterpret_cast<const char*>(&marbles[i]), sizeof(flat_marble));
+		}
+	}
+	
+	void Unpack(const string& key, vector<int8_t>& bits, vector<flat_marble>& marbles, uint8_t& matched) const {
+		bits.resize(board.initial_bits.size());
+		for (size_t i = 0; i < bits.size(); i++)
+			bits[i] = ((key[i / 8] >> (i % 8)) & 1) ? 1 : -1;
+		size_t p = (bits.size() + 7) / 8;
+		matched = static_cast<uint8_t>(key[p++]);
+		
+		marbles = idle;
+		while (p < key.size()) {
+			uint32_t i;
+			memcpy(&i, key.data() + p, sizeof(i));
+			memcpy(&marbles[i], key.data() + p + sizeof(i), sizeof(flat_marble));
+			p += sizeof(i) + sizeof(flat_marble);
+		}
+	}
+};
+
+//positions in pattern, as a KMP automaton over output bits
+class PatternMatcher {
+private:
+	vector<array<uint8_t, 2>> next;
+	
+public:
+	explicit PatternMatcher(const string& pattern) : next(pattern.size() + 1) {
+		uint8_t fallback = 0;
+		for (size_t i = 0; i <= pattern.size(); i++) {
+			for (int b = 0; b < 2; b++) {
+				if (i < pattern.size() && pattern[i] - '0' == b) next[i][b] = static_cast<uint8_t>(i + 1);
+				else next[i][b] = (i == 0 ? 0 : next[fallback][b]);
+			}
+			if (i > 0 && i < pattern.size()) fallback = next[fallback][pattern[i] - '0'];
+		}
+	}
+	
+	//returns the position after bit, Length() once the pattern was seen
+	uint8_t Step(uint8_t pos, bool bit) const { return next[pos][bit]; }
+	uint8_t Length(void) const { return static_cast<uint8_t>(next.size() - 1); }
+};
+
+
+// Search
+
+enum reach_result {
+	REACH_FOUND,
+	REACH_NONE,
+	REACH_LIMIT
+};
+
+struct reach_stats {
+	uint64_t states = 0;
+	uint32_t depth = 0;     //longest shortest input to a state
+	uint32_t searched = 0;  //every input of up to this many marbles was followed
+	uint64_t stuck = 0;     //marbles that did not leave the board in time
+	bool memory = false;    //the memory cap stopped the search
+	bool ticks = false;     //all states were searched, but some branches ended with stuck marbles
+};
+
+class Search {
+private:
+	flat_view board;
+	const reach_options& opt;
+	StatePacker packer;
+	PatternMatcher matcher;
+	const vector<int8_t>* target;
+	
+	StateSet set;
+	vector<reach_node*> states; //in search order, parents come first
+	
+	//whether a marble answers the question. Bit states count once it left the board,
+	//outputs as soon as they are made
+	bool Goal(const vector<int8_t>& bits, uint8_t matched, bool done) const {
+		if (target) return done && bits == *target;
+		return !opt.pattern.empty() && matched == matcher.Length();
+	}
+	
+public:
+	reach_stats stats;
+	vector<bool> witness;
+	
+	Search(const flat_view& board, const reach_options& opt, const vector<int8_t>* target)
+		: board(board), opt(opt), packer(board), matcher(opt.pattern), target(target) {}
+	
+	reach_result Run(void) {
+		FlatRunner start(board);
+		string key;
+		packer.Pack(start.Bits(), start.Marbles(), 0, key);
+		states.push_back(set.Insert(key, {UINT32_MAX, 0, false}));
+		if (Goal(start.Bits(), 0, true)) return REACH_FOUND;
+		
+		size_t begin = 0;
+		for (uint32_t depth = 1; begin < states.size(); depth++) {
+			if (depth > opt.max_depth) return REACH_LIMIT;
+			const size_t end = states.size();
+			
+			atomic<size_t> next(begin);
+			atomic<bool> full(false);
+			mutex lock;
+			vector<reach_node*> found;
+			uint32_t goal = UINT32_MAX; //2 * parent + value of the first goal in search order
+			atomic<uint64_t> stuck(0);
+			
+			auto Worker = [&](void) {
+				FlatRunner runner(board);
+				vector<int8_t> bits;
+				vector<flat_marble> marbles;
+				vector<bool> output;
+				vector<reach_node*> added;
+				uint32_t first_goal = UINT32_MAX;
+				string next_key;
+				
+				for (size_t i = next++; i < end && !full; i = next++) {
+					uint8_t matched;
+					packer.Unpack(states[i]->first, bits, marbles, matched);
+					for (bool value : {false, true}) {
+						runner.Restore(bits, marbles);
+						output.clear();
+						uint64_t ticks = opt.max_ticks;
+						const bool done = runner.Drop(value, output, ticks);
+						
+						uint8_t m = matched;
+						for (bool b : output)
+							if (m < matcher.Length()) m = matcher.Step(m, b);
+						const uint32_t edge = static_cast<uint32_t>(2 * i + value);
+						if (Goal(runner.Bits(), m, done)) {
+							first_goal = min(first_goal, edge);
+							continue;
+						}
+						if (!done) {
+							stuck++;
+							continue;
+						}
+						
+						packer.Pack(runner.Bits(), runner.Marbles(), m, next_key);
+						reach_node* n = set.Insert(next_key, {static_cast<uint32_t>(i), depth, value});
+						if (n) added.push_back(n);
+					}
+					if (set.bytes > opt.max_bytes) full = true;
+				}
+				
+				lock_guard<mutex> guard(lock);
+				found.insert(found.end(), added.begin(), added.end());
+				goal = min(goal, first_goal);
+			};
+			
+			//narrow levels, as in counters, cost less than starting threads for them
+			const size_t threads = min<size_t>(opt.workers, (end - begin + 255) / 256);
+			if (threads <= 1) {
+				Worker();
+			} else {
+				vector<thread> workers;
+				for (size_t w = 0; w < threads; w++)
+					workers.emplace_back(Worker);
+				for (thread& t : workers)
+					t.join();
+			}
+			stats.stuck += stuck;
+			
+			if (goal != UINT32_MAX) {
+				witness.push_back(goal & 1);
+				for (uint32_t s = goal / 2; states[s]->second.parent != UINT32_MAX; s = states[s]->second.parent)
+					witness.push_back(states[s]->second.value);
+				reverse(witness.begin(), witness.end());
+				return REACH_FOUND;
+			}
+			if (full) {
+				stats.states = states.size() + found.size();
+				stats.memory = true;
+				return REACH_LIMIT;
+			}
+			
+			//the order a single thread would have found them in
+			sort(found.begin(), found.end(), [](const reach_node* a, const reach_node* b) {
+				return make_pair(a->second.parent, a->second.value) < make_pair(b->second.parent, b->second.value);
+			});
+			if (states.size() + found.size() >= UINT32_MAX / 2) {
+				stats.memory = true;
+				return REACH_LIMIT;
+			}
+			states.insert(states.end(), found.begin(), found.end());
+			stats.states = states.size();
+			if (!found.empty()) stats.depth = depth;
+			stats.searched = depth;
+			begin = end;
+		}
+		stats.states = states.size();
+		if (stats.stuck == 0) return REACH_NONE;
+		stats.ticks = true;
+		return REACH_LIMIT;
+	}
+};
+
+//whether a and b are the same board apart from the states of bits that flip
+static bool SameLayout(const FlatBoard& a, const FlatBoard& b) {
+	if (a.grids.size() != b.grids.size() || a.tiles.size() != b.tiles.size() || a.slots.size() != b.slots.size()
+		|| a.initial_bits.size() != b.initial_bits.size())
+		return false;
+	for (size_t i = 0; i < a.tiles.size(); i++) {
+		const flat_tile& x = a.tiles[i];
+		const flat_tile& y = b.tiles[i];
+		const bool flips = (x.type == TILE_BIT || x.type == TILE_GEARBIT) && x.arg >= 0;
+		if (x.type != y.type || x.arg != y.arg || x.turn != y.turn || x.color != y.color || (!flips && x.dir != y.dir))
+			return false;
+	}
+	for (size_t i = 0; i < a.grids.size(); i++)
+		if (a.grids[i].slot_mask != b.grids[i].slot_mask)
+			return false;
+	for (size_t i = 0; i < a.slots.size(); i++)
+		if (a.slots[i].tile != b.slots[i].tile || (a.slots[i].tile >= 0 && (a.slots[i].x != b.slots[i].x || a.slots[i].y != b.slots[i].y)))
+			return false;
+	return true;
+}
+
+static string Bits(const vector<bool>& bits) {
+	string s;
+	for (bool b : bits)
+		s += b ? '1' : '0';
+	return s;
+}
+
+int main(int argc, char** argv) {
+	string file;
+	reach_options opt;
+	bool usage = false;
+	
+	for (int i = 1; i < argc && !usage; i++) {
+		string arg = argv[i];
+		const bool has_value = (i + 1 < argc);
+		if (arg == "-s" && has_value)
+			opt.target = argv[++i];
+		else if (arg == "-o" && has_value)
+			opt.pattern = argv[++i];
+		else if (arg == "-d" && has_value)
+			opt.max_depth = static_cast<uint32_t>(max(0, atoi(argv[++i])));
+		else if (arg == "-m" && has_value)
+			opt.max_bytes = strtoull(argv[++i], nullptr, 10) << 20;
+		else if (arg == "-j" && has_value)
+			opt.workers = max(1, atoi(argv[++i]));
+		else if (arg == "-t" && has_value)
+			opt.max_ticks = strtoull(argv[++i], nullptr, 10);
+		else if (arg[0] != '-' && file.empty())
+			file = arg;
+		else
+			usage = true;
+	}
+	const bool bad_pattern = opt.pattern.size() > 200 || opt.pattern.find_first_not_of("01") != string::npos;
+	if (usage || file.empty() || bad_pattern || (!opt.target.empty() && !opt.pattern.empty())) {
+		cerr << "usage: " << argv[0] << " board.ttsim [-s target.ttsim | -o pattern] [-d max_depth] [-m max_megabytes] [-j workers] [-t max_ticks]" << endl;
+		return 2;
+	}
+	
+	Grid g;
+	parse_error err;
+	if (LoadGrid(g, file, err)) {
+		cerr << file << ":" << err.line << ":" << err.column << ": " << err.message << endl;
+		return 2;
+	}
+	const FlatBoard board(g);
+	
+	vector<int8_t> target;
+	if (!opt.target.empty()) {
+		Grid tg;
+		if (LoadGrid(tg, opt.target, err)) {
+			cerr << opt.target << ":" << err.line << ":" << err.column << ": " << err.message << endl;
+			return 2;
+		}
+		const FlatBoard target_board(tg);
+		if (!SameLayout(board, target_board)) {
+			cerr << opt.target << " differs from " << file << " in more than bit states" << endl;
+			return 2;
+		}
+		target = target_board.initial_bits;
+	}
+	
+	Search search(board.View(), opt, opt.target.empty() ? nullptr : &target);
+	const reach_result result = search.Run();
+	const reach_stats& stats = search.stats;
+	
+	if (result == REACH_FOUND) {
+		if (!opt.target.empty()) cout << "Target state";
+		else if (!opt.pattern.empty()) cout << "Output " << opt.pattern;
+		cout << " reached after input " << Bits(search.witness) << " (" << search.witness.size() << " marbles)" << endl;
+		
+		vector<bool> output;
+		FlatRunner(board).Run(search.witness, output, opt.max_ticks * max<size_t>(1, search.witness.size()));
+		cout << "output: " << Bits(output) << endl;
+		return 0;
+	}
+	
+	if (result == REACH_LIMIT && stats.ticks) {
+		cout << "Inconclusive, " << stats.states << " states searched, each within " << stats.depth
+			<< " marbles of the start, but the tick limit cut some inputs short" << endl;
+	} else if (result == REACH_LIMIT) {
+		cout << "Stopped by the " << (stats.memory ? "memory" : "depth") << " limit after " << stats.states
+			<< " states, inputs of up to " << stats.searched << " marbles searched" << endl;
+	} else {
+		if (opt.target.empty() && opt.pattern.empty()) cout << "All ";
+		else cout << "Not reachable, all ";
+		cout << stats.states << " reachable states searched, each within " << stats.depth << " marbles of the start" << endl;
+	}
+	if (stats.stuck > 0)
+		cout << stats.stuck << " marbles did not leave the board within " << opt.max_ticks << " ticks and were not followed" << endl;
+	
+	if (result == REACH_LIMIT) return 3;
+	return (opt.target.empty() && opt.pattern.empty()) ? 0 : 1;
+}
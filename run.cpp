@@ -0,0 +1,601 @@
+// ttsim-run: runs a board on inputs read from stdin, one per line of 0s and 1s,
+// and prints the outputs of each line
+//
+// With -m the run's metrics are written to a file, or to stdout for "-", every -p
+// seconds and once more at the end. Files are replaced atomically so a scraper
+// never reads half a snapshot. -f selects JSON (one object per snapshot) or the
+// Prometheus text exposition format.
+//
+// With -i all lines are read first and run at the same time on one thread, each as a
+// coroutine on a FlatBoard that yields every -s ticks. Outputs are still printed in
+// input order, each line as soon as it and the lines before it are done. A FlatBoard
+// does not count gear turns, flips and nesting depth, so -i and -c metrics leave them
+// out: null in JSON, no samples in the Prometheus format.
+//
+// -P counts cycles, instructions, cache misses and branch misses with the hardware
+// counters and prints them per phase (load, tick loop, gear turns) to stderr at the end.
+//
+// With -c the run writes a checkpoint to a file every -k seconds, and when it gets
+// SIGINT or SIGTERM before exiting: the machine state, marbles still on the board
+// included, the position in the input and the output so far. -r resumes from the
+// checkpoint if there is one, with the same board and input. The output of the lines
+// finished before the checkpoint is not printed again: when stdout is a file that
+// holds at least what it held when the run started and what the run printed up to the
+// checkpoint after that, as with >>, it is cut back to that and the resumed run appends
+// to it, so the file is the same as that of a run that was never stopped. The
+// checkpoint is removed when the run completes. Checkpointed runs use a FlatBoard, like
+// -i, and look at the clock every 65536 ticks.
+
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "tumble.hpp"
+#include "journal.hpp"
+#include "flat.hpp"
+#include <fcntl.h>
+#include "machine.hpp"
+#include "perf.hpp"
+
+using namespace std;
+
+struct run_metrics {
+	uint64_t inputs = 0;     //input lines run
+	uint64_t unfinished = 0; //inputs stopped by the tick limit
+	uint64_t ticks = 0;
+	uint64_t marbles = 0;
+	uint64_t outputs = 0;
+};
+
+class MetricsWriter {
+private:
+	string path; //empty for none, "-" for stdout
+	bool prometheus;
+	bool counted; //whether the engine counts gear turns, flips and nesting depth
+	chrono::steady_clock::time_point start, next;
+	chrono::milliseconds period;
+	
+	string Counted(uint64_t value) const {
+		return (counted ? to_string(value) : "null");
+	}
+	
+	string Format(const run_metrics& m, bool done) const {
+		const double wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		const double rate = (wall > 0 ? m.ticks / wall : 0);
+		
+		rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		const uint64_t peak = static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+		
+		ostringstream out;
+		if (!prometheus) {
+			out << "{\"inputs\":" << m.inputs << ",\"unfinished\":" << m.unfinished
+				<< ",\"ticks\":" << m.ticks << ",\"marbles\":" << m.marbles << ",\"outputs\":" << m.outputs
+				<< ",\"turns\":" << Counted(sim_stats.turns) << ",\"flips\":" << Counted(sim_stats.flips)
+				<< ",\"max_depth\":" << Counted(sim_stats.max_depth) << ",\"peak_memory_bytes\":" << peak
+				<< ",\"wall_seconds\":" << wall << ",\"ticks_per_second\":" << rate
+				<< ",\"done\":" << (done ? "true" : "false") << "}\n";
+			return out.str();
+		}
+		
+		auto Metric = [&out](const char* name, const char* type, const char* help, auto value) {
+			out << "# HELP " << name << " " << help << "\n";
+			out << "# TYPE " << name << " " << type << "\n";
+			out << name << " " << value << "\n";
+		};
+		Metric("ttsim_inputs_total", "counter", "Input lines run.", m.inputs);
+		Metric("ttsim_unfinished_total", "counter", "Inputs stopped by the tick limit.", m.unfinished);
+		Metric("ttsim_ticks_total", "counter", "Simulation ticks.", m.ticks);
+		Metric("ttsim_marbles_total", "counter", "Marbles dropped.", m.marbles);
+		Metric("ttsim_outputs_total", "counter", "Output bits emitted.", m.outputs);
+		if (counted) {
+			Metric("ttsim_turns_total", "counter", "Gear turns propagated.", sim_stats.turns);
+			Metric("ttsim_flips_total", "counter", "Gear bits flipped by turns.", sim_stats.flips);
+			Metric("ttsim_max_depth", "gauge", "Deepest nested grid a marble reached.", sim_stats.max_depth);
+		}
+		Metric("ttsim_peak_memory_bytes", "gauge", "Peak resident memory.", peak);
+		Metric("ttsim_wall_seconds", "gauge", "Time since the run started.", wall);
+		Metric("ttsim_ticks_per_second", "gauge", "Average simulation speed.", rate);
+		Metric("ttsim_running", "gauge", "1 while the run is in progress.", done ? 0 : 1);
+		return out.str();
+	}
+	
+public:
+	MetricsWriter(const string& path, bool prometheus, double period_s, bool counted)
+		: path(path), prometheus(prometheus), counted(counted), start(chrono::steady_clock::now()),
+		period(static_cast<long>(period_s * 1000)) {
+		next = start + period;
+	}
+	
+	//writes a snapshot if the period has passed, cheap enough to call often
+	void Poll(const run_metrics& m) {
+		if (path.empty() || chrono::steady_clock::now() < next) return;
+		Write(m, false);
+		next = chrono::steady_clock::now() + period;
+	}
+	
+	//returns true on error
+	bool Write(const run_metrics& m, bool done) {
+		if (path.empty()) return false;
+		const string data = Format(m, done);
+		if (path != "-") return WriteFileAtomic(path, data);
+		cout << data << flush;
+		return false;
+	}
+};
+
+//same as Grid::Run(), counting as it goes
+static bool RunInput(Grid& g, const vector<bool>& input, vector<bool>& output, uint64_t max_ticks, run_metrics& m, MetricsWriter& writer) {
+	g.Reset();
+	uint64_t ticks = 0;
+	bool finished = true;
+	
+	for (size_t i = 0; i < input.size() && finished; i++) {
+		g.AddMarble(input[i] ? 1 : -1, static_cast<short>(input[i] ? COLOR_RED : COLOR_BLUE));
+		m.marbles++;
+		PerfScope perf(PERF_TICK);
+		
+		while (true) {
+			if (ticks++ >= max_ticks) {
+				finished = false;
+				break;
+			}
+			m.ticks++;
+			if ((m.ticks & 0xfff) == 0) writer.Poll(m);
+			
+			collision_result result;
+			bool done = g.Update(result);
+			if (result.output >= 0) {
+				output.push_back(result.output > 0);
+				m.outputs++;
+			}
+			if (done) break;
+		}
+	}
+	
+	g.Reset();
+	m.inputs++;
+	if (!finished) m.unfinished++;
+	return finished;
+}
+
+typedef function<void(const vector<bool>& out, bool finished)> print_fn;
+
+//runs every input at once, interleaved by the scheduler. The output of a line is
+//printed as soon as it and all lines before it are done
+static void RunInterleaved(const Grid& g, const vector<vector<bool>>& inputs, uint64_t max_ticks, uint32_t slice,
+		run_metrics& m, MetricsWriter& writer, const print_fn& print) {
+	const FlatBoard board(g);
+	MachineScheduler scheduler(max_ticks, slice);
+	for (const vector<bool>& in : inputs)
+		scheduler.Add(board, in);
+	
+	vector<vector<bool>> outputs(inputs.size());
+	vector<char> done_lines(inputs.size(), false), finished(inputs.size(), false);
+	size_t next = 0; //first line not printed
+	PerfScope perf(PERF_TICK);
+	scheduler.Run([&](uint64_t id, bool value) {
+		outputs[id].push_back(value);
+		m.outputs++;
+	}, [&](uint64_t id, const machine_event& done) {
+		done_lines[id] = true;
+		finished[id] = done.value;
+		m.inputs++;
+		m.ticks += done.ticks;
+		m.marbles += done.marbles;
+		if (!done.value) m.unfinished++;
+		writer.Poll(m);
+		
+		if (id != next) return;
+		for (; next < inputs.size() && done_lines[next]; next++) {
+			print(outputs[next], finished[next]);
+			vector<bool>().swap(outputs[next]);
+		}
+		cout << flush;
+	});
+}
+
+
+// Checkpoints
+
+//set by SIGINT and SIGTERM while a checkpointed run is going
+static volatile sig_atomic_t stop_requested = 0;
+
+static void RequestStop(int) {
+	stop_requested = 1;
+}
+
+//everything needed to go on with a run as if it had never stopped
+struct run_checkpoint {
+	uint64_t board = 0;      //ContentHash() of the serialized board
+	uint64_t max_ticks = 0;
+	uint64_t start = 0;      //offset of stdout when the run started
+	uint64_t printed = 0;    //bytes the finished lines printed after it
+	vector<uint64_t> lines;  //LineHash() of each finished line
+	uint64_t line_hash = 0;  //of the current line
+	uint64_t marbles = 0;    //marbles of the current line dropped
+	bool rolling = false;    //the last one is still on the board
+	uint64_t ticks = 0;      //ticks the current line used
+	run_metrics metrics;
+	vector<bool> output;     //output of the current line so far
+	string state;            //FlatRunner::Save()
+};
+
+static const uint32_t checkpoint_magic = 0x33435454; //"TTC3"
+
+//host byte order, in the order of the fields above, vectors after their size. The
+//output is packed 8 bits a byte
+static string SerializeCheckpoint(const run_checkpoint& c) {
+	string data;
+	auto Put = [&data](const auto& v) {
+		data.append(reinterpret_cast<const char*>(&v), sizeof(v));
+	};
+	Put(checkpoint_magic);
+	Put(c.board), Put(c.max_ticks), Put(c.start), Put(c.printed), Put(static_cast<uint64_t>(c.lines.size()));
+	data.append(reinterpret_cast<const char*>(c.lines.data()), c.lines.size() * sizeof(uint64_t));
+	Put(c.line_hash), Put(c.marbles), Put(static_cast<uint8_t>(c.rolling)), Put(c.ticks);
+	Put(c.metrics.inputs), Put(c.metrics.unfinished), Put(c.metrics.ticks), Put(c.metrics.marbles), Put(c.metrics.outputs);
+	Put(static_cast<uint64_t>(c.output.size()));
+	string packed((c.output.size() + 7) / 8, '\0');
+	for (size_t i = 0; i < c.output.size(); i++)
+		if (c.output[i]) packed[i / 8] |= static_cast<char>(1 << (i % 8));
+	data += packed;
+	data += c.state;
+	return data;
+}
+
+//returns true if data is not a checkpoint
+static bool DeserializeCheckpoint(const string& data, run_checkpoint& c) {
+	size_t p = 0;
+	auto Get = [&data, &p](auto& v) {
+		if (data.size() - p < sizeof(v)) return false;
+		memcpy(&v, data.data() + p, sizeof(v));
+		p += sizeof(v);
+		return true;
+	};
+	auto GetHashes = [&data, &p, &Get](vector<uint64_t>& v) {
+		uint64_t size = 0;
+		if (!Get(size) || (data.size() - p) / sizeof(uint64_t) < size) return false;
+		v.resize(size);
+		memcpy(v.data(), data.data() + p, size * sizeof(uint64_t));
+		p += size * sizeof(uint64_t);
+		return true;
+	};
+	
+	uint32_t magic = 0;
+	uint8_t rolling = 0;
+	uint64_t outputs = 0;
+	if (!Get(magic) || magic != checkpoint_magic) return true;
+	if (!Get(c.board) || !Get(c.max_ticks) || !Get(c.start) || !Get(c.printed) || !GetHashes(c.lines)
+		|| !Get(c.line_hash) || !Get(c.marbles) || !Get(rolling) || !Get(c.ticks)
+		|| !Get(c.metrics.inputs) || !Get(c.metrics.unfinished) || !Get(c.metrics.ticks) || !Get(c.metrics.marbles) || !Get(c.metrics.outputs)
+		|| !Get(outputs) || outputs > 8 * (data.size() - p))
+		return true;
+	c.rolling = rolling;
+	c.output.resize(outputs);
+	for (size_t i = 0; i < outputs; i++)
+		c.output[i] = (data[p + i / 8] >> (i % 8)) & 1;
+	p += (outputs + 7) / 8;
+	c.state = data.substr(p);
+	return false;
+}
+
+static uint64_t BoardHash(const Grid& g) {
+	ostringstream out;
+	g.Serialize(out);
+	return ContentHash(out.str());
+}
+
+static uint64_t LineHash(const vector<bool>& input) {
+	string s;
+	for (bool b : input)
+		s += (b ? '1' : '0');
+	return ContentHash(s);
+}
+
+//where the run's output starts in stdout, the end of the file when it is appended to
+static uint64_t StdoutOffset(void) {
+	struct stat st;
+	if (fstat(STDOUT_FILENO, &st) != 0 || !S_ISREG(st.st_mode)) return 0;
+	if (fcntl(STDOUT_FILENO, F_GETFL) & O_APPEND) return st.st_size;
+	const off_t offset = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+	return (offset > 0 ? offset : 0);
+}
+
+//a run on a FlatBoard that can be stopped and resumed at any tick
+class ResumableRun {
+private:
+	string path;
+	chrono::steady_clock::time_point next;
+	chrono::milliseconds period;
+	FlatBoard board;
+	FlatRunner runner;
+	run_checkpoint c;
+	bool resumed = false;      //a checkpoint was loaded
+	bool resumed_line = false; //the current line was read from the checkpoint
+	
+public:
+	ResumableRun(const Grid& g, const string& path, double period_s, uint64_t max_ticks)
+		: path(path), next(chrono::steady_clock::now()), period(static_cast<long>(period_s * 1000)), board(g), runner(board) {
+		next += period;
+		c.board = BoardHash(g);
+		c.max_ticks = max_ticks;
+		c.start = StdoutOffset();
+	}
+	
+	//loads the checkpoint, if there is one. Returns true on error, described in err
+	bool Resume(string& err) {
+		string data;
+		if (ReadBoardFile(path, data)) return false;
+		run_checkpoint loaded;
+		if (DeserializeCheckpoint(data, loaded)) err = "is not a checkpoint";
+		else if (loaded.board != c.board) err = "is of another board";
+		else if (loaded.max_ticks != c.max_ticks) err = "was made with -t " + to_string(loaded.max_ticks);
+		else if ((loaded.marbles > 0 || loaded.rolling) && runner.Load(loaded.state.data(), loaded.state.size())) err = "does not fit the board";
+		if (!err.empty()) return true;
+		
+		c = loaded;
+		resumed = true;
+		resumed_line = (c.marbles > 0 || c.rolling);
+		return false;
+	}
+	
+	//whether Resume() loaded a checkpoint, the lines it had finished, the offset in
+	//stdout after what they printed and the metrics so far
+	bool Resumed(void) const { return resumed; }
+	uint64_t Lines(void) const { return c.lines.size(); }
+	uint64_t Printed(void) const { return c.start + c.printed; }
+	const run_metrics& Metrics(void) const { return c.metrics; }
+	
+	//checks a line skipped because the checkpoint had finished it, returns true if it
+	//differs from the line the checkpointed run read there
+	bool Skip(const vector<bool>& input, uint64_t index) const {
+		return LineHash(input) != c.lines[index];
+	}
+	
+	//writes the checkpoint, returns true on error
+	bool Write(const run_metrics& m) {
+		//what is counted as printed must be out before a checkpoint says so
+		cout << flush;
+		c.metrics = m;
+		c.state.clear();
+		runner.Save(c.state);
+		next = chrono::steady_clock::now() + period;
+		return WriteFileAtomic(path, SerializeCheckpoint(c));
+	}
+	
+	//runs a line like RunInput(), from where the checkpoint left it if it stopped in
+	//this line. Returns false if the line was stopped by a signal, after writing the
+	//checkpoint, or does not match the checkpoint
+	bool Run(const vector<bool>& input, vector<bool>& output, bool& finished, run_metrics& m, MetricsWriter& writer) {
+		if (resumed_line) {
+			if (LineHash(input) != c.line_hash) return false;
+			output = c.output;
+		} else {
+			runner.Reset();
+			c.line_hash = LineHash(input);
+			c.marbles = 0, c.rolling = false, c.ticks = 0;
+			output.clear();
+		}
+		resumed_line = false;
+		
+		finished = true;
+		while (true) {
+			if (!c.rolling) {
+				if (c.marbles == input.size()) break;
+				const bool value = input[c.marbles++];
+				runner.AddMarble(value ? 1 : -1, static_cast<short>(value ? COLOR_RED : COLOR_BLUE));
+				c.rolling = true;
+				m.marbles++;
+			}
+			
+			const uint64_t budget = min<uint64_t>(c.max_ticks - c.ticks, 1 << 16);
+			if (budget == 0) {
+				finished = false;
+				break;
+			}
+			uint64_t ticks = budget;
+			const size_t before = output.size();
+			{
+				PerfScope perf(PERF_TICK);
+				if (runner.Continue(output, ticks)) c.rolling = false;
+			}
+			c.ticks += budget - ticks;
+			m.ticks += budget - ticks;
+			m.outputs += output.size() - before;
+			writer.Poll(m);
+			
+			if (stop_requested || chrono::steady_clock::now() >= next) {
+				c.output = output;
+				if (Write(m)) cerr << "Could not write the checkpoint \"" << path << "\"" << endl;
+				if (stop_requested) return false;
+			}
+		}
+		
+		runner.Reset();
+		m.inputs++;
+		if (!finished) m.unfinished++;
+		return true;
+	}
+	
+	//records a finished line and the bytes it printed
+	void Finish(const vector<bool>& input, uint64_t printed) {
+		c.lines.push_back(LineHash(input));
+		c.printed += printed;
+		c.marbles = 0, c.rolling = false, c.ticks = 0;
+		c.output.clear();
+	}
+	
+	void Remove(void) { remove(path.c_str()); }
+};
+
+//cuts stdout back to the offset after what was printed up to the checkpoint, if it is
+//a file holding at least that much, and appends after it. Returns true if not
+static bool TruncateOutput(uint64_t printed) {
+	const off_t size = static_cast<off_t>(printed);
+	struct stat st;
+	if (fstat(STDOUT_FILENO, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < size) return true;
+	return ftruncate(STDOUT_FILENO, size) != 0 || lseek(STDOUT_FILENO, size, SEEK_SET) != size;
+}
+
+int main(int argc, char** argv) {
+	string input, metrics, checkpoint;
+	uint64_t max_ticks = 10000000;
+	uint32_t slice = 1024;
+	bool prometheus = false, quiet = false, interleave = false, profile = false, resume = false;
+	double period = 5, checkpoint_period = 60;
+	
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		const bool has_value = (i + 1 < argc);
+		if (arg == "-t" && has_value)
+			max_ticks = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-m" && has_value)
+			metrics = argv[++i];
+		else if (arg == "-f" && has_value) {
+			const string format = argv[++i];
+			if (format != "json" && format != "prometheus") {
+				input.clear();
+				break;
+			}
+			prometheus = (format == "prometheus");
+		} else if (arg == "-p" && has_value)
+			period = max(0.1, atof(argv[++i]));
+		else if (arg == "-q")
+			quiet = true;
+		else if (arg == "-i")
+			interleave = true;
+		else if (arg == "-s" && has_value)
+			slice = max(1, atoi(argv[++i]));
+		else if (arg == "-P")
+			profile = true;
+		else if (arg == "-c" && has_value)
+			checkpoint = argv[++i];
+		else if (arg == "-k" && has_value)
+			checkpoint_period = max(0.1, atof(argv[++i]));
+		else if (arg == "-r")
+			resume = true;
+		else if (input.empty() && arg[0] != '-')
+			input = arg;
+		else {
+			input.clear();
+			break;
+		}
+	}
+	if (input.empty() || (!checkpoint.empty() && interleave) || (resume && checkpoint.empty())) {
+		cerr << "usage: " << argv[0] << " board.ttsim [-t max_ticks] [-m metrics|-] [-f json|prometheus] [-p seconds] [-q] [-i [-s slice_ticks]] [-P]"
+			<< " [-c checkpoint [-k seconds] [-r]]" << endl;
+		return 1;
+	}
+	if (profile && PerfOpen()) {
+		cerr << "Hardware counters are not available, see /proc/sys/kernel/perf_event_paranoid" << endl;
+		return 1;
+	}
+	
+	Grid g;
+	parse_error err;
+	if (LoadGrid(g, input, err)) {
+		cerr << input << ":" << err.line << ":" << err.column << ": " << err.message << endl;
+		return 1;
+	}
+	
+	sim_stats.Reset();
+	MetricsWriter writer(metrics, prometheus, period, !interleave && checkpoint.empty());
+	run_metrics m;
+	
+	auto Format = [quiet](const vector<bool>& out, bool finished) -> string {
+		if (quiet) return "";
+		string text;
+		for (bool b : out)
+			text += (b ? '1' : '0');
+		return text + (finished ? "" : " (tick limit)") + "\n";
+	};
+	auto Print = [&Format](const vector<bool>& out, bool finished) {
+		cout << Format(out, finished);
+	};
+	
+	unique_ptr<ResumableRun> resumable;
+	if (!checkpoint.empty()) {
+		resumable = make_unique<ResumableRun>(g, checkpoint, checkpoint_period, max_ticks);
+		string why;
+		if (resume && resumable->Resume(why)) {
+			cerr << "\"" << checkpoint << "\" " << why << endl;
+			return 1;
+		}
+		m = resumable->Metrics();
+		if (resumable->Resumed() && TruncateOutput(resumable->Printed()) && resumable->Lines() > 0)
+			cerr << "Not printing the output of the " << resumable->Lines() << " lines before the checkpoint again" << endl;
+		
+		//no SA_RESTART, so a read waiting for input stops too
+		struct sigaction action = {};
+		action.sa_handler = RequestStop;
+		sigaction(SIGINT, &action, nullptr);
+		sigaction(SIGTERM, &action, nullptr);
+	}
+	
+	string line;
+	vector<bool> in, out;
+	vector<vector<bool>> inputs;
+	uint64_t index = 0; //input lines read
+	while (!stop_requested && getline(cin, line)) {
+		in.clear();
+		out.clear();
+		for (char c : line)
+			if (c == '0' || c == '1') in.push_back(c == '1');
+		if (interleave) {
+			inputs.push_back(in);
+			continue;
+		}
+		
+		if (resumable) {
+			if (index < resumable->Lines()) {
+				if (resumable->Skip(in, index++)) {
+					cerr << "The input differs from the one of the checkpoint" << endl;
+					return 1;
+				}
+				continue;
+			}
+			bool finished;
+			if (!resumable->Run(in, out, finished, m, writer)) break;
+			const string text = Format(out, finished);
+			cout << text;
+			resumable->Finish(in, text.size());
+			index++;
+			writer.Poll(m);
+			continue;
+		}
+		
+		const bool finished = RunInput(g, in, out, max_ticks, m, writer);
+		writer.Poll(m);
+		Print(out, finished);
+	}
+	
+	if (interleave)
+		RunInterleaved(g, inputs, max_ticks, slice, m, writer, Print);
+	cout << flush;
+	if (resumable) {
+		if (stop_requested) {
+			//again if a line was stopped, the state has not changed since
+			if (resumable->Write(m)) cerr << "Could not write the checkpoint \"" << checkpoint << "\"" << endl;
+			cerr << "Stopped, resume with -c " << checkpoint << " -r" << endl;
+			return 1;
+		}
+		if (index < resumable->Lines() || !cin.eof()) {
+			cerr << "The input differs from the one of the checkpoint" << endl;
+			return 1;
+		}
+		resumable->Remove();
+	}
+	if (profile) cerr << PerfReport();
+	
+	if (writer.Write(m, true)) {
+		cerr << "Could not write \"" << metrics << "\"" << endl;
+		return 1;
+	}
+	return 0;
+}
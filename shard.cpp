@@ -0,0 +1,225 @@
+// ttsim-shard: runs a board on a large batch of inputs in several processes
+//
+// The board is parsed once and written as a read-only FlatImage into a sealed memory
+// file. -j worker processes are forked and share its pages, each runs a contiguous
+// shard of the inputs and writes the results to a file of its own, and the files are
+// concatenated in order at the end. Workers have their own heaps, so they do not
+// contend on one allocator the way threads of one process do.
+//
+// Inputs are the lines of stdin, printed like ttsim-run, or with -n every input of n
+// marbles in binary order (the first marble is the highest bit, 1 is red), printed as
+// "input output". -w writes the image to a file and exits, -b runs from such a file
+// instead of a board, and -s k/N runs only shard k of N in this process, so shards can
+// also be started by hand or by a job scheduler and their outputs concatenated.
+//
+// Exit status is 0 on success, 1 if a worker failed and 2 on errors.
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <thread>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "tumble.hpp"
+#include "flat.hpp"
+
+using namespace std;
+
+struct shard_options {
+	unsigned workers = max(1u, thread::hardware_concurrency());
+	uint64_t max_ticks = 10000000;
+	int marbles = -1;     //-n, -1 to read lines
+	int shard = -1;       //-s, -1 to fork workers
+	int shards = 1;
+};
+
+struct shard_inputs {
+	int marbles;                 //every input of this many marbles, or -1 for lines
+	vector<vector<bool>> lines;
+	
+	uint64_t Count(void) const { return marbles >= 0 ? 1ull << marbles : lines.size(); }
+};
+
+//first input of shard k out of n
+static uint64_t ShardBegin(uint64_t count, int k, int n) {
+	return static_cast<uint64_t>((static_cast<unsigned __int128>(count) * k) / n);
+}
+
+//runs inputs [begin, end) and writes a line for each, returns true on error
+static bool RunShard(const flat_view& board, const shard_inputs& in, uint64_t begin, uint64_t end, uint64_t max_ticks, ostream& out) {
+	FlatRunner runner(board);
+	vector<bool> input(max(in.marbles, 0)), output;
+	string line;
+	
+	for (uint64_t i = begin; i < end; i++) {
+		line.clear();
+		if (in.marbles >= 0) {
+			for (int j = 0; j < in.marbles; j++) {
+				input[j] = (i >> (in.marbles - 1 - j)) & 1;
+				line += (input[j] ? '1' : '0');
+			}
+			line += ' ';
+		}
+		const vector<bool>& marbles = (in.marbles >= 0 ? input : in.lines[i]);
+		
+		output.clear();
+		const bool finished = runner.Run(marbles, output, max_ticks);
+		for (bool b : output)
+			line += (b ? '1' : '0');
+		line += (finished ? "\n" : " (tick limit)\n");
+		out << line;
+	}
+	out.flush();
+	return out.fail();
+}
+
+//forks a worker per shard and concatenates their results into out. Returns the exit status
+static int RunWorkers(const flat_view& board, const shard_inputs& in, const shard_options& opt, ostream& out) {
+	const char* tmp = getenv("TMPDIR");
+	string dir = string(tmp && *tmp ? tmp : "/tmp") + "/ttsim-shard-XXXXXX";
+	if (mkdtemp(dir.data()) == nullptr) {
+		cerr << "Could not create a directory for the results" << endl;
+		return 2;
+	}
+	
+	const uint64_t count = in.Count();
+	const int n = static_cast<int>(max<uint64_t>(1, min<uint64_t>(opt.workers, count)));
+	auto Path = [&dir](int k) { return dir + "/" + to_string(k); };
+	
+	//buffered output would be written again by every child
+	out.flush();
+	vector<pid_t> pids;
+	for (int k = 0; k < n; k++) {
+		const pid_t pid = fork();
+		if (pid == 0) {
+			ofstream f(Path(k));
+			const bool failed = !f || RunShard(board, in, ShardBegin(count, k, n), ShardBegin(count, k + 1, n), opt.max_ticks, f);
+			_exit(failed ? 1 : 0);
+		}
+		if (pid < 0) {
+			cerr << "Could not start worker " << k << endl;
+			break;
+		}
+		pids.push_back(pid);
+	}
+	
+	bool failed = (static_cast<int>(pids.size()) != n);
+	for (size_t k = 0; k < pids.size(); k++) {
+		int status = 0;
+		while (waitpid(pids[k], &status, 0) < 0 && errno == EINTR) {}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			cerr << "Worker " << k << " failed" << endl;
+			failed = true;
+		}
+	}
+	
+	for (int k = 0; k < n; k++) {
+		if (!failed && k < static_cast<int>(pids.size())) {
+			ifstream f(Path(k));
+			if (f.peek() != EOF) out << f.rdbuf();
+		}
+		remove(Path(k).c_str());
+	}
+	rmdir(dir.c_str());
+	out.flush();
+	return failed ? 1 : 0;
+}
+
+//writes the image of board to a sealed memory file and maps it, returns true on error
+static bool ShareBoard(const FlatBoard& board, FlatImage& image) {
+	const int fd = memfd_create("ttsim-board", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0) return true;
+	
+	const bool failed = WriteFlatImage(board, fd)
+		|| fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0
+		|| image.Map(fd);
+	close(fd);
+	return failed;
+}
+
+int main(int argc, char** argv) {
+	string file, image_file, write_file;
+	shard_options opt;
+	bool usage = false;
+	
+	for (int i = 1; i < argc && !usage; i++) {
+		string arg = argv[i];
+		const bool has_value = (i + 1 < argc);
+		if (arg == "-j" && has_value)
+			opt.workers = max(1, atoi(argv[++i]));
+		else if (arg == "-t" && has_value)
+			opt.max_ticks = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-n" && has_value)
+			opt.marbles = max(0, min(40, atoi(argv[++i])));
+		else if (arg == "-s" && has_value)
+			usage = (sscanf(argv[++i], "%d/%d", &opt.shard, &opt.shards) != 2 || opt.shards < 1 || opt.shard < 0 || opt.shard >= opt.shards);
+		else if (arg == "-b" && has_value)
+			image_file = argv[++i];
+		else if (arg == "-w" && has_value)
+			write_file = argv[++i];
+		else if (arg[0] != '-' && file.empty())
+			file = arg;
+		else
+			usage = true;
+	}
+	if (usage || file.empty() == image_file.empty() || (!write_file.empty() && file.empty())) {
+		cerr << "usage: " << argv[0] << " board.ttsim|-b image [-w image] [-j processes] [-n marbles] [-s shard/shards] [-t max_ticks]" << endl;
+		return 2;
+	}
+	
+	//the board is parsed and lowered once, and freed before any worker starts
+	FlatImage image;
+	if (!file.empty()) {
+		Grid g;
+		parse_error err;
+		if (LoadGrid(g, file, err)) {
+			cerr << file << ":" << err.line << ":" << err.column << ": " << err.message << endl;
+			return 2;
+		}
+		const FlatBoard board(g);
+		
+		if (!write_file.empty()) {
+			const int fd = open(write_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			bool failed = (fd < 0);
+			if (!failed) {
+				failed = WriteFlatImage(board, fd);
+				if (close(fd) != 0) failed = true;
+			}
+			if (failed) {
+				cerr << "Could not write \"" << write_file << "\"" << endl;
+				return 2;
+			}
+			return 0;
+		}
+		if (ShareBoard(board, image)) {
+			cerr << "Could not share the board" << endl;
+			return 2;
+		}
+	} else if (image.Open(image_file)) {
+		cerr << "\"" << image_file << "\" is not a board image" << endl;
+		return 2;
+	}
+	
+	shard_inputs in = {opt.marbles, {}};
+	if (opt.marbles < 0) {
+		string line;
+		while (getline(cin, line)) {
+			vector<bool> input;
+			for (char c : line)
+				if (c == '0' || c == '1') input.push_back(c == '1');
+			in.lines.push_back(move(input));
+		}
+	}
+	
+	if (opt.shard >= 0) {
+		const uint64_t count = in.Count();
+		if (RunShard(image.View(), in, ShardBegin(count, opt.shard, opt.shards), ShardBegin(count, opt.shard + 1, opt.shards), opt.max_ticks, cout)) return 2;
+		return 0;
+	}
+	return RunWorkers(image.View(), in, opt, cout);
+}
@@ -0,0 +1,93 @@
+// ttsim-bdd: extracts the boolean function a board computes for inputs of a
+// fixed length
+//
+// All 2^n inputs are simulated at once. Every board state reachable after a
+// marble is kept once, together with a BDD of the inputs leading to it, so the
+// work grows with the number of distinct states instead of the number of inputs.
+// Only the input is symbolic, the states of bits and gear bits are concrete: a
+// board whose bits remember the input, like a register or a counter, still has up
+// to 2^n states and is not helped. The search stops with an error when more than
+// -s states (a million by default) are reached after a marble.
+// For every output position it prints how many inputs produce it and how many
+// of those produce a 1, and -d writes the BDDs as a graphviz file.
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include "tumble.hpp"
+#include "flat.hpp"
+#include "bdd.hpp"
+
+using namespace std;
+
+int main(int argc, char** argv) {
+	string input, dot;
+	int n = -1;
+	uint64_t max_ticks = 10000000;
+	size_t max_states = 1 << 20;
+	
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "-n" && i + 1 < argc)
+			n = atoi(argv[++i]);
+		else if (arg == "-t" && i + 1 < argc)
+			max_ticks = strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-s" && i + 1 < argc)
+			max_states = max(1ull, strtoull(argv[++i], nullptr, 10));
+		else if (arg == "-d" && i + 1 < argc)
+			dot = argv[++i];
+		else if (input.empty() && arg[0] != '-')
+			input = arg;
+		else {
+			input.clear();
+			break;
+		}
+	}
+	if (input.empty() || n <= 0) {
+		cerr << "usage: " << argv[0] << " board.ttsim -n bits [-t max_ticks] [-s max_states] [-d out.dot]" << endl;
+		return 1;
+	}
+	
+	Grid g;
+	parse_error err;
+	if (LoadGrid(g, input, err)) {
+		cerr << input << ":" << err.line << ":" << err.column << ": " << err.message << endl;
+		return 1;
+	}
+	
+	FlatBoard board(g);
+	BddManager manager;
+	symbolic_result result;
+	if (SymbolicRun(board, n, manager, result, max_ticks, max_states)) {
+		if (result.state_limit)
+			cerr << "More than " << max_states << " board states: the bits depend on the input, only the input is symbolic" << endl;
+		else
+			cerr << "A marble did not leave the board within " << max_ticks << " ticks" << endl;
+		return 1;
+	}
+	
+	printf("%d inputs, %zu states at most, %zu bdd nodes\n", n, result.max_states, manager.Nodes());
+	printf("%-8s %9s %9s %9s\n", "output", "present", "ones", "nodes");
+	for (size_t k = 0; k < result.value.size(); k++) {
+		const double present = manager.Fraction(result.present[k]);
+		const double ones = manager.Fraction(result.value[k]);
+		printf("%-8zu %8.3f%% %8.3f%% %9zu\n", k, 100 * present, 100 * ones, manager.Size(result.value[k]));
+	}
+	
+	if (dot.empty()) return 0;
+	
+	vector<pair<string, bdd>> roots;
+	for (size_t k = 0; k < result.value.size(); k++) {
+		roots.push_back({"out" + to_string(k), result.value[k]});
+		if (result.present[k] != BddManager::True)
+			roots.push_back({"present" + to_string(k), result.present[k]});
+	}
+	
+	ofstream out(dot);
+	if (!out.is_open()) {
+		cerr << "Could not open \"" << dot << "\"" << endl;
+		return 1;
+	}
+	manager.Dot(out, roots);
+	return out.fail() ? 1 : 0;
+}
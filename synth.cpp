@@ -0,0 +1,526 @@
+// ttsim-synth: searches for the smallest board that gives the outputs of a spec
+//
+// The spec has one case per line, an input and the outputs expected for it, with
+// "-" for none:
+//
+//   # two bit and
+//   00 0
+//   01 0
+//   10 0
+//   11 1
+//
+// Boards are built from ramps, bits, gear bits, gears, crosses and output tiles in
+// columns -w to w of rows 1 to h. A cell's tile is only chosen when a marble or a
+// gear turn first reaches it, so the search never branches on cells the spec does
+// not look at. The evaluator stops there and each choice resumes from that point
+// instead of replaying the spec, and a wrong output prunes every board that shares
+// the choices made so far. Bounds on the number of tiles are tried in increasing
+// order so the first board found is the smallest, and the search below each bound
+// is shared out between -j threads. The board found is checked with Grid before it
+// is written.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <array>
+#include <bitset>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdio>
+#include "tumble.hpp"
+
+using namespace std;
+
+static const int max_cells = 256;
+
+struct spec_case {
+	vector<bool> input;
+	vector<bool> output;
+};
+
+//what is known about a cell
+enum cell_kind : uint8_t {
+	CELL_UNKNOWN,
+	CELL_EMPTY,
+	CELL_NOGEAR,   //does not pass turns on, its tile is not chosen yet
+	CELL_RAMP,
+	CELL_BIT,
+	CELL_GEARBIT,
+	CELL_STRAIGHT, //cross or gear, not reached by a turn yet
+	CELL_CROSS,
+	CELL_GEAR,
+	CELL_OUTPUT_VALUE,
+	CELL_OUTPUT_DIRECTION,
+};
+
+struct cell {
+	cell_kind kind;
+	int8_t dir; //ramps and bits
+};
+
+typedef array<cell, max_cells> cell_array;
+
+//position in the spec, resumed after a choice
+struct sim_state {
+	uint16_t test = 0;     //current case
+	uint16_t marble = 0;   //marble of the case on the board or next to drop
+	uint16_t produced = 0; //outputs of the case so far
+	int8_t x = 0, y = 0, dir = 0;
+	bool moving = false;
+	bool started = false;  //bits are reset for the case
+	uint16_t turn_size = 0; //cells left to spread a turn from
+	array<int8_t, max_cells> bits; //0 until a bit is first used, cells can be chosen during a case
+	array<uint8_t, max_cells> turn_stack;
+	bitset<max_cells> turned;
+};
+
+enum outcome { PASS, FAIL, NEED };
+
+struct choice {
+	cell value;
+	int tiles; //tiles it adds
+};
+
+static const int max_choices = 10;
+
+class Synthesizer {
+private:
+	vector<spec_case> spec;
+	int w, h, cells;
+	vector<array<int, 4>> neighbors; //-1 outside the box
+	
+	int Index(int x, int y) const { return (y - 1) * (2 * w + 1) + (x + w); }
+	
+public:
+	atomic<bool> timed_out{false};
+	
+	Synthesizer(const vector<spec_case>& spec, int w, int h) : spec(spec), w(w), h(h), cells((2 * w + 1) * h) {
+		const int directions[4][2] = {{1,0}, {0,1}, {-1,0}, {0,-1}};
+		neighbors.resize(cells);
+		for (int y = 1; y <= h; y++)
+			for (int x = -w; x <= w; x++)
+				for (int d = 0; d < 4; d++) {
+					const int i = x + directions[d][0], j = y + directions[d][1];
+					const bool inside = (i >= -w && i <= w && j >= 1 && j <= h);
+					neighbors[Index(x, y)][d] = inside ? Index(i, j) : -1;
+				}
+	}
+	
+	int Cells(void) const { return cells; }
+	
+	//runs the spec until it fails, passes or reaches a cell in need of a choice
+	outcome Run(sim_state& s, const cell_array& board, int& need, uint64_t& steps) const;
+	//choices for the cell Run() stopped at, returns how many
+	int Choices(const sim_state& s, const cell_array& board, int need, choice out[max_choices]) const;
+	
+	//depth first search below s, leaves the board found in board
+	bool Search(const sim_state& s, cell_array& board, int tiles, int bound, uint64_t& steps, uint64_t& nodes, const atomic<size_t>& found, size_t task) const;
+	
+	Grid Build(const cell_array& board) const;
+};
+
+outcome Synthesizer::Run(sim_state& s, const cell_array& board, int& need, uint64_t& steps) const {
+	while (s.test < spec.size()) {
+		const spec_case& c = spec[s.test];
+		
+		//a gear bit was hit, turn everything connected before the marble moves on
+		if (s.turn_size > 0) {
+			const int p = s.turn_stack[s.turn_size - 1];
+			for (int q : neighbors[p])
+				if (q >= 0 && !s.turned[q] && (board[q].kind == CELL_UNKNOWN || board[q].kind == CELL_STRAIGHT)) {
+					need = q;
+					return NEED;
+				}
+			
+			s.turn_size--;
+			for (int q : neighbors[p]) {
+				if (q < 0 || s.turned[q] || board[q].kind == CELL_EMPTY) continue;
+				s.turned[q] = true;
+				steps++;
+				if (board[q].kind == CELL_GEARBIT) s.bits[q] = -(s.bits[q] ? s.bits[q] : board[q].dir);
+				if (board[q].kind == CELL_GEARBIT || board[q].kind == CELL_GEAR)
+					s.turn_stack[s.turn_size++] = q;
+			}
+			continue;
+		}
+		
+		if (!s.moving) {
+			if (!s.started) {
+				fill(s.bits.begin(), s.bits.begin() + cells, 0);
+				s.started = true;
+			}
+			if (s.marble == c.input.size()) {
+				if (s.produced != c.output.size()) return FAIL;
+				s.test++;
+				s.marble = s.produced = 0;
+				s.started = false;
+				continue;
+			}
+			s.x = s.y = 0;
+			s.dir = (c.input[s.marble] ? 1 : -1);
+			s.moving = true;
+		}
+		
+		steps++;
+		const int x = s.x + s.dir, y = s.y + 1;
+		if (x < -w || x > w || y > h) {
+			s.moving = false;
+			s.marble++;
+			continue;
+		}
+		
+		const int i = Index(x, y);
+		const cell& t = board[i];
+		if (t.kind == CELL_UNKNOWN || t.kind == CELL_NOGEAR) {
+			need = i;
+			return NEED;
+		}
+		s.x = x, s.y = y;
+		
+		switch (t.kind) {
+			case CELL_EMPTY:
+				s.moving = false;
+				s.marble++;
+				break;
+			case CELL_RAMP:
+				s.dir = t.dir;
+				break;
+			case CELL_BIT:
+			case CELL_GEARBIT:
+				s.dir = (s.bits[i] ? s.bits[i] : t.dir);
+				s.bits[i] = -s.dir;
+				if (t.kind == CELL_GEARBIT) {
+					s.turned.reset();
+					s.turned[i] = true;
+					s.turn_stack[0] = i;
+					s.turn_size = 1;
+				}
+				break;
+			case CELL_OUTPUT_VALUE:
+			case CELL_OUTPUT_DIRECTION: {
+				const bool value = (t.kind == CELL_OUTPUT_VALUE ? c.input[s.marble] : s.dir > 0);
+				if (s.produced >= c.output.size() || c.output[s.produced] != value) return FAIL;
+				s.produced++;
+				break;
+			}
+			default:
+				break;
+		}
+	}
+	return PASS;
+}
+
+int Synthesizer::Choices(const sim_state& s, const cell_array& board, int need, choice out[max_choices]) const {
+	static const choice turned_straight[] = {{{CELL_CROSS, 0}, 0}, {{CELL_GEAR, 0}, 0}};
+	static const choice turned[] = {{{CELL_NOGEAR, 0}, 0}, {{CELL_GEAR, 0}, 1}, {{CELL_GEARBIT, 1}, 1}, {{CELL_GEARBIT, -1}, 1}};
+	//cheapest first, gear bits only where turns are not ruled out
+	static const choice reached[] = {{{CELL_EMPTY, 0}, 0}, {{CELL_RAMP, 1}, 1}, {{CELL_RAMP, -1}, 1}, {{CELL_STRAIGHT, 0}, 1},
+		{{CELL_OUTPUT_VALUE, 0}, 1}, {{CELL_OUTPUT_DIRECTION, 0}, 1}, {{CELL_BIT, 1}, 1}, {{CELL_BIT, -1}, 1},
+		{{CELL_GEARBIT, 1}, 1}, {{CELL_GEARBIT, -1}, 1}};
+	
+	const cell_kind kind = board[need].kind;
+	
+	//reached by a turn, only whether it passes the turn on matters yet
+	if (s.turn_size > 0) {
+		if (kind == CELL_STRAIGHT) {
+			copy(begin(turned_straight), end(turned_straight), out);
+			return 2;
+		}
+		copy(begin(turned), end(turned), out);
+		return 4;
+	}
+	
+	//reached by a marble
+	copy(begin(reached), end(reached), out);
+	if (kind == CELL_UNKNOWN) return 10;
+	out[3].value.kind = CELL_CROSS;
+	return 8;
+}
+
+bool Synthesizer::Search(const sim_state& from, cell_array& board, int tiles, int bound, uint64_t& steps, uint64_t& nodes, const atomic<size_t>& found, size_t task) const {
+	//an earlier task has a board already
+	if ((++nodes & 0xfff) == 0 && (found < task || timed_out)) return false;
+	
+	sim_state s = from;
+	int need;
+	const outcome result = Run(s, board, need, steps);
+	if (result != NEED) return result == PASS;
+	
+	choice choices[max_choices];
+	const int n = Choices(s, board, need, choices);
+	const cell old = board[need];
+	for (int i = 0; i < n; i++) {
+		const choice& c = choices[i];
+		if (tiles + c.tiles > bound) continue;
+		board[need] = c.value;
+		if (Search(s, board, tiles + c.tiles, bound, steps, nodes, found, task)) return true;
+	}
+	board[need] = old;
+	return false;
+}
+
+Grid Synthesizer::Build(const cell_array& board) const {
+	Grid g;
+	for (int y = 1; y <= h; y++)
+		for (int x = -w; x <= w; x++) {
+			const cell& c = board[Index(x, y)];
+			tile t;
+			switch (c.kind) {
+				case CELL_RAMP:
+					t = g.NewTile<RampTile>();
+					break;
+				case CELL_BIT:
+					t = g.NewTile<BitTile>();
+					break;
+				case CELL_GEARBIT:
+					t = g.NewTile<GearBitTile>();
+					break;
+				case CELL_STRAIGHT:
+				case CELL_CROSS:
+					t = g.NewTile<CrossTile>();
+					break;
+				case CELL_GEAR:
+					t = g.NewTile<GearTile>();
+					break;
+				case CELL_OUTPUT_VALUE:
+					t = g.NewTile<OutputValueTile>();
+					break;
+				case CELL_OUTPUT_DIRECTION:
+					t = g.NewTile<OutputDirectionTile>();
+					break;
+				default:
+					continue;
+			}
+			//tiles start pointing right, Interract() turns them around
+			if (c.dir < 0) t->Interract();
+			g.AddTile(x, y, t);
+		}
+	return g;
+}
+
+
+// Parallel search
+
+struct search_task {
+	sim_state state;
+	cell_array board;
+	int tiles;
+};
+
+struct search_totals {
+	uint64_t steps = 0, nodes = 0;
+};
+
+//searches all boards of at most bound tiles, returns true and sets board if one exists
+static bool SearchBound(Synthesizer& synth, int bound, unsigned workers, cell_array& board, search_totals& totals) {
+	search_task root;
+	root.tiles = 0;
+	for (cell& c : root.board)
+		c = {CELL_UNKNOWN, 0};
+	
+	//expand the first choices until there is enough work to share, in search order
+	vector<search_task> tasks = {root};
+	choice choices[max_choices];
+	while (tasks.size() < 64 * workers) {
+		vector<search_task> next;
+		bool expanded = false;
+		for (search_task& t : tasks) {
+			sim_state s = t.state;
+			int need;
+			const outcome result = synth.Run(s, t.board, need, totals.steps);
+			totals.nodes++;
+			if (result == PASS) {
+				board = t.board;
+				return true;
+			}
+			if (result == FAIL) continue;
+			
+			const int n = synth.Choices(s, t.board, need, choices);
+			for (int i = 0; i < n; i++) {
+				const choice& c = choices[i];
+				if (t.tiles + c.tiles > bound) continue;
+				search_task child = {s, t.board, t.tiles + c.tiles};
+				child.board[need] = c.value;
+				next.push_back(child);
+			}
+			expanded = true;
+		}
+		tasks = move(next);
+		if (!expanded || tasks.empty()) break;
+	}
+	
+	atomic<size_t> next(0), found(SIZE_MAX);
+	mutex lock;
+	
+	auto Worker = [&](void) {
+		uint64_t steps = 0, nodes = 0;
+		for (size_t task = next++; task < tasks.size() && task < found; task = next++) {
+			cell_array b = tasks[task].board;
+			if (!synth.Search(tasks[task].state, b, tasks[task].tiles, bound, steps, nodes, found, task)) continue;
+			
+			lock_guard<mutex> guard(lock);
+			if (task < found) {
+				found = task;
+				board = b;
+			}
+		}
+		lock_guard<mutex> guard(lock);
+		totals.steps += steps;
+		totals.nodes += nodes;
+	};
+	
+	vector<thread> threads;
+	for (unsigned i = 0; i < workers; i++)
+		threads.emplace_back(Worker);
+	for (thread& t : threads)
+		t.join();
+	return found != SIZE_MAX;
+}
+
+static bool ReadBits(const string& s, vector<bool>& bits) {
+	bits.clear();
+	if (s == "-") return false;
+	for (char c : s) {
+		if (c != '0' && c != '1') return true;
+		bits.push_back(c == '1');
+	}
+	return false;
+}
+
+//returns true on error
+static bool LoadSpec(const string& path, vector<spec_case>& spec) {
+	ifstream in(path);
+	if (!in.is_open()) {
+		cerr << "Could not open \"" << path << "\"" << endl;
+		return true;
+	}
+	
+	string line;
+	for (int n = 1; getline(in, line); n++) {
+		if (line.empty() || line[0] == '#') continue;
+		istringstream fields(line);
+		string input, output, extra;
+		spec_case c;
+		if (!(fields >> input >> output) || (fields >> extra) || ReadBits(input, c.input) || ReadBits(output, c.output)) {
+			cerr << path << ":" << n << ": expected an input and its outputs, made of 0s and 1s" << endl;
+			return true;
+		}
+		spec.push_back(c);
+	}
+	if (spec.empty()) {
+		cerr << path << ": no cases" << endl;
+		return true;
+	}
+	
+	//short cases first, they fail sooner
+	stable_sort(spec.begin(), spec.end(), [](const spec_case& a, const spec_case& b) { return a.input.size() < b.input.size(); });
+	return false;
+}
+
+int main(int argc, char** argv) {
+	string input, output;
+	int w = 2, h = 5, max_tiles = -1;
+	unsigned workers = max(1u, thread::hardware_concurrency());
+	double time_limit = 0;
+	
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		const bool has_value = (i + 1 < argc);
+		if (arg == "-w" && has_value)
+			w = max(0, atoi(argv[++i]));
+		else if (arg == "-h" && has_value)
+			h = max(1, atoi(argv[++i]));
+		else if (arg == "-m" && has_value)
+			max_tiles = atoi(argv[++i]);
+		else if (arg == "-j" && has_value)
+			workers = max(1, atoi(argv[++i]));
+		else if (arg == "-t" && has_value)
+			time_limit = atof(argv[++i]);
+		else if (arg == "-o" && has_value)
+			output = argv[++i];
+		else if (input.empty() && arg[0] != '-')
+			input = arg;
+		else {
+			input.clear();
+			break;
+		}
+	}
+	if (input.empty()) {
+		cerr << "usage: " << argv[0] << " spec.txt [-w half_width] [-h height] [-m max_tiles] [-j workers] [-t seconds] [-o out.ttsim]" << endl;
+		return 1;
+	}
+	if ((2 * w + 1) * h > max_cells) {
+		cerr << "The box has " << (2 * w + 1) * h << " cells, at most " << max_cells << " are supported" << endl;
+		return 1;
+	}
+	
+	vector<spec_case> spec;
+	if (LoadSpec(input, spec)) return 1;
+	
+	Synthesizer synth(spec, w, h);
+	if (max_tiles < 0 || max_tiles > synth.Cells()) max_tiles = synth.Cells();
+	
+	//stops the search from the side, workers poll the flag
+	const auto start = chrono::steady_clock::now();
+	bool stopped = false;
+	thread timer;
+	mutex timer_lock;
+	condition_variable timer_wake;
+	if (time_limit > 0)
+		timer = thread([&](void) {
+			unique_lock<mutex> guard(timer_lock);
+			if (!timer_wake.wait_for(guard, chrono::duration<double>(time_limit), [&] { return stopped; }))
+				synth.timed_out = true;
+		});
+	
+	search_totals totals;
+	cell_array board;
+	int bound = 0;
+	bool found = false;
+	for (; bound <= max_tiles && !found && !synth.timed_out; bound++)
+		found = SearchBound(synth, bound, workers, board, totals);
+	bound--;
+	
+	if (timer.joinable()) {
+		{
+			lock_guard<mutex> guard(timer_lock);
+			stopped = true;
+		}
+		timer_wake.notify_all();
+		timer.join();
+	}
+	
+	const double wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	printf("searched %llu boards, %llu evaluation steps in %.2f s: %.3g steps/s, %.3g boards/s on %u threads\n",
+		static_cast<unsigned long long>(totals.nodes), static_cast<unsigned long long>(totals.steps),
+		wall, totals.steps / wall, totals.nodes / wall, workers);
+	
+	if (!found) {
+		if (synth.timed_out)
+			printf("no board with fewer than %d tiles, stopped after %.0f s\n", bound, time_limit);
+		else
+			printf("no board of at most %d tiles fits in columns %d to %d and rows 1 to %d\n", max_tiles, -w, w, h);
+		return 1;
+	}
+	
+	Grid g = synth.Build(board);
+	for (const spec_case& c : spec) {
+		vector<bool> out;
+		if (!g.Run(c.input, out) || out != c.output) {
+			cerr << "Board found does not match the spec when run" << endl;
+			return 1;
+		}
+	}
+	
+	printf("smallest board has %d tiles:\n", bound);
+	g.Serialize(cout);
+	if (output.empty()) return 0;
+	if (SaveGrid(g, output)) {
+		cerr << "Could not write \"" << output << "\"" << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,45 @@
+#!/bin/sh
+# ttsim-daemon with one worker must serve a client while other clients stay
+# connected without sending anything
+set -e
+dir=$(mktemp -d)
+trap 'kill $pid 2>/dev/null; rm -rf "$dir"' EXIT
+./ttsim-daemon -s "$dir/sock" -j 1 &
+pid=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+	[ -S "$dir/sock" ] && break
+	sleep 0.1
+done
+
+python3 - "$dir/sock" demo/xor.ttsim <<'PY'
+import socket, struct, sys
+
+def connect():
+	s = socket.socket(socket.AF_UNIX)
+	s.connect(sys.argv[1])
+	s.settimeout(5)
+	return s
+
+def request(s, op, payload):
+	s.sendall(op + struct.pack("=I", len(payload)) + payload)
+	reply = b""
+	while len(reply) < 5 or len(reply) < 5 + struct.unpack("=I", reply[1:5])[0]:
+		chunk = s.recv(4096)
+		assert chunk, "connection closed"
+		reply += chunk
+	return reply
+
+idle = [connect() for _ in range(4)]
+busy = connect()
+board = open(sys.argv[2], "rb").read()
+reply = request(busy, b"L", board)
+assert reply[0] == 0, reply
+board_id = reply[5:13]
+reply = request(busy, b"E", board_id + struct.pack("=I", 2) + bytes([3]))
+assert reply[0] == 0, reply
+
+#the idle connections are still served
+for s in idle:
+	assert request(s, b"X", b"")[5:] == b"unknown request"
+PY
+kill -0 $pid
@@ -0,0 +1,42 @@
+#!/bin/sh
+# ttsim-daemon must refuse a request header announcing a huge payload, without
+# allocating it, and keep serving other connections afterwards
+set -e
+dir=$(mktemp -d)
+trap 'kill $pid 2>/dev/null; rm -rf "$dir"' EXIT
+./ttsim-daemon -s "$dir/sock" -m 1 &
+pid=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+	[ -S "$dir/sock" ] && break
+	sleep 0.1
+done
+
+python3 - "$dir/sock" <<'PY'
+import socket, struct, sys
+
+def request(op, payload, size=None):
+	s = socket.socket(socket.AF_UNIX)
+	s.connect(sys.argv[1])
+	s.sendall(op + struct.pack("=I", len(payload) if size is None else size) + payload)
+	reply = b""
+	while True:
+		chunk = s.recv(4096)
+		if not chunk:
+			break
+		reply += chunk
+		if len(reply) >= 5 and len(reply) >= 5 + struct.unpack("=I", reply[1:5])[0]:
+			break
+	return s, reply
+
+s, reply = request(b"L", b"", 0xffffffff)
+assert reply[0] == 1, reply
+assert reply[5:] == b"request too large", reply
+assert s.recv(1) == b"", "connection left open"
+
+s, reply = request(b"L", b"", 2 << 20)
+assert reply[0] == 1 and reply[5:] == b"request too large", reply
+
+s, reply = request(b"X", b"")
+assert reply[0] == 1 and reply[5:] == b"unknown request", reply
+PY
+kill -0 $pid
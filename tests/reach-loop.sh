@@ -0,0 +1,27 @@
+#!/bin/sh
+# ttsim-reach must not answer "not reachable" when marbles were stuck in a loop
+# and their branches were cut, only when every branch was followed to the end
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+#the loop keeps marbles on the board, the same board without it lets them leave
+printf '0 0 Drop\n-1 1 Bit -1\n1 1 Loop 4\n' > "$dir/loop.ttsim"
+printf '0 0 Drop\n-1 1 Bit -1\n' > "$dir/open.ttsim"
+
+expect() {
+	want=$1
+	shift
+	./ttsim-reach "$@" > "$dir/out"
+	got=$?
+	if [ $got -ne $want ]; then
+		echo "ttsim-reach $*: exit status $got, expected $want"
+		cat "$dir/out"
+		exit 1
+	fi
+}
+
+expect 3 "$dir/loop.ttsim" -o 1 -t 1000
+grep -q "^Inconclusive" "$dir/out" || { cat "$dir/out"; exit 1; }
+expect 3 "$dir/loop.ttsim" -t 1000
+expect 1 "$dir/open.ttsim" -o 1 -t 1000
+expect 0 "$dir/open.ttsim" -t 1000
@@ -0,0 +1,29 @@
+#!/bin/sh
+# A checkpointed ttsim-run appending with >> to a file that already holds output,
+# stopped and resumed with >>, must leave the file as a run that was never stopped
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+export LD_LIBRARY_PATH=.
+
+#enough lines that the run is still going when it is stopped
+python3 -c '
+import random
+random.seed(1)
+for i in range(20000):
+	print(format(random.getrandbits(200), "0200b"))' > "$dir/in"
+printf 'output of an earlier run, kept\n' > "$dir/log"
+cp "$dir/log" "$dir/expected"
+./ttsim-run demo/running-xor.ttsim < "$dir/in" >> "$dir/expected"
+
+./ttsim-run demo/running-xor.ttsim -c "$dir/ck" -k 0.1 < "$dir/in" >> "$dir/log" 2> /dev/null &
+pid=$!
+while [ ! -e "$dir/ck" ] && kill -0 $pid 2> /dev/null; do sleep 0.05; done
+kill -INT $pid
+wait $pid
+if [ ! -e "$dir/ck" ]; then
+	echo "the run finished before it was stopped"
+	exit 1
+fi
+
+./ttsim-run demo/running-xor.ttsim -c "$dir/ck" -r < "$dir/in" >> "$dir/log" 2> /dev/null || exit 1
+cmp "$dir/log" "$dir/expected" || exit 1
@@ -1,4 +1,14 @@
 #include "tumble.hpp"
+#include "perf.hpp"
+#include <sstream>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <zlib.h>
+
+thread_local sim_counters sim_stats = {};
 
 int modulo2(int x) {
 	int y = x % 2;
@@ -9,12 +19,55 @@ bool isOdd(int x, int y) {
 	return static_cast<bool>(modulo2(x) ^ modulo2(y));
 }
 
+bool EndsWith(const string& str, const string& suffix) {
+	return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
 void toWorldCoords(render_info& info, int x, int y, int& wx, int& wy) {
 	wx = x - info.w / 2;
 	wy = y - info.h / 2;
 }
 
 
+// Tile memory
+
+void* TileArena::Allocate(size_t size) {
+	size = (size + granule - 1) / granule * granule;
+	refs++;
+	if (size > max_block) return ::operator new(size);
+	
+	void*& head = free_blocks[size / granule - 1];
+	if (head != nullptr) {
+		void* p = head;
+		head = *static_cast<void**>(p);
+		return p;
+	}
+	
+	//the rest of a full chunk is left unused
+	if (static_cast<size_t>(end - pos) < size) {
+		chunks.emplace_back(new char[chunk_size]);
+		pos = chunks.back().get();
+		end = pos + chunk_size;
+		chunk_size = min<size_t>(2 * chunk_size, 256 * 1024);
+	}
+	void* p = pos;
+	pos += size;
+	return p;
+}
+
+void TileArena::Deallocate(void* p, size_t size) {
+	size = (size + granule - 1) / granule * granule;
+	if (size > max_block) {
+		::operator delete(p);
+	} else {
+		void*& head = free_blocks[size / granule - 1];
+		*static_cast<void**>(p) = head;
+		head = p;
+	}
+	if (--refs == 0) delete this;
+}
+
+
 // Marble functions
 
 void Marble::Start(int dir, short clr, int x, int y) {
@@ -36,8 +89,25 @@ void Marble::Update() {
 
 // Grid functions
 
+Grid::Grid(const Grid& other) : arena(TileArena::Create()), marble(other.marble) {
+	other.Load();
+	tiles.reserve(other.tiles.size());
+	for (auto& [pos, t] : other.tiles)
+		tiles[pos] = t->Copy(Allocator());
+}
+
+Grid& Grid::operator=(const Grid& other) {
+	if (this != &other) {
+		Grid tmp(other);
+		tmp.on_edit = move(on_edit);
+		*this = move(tmp);
+	}
+	return *this;
+}
+
 void Grid::AddTile(int x, int y, tile t) {
 	tiles[{x, y}] = move(t);
+	if (on_edit) on_edit(*this, {GRID_EDIT_ADD, x, y});
 }
 
 tile Grid::GetTile(int x, int y) const {
@@ -51,7 +121,7 @@ tile Grid::GetTile(int x, int y) const {
 
 void Grid::RemoveTile(int x, int y) {
 	if (x == 0 && y == 0) return;
-	tiles.erase({x, y});
+	if (tiles.erase({x, y}) > 0 && on_edit) on_edit(*this, {GRID_EDIT_REMOVE, x, y});
 }
 
 void Grid::Interract(int x, int y) {
@@ -59,6 +129,7 @@ void Grid::Interract(int x, int y) {
 	if (t == nullptr) return;
 	
 	t->Interract();
+	if (on_edit) on_edit(*this, {GRID_EDIT_INTERRACT, x, y});
 }
 
 void Grid::AddMarble(int direction, short color) {
@@ -83,6 +154,8 @@ void Grid::TurnConnected(unordered_set<pair<int, int>, IntPairHash>& v, int x, i
 }
 
 void Grid::TurnConnected(int x, int y, collision_result& result) {
+	PerfScope perf(PERF_TURN);
+	sim_stats.turns++;
 	unordered_set<pair<int, int>, IntPairHash> visited = {{x,y}};
 	
 	TurnConnected(visited, x, y, result);
@@ -124,58 +197,85 @@ void Grid::Reset() {
 		t->Reset();
 }
 
-void Grid::Render(render_info& info, int x, int y, bool blink, int mx, int my, short blink_color) const {
-	//render bounds
-	int start_x, start_y;
-	toWorldCoords(info, x, y, start_x, start_y);
-	const int end_x = start_x + info.w;
-	const int end_y = start_y + info.h;
+bool Grid::Drop(bool value, vector<bool>& output, uint64_t& ticks) {
+	AddMarble(value ? 1 : -1, static_cast<short>(value ? COLOR_RED : COLOR_BLUE));
+	PerfScope perf(PERF_TICK);
 	
-	for (int j = start_y; j < end_y; j++)
-		for (int i = start_x; i < end_x; i++) {
-			tile t = GetTile(i, j);
-			
-			const int x = i - start_x;
-			const int y = j - start_y;
-			gfx_char c = {' ', COLOR_BLACK+8, COLOR_BLACK};
-			
-			bool isMarble = (marble.IsActive() && i == marble.x && j == marble.y);
-			
-			if (t == nullptr) {
-				//checkerboard pattern
-				if (!isOdd(i, j)) c.c = '.';
-			} else {
-				//get tile's graphic
-				c = t->GetGraphic(info);
-			}
-			
-			if (isMarble && blink) {
-				c = marble.GetGraphic();
-			}
-			
-			if (x == mx && y == my && blink) {
-				c.bg = blink_color;
-			}
-			
-			DrawChar(c, x, y, info.color);
+	while (ticks > 0) {
+		ticks--;
+		collision_result result;
+		bool done = Update(result);
+		
+		if (result.output >= 0)
+			output.push_back(result.output > 0);
+		if (done) return true;
+	}
+	return false;
+}
+
+bool Grid::Run(const vector<bool>& input, vector<bool>& output, uint64_t max_ticks) {
+	Reset();
+	
+	uint64_t ticks = max_ticks;
+	bool finished = true;
+	for (bool value : input)
+		if (!Drop(value, output, ticks)) {
+			finished = false;
+			break;
 		}
+	
+	Reset();
+	return finished;
 }
 
 
 // Recursive tile
 
+//set while a shared grid is copied
+static thread_local bool copying_shared = false;
+
+Grid& RecursiveTile::Own(void) {
+	grid->Load();
+	if (grid.use_count() != 1) {
+		//nothing inside a shared grid can change either, so its nested grids stay shared
+		copying_shared = true;
+		grid = make_shared<Grid>(*grid);
+		copying_shared = false;
+	} else {
+		//the last other owner may have let go on another thread, see its reads first
+		atomic_thread_fence(memory_order_acquire);
+	}
+	return *grid;
+}
+
+void RecursiveTile::Reset(void) {
+	//shared grids and grids not read yet are as they were loaded
+	if (grid.use_count() == 1 && grid->Loaded()) Own().Reset();
+	active = false;
+}
+
+tile RecursiveTile::Copy(const tile_allocator& alloc) const {
+	const bool shared = (copying_shared || grid.use_count() > 1 || !grid->Loaded());
+	shared_ptr<RecursiveTile> t = allocate_shared<RecursiveTile>(alloc, *this);
+	if (!shared) t->grid = make_shared<Grid>(*grid);
+	return t;
+}
+
 bool RecursiveTile::Collide(Marble& m, collision_result& result) {
+	Grid& inner = Own();
 	//inform upper grid
 	result.inside_tile = true;
 	
 	//marble just entered
 	if (!active) {
 		active = true;
-		grid.AddMarble(m.GetDirection(), m.GetColor());
+		inner.AddMarble(m.GetDirection(), m.GetColor());
 	}
 	
 	collision_result internal_result;
-	bool done = grid.Update(internal_result, false);
+	if (++sim_stats.depth > sim_stats.max_depth) sim_stats.max_depth = sim_stats.depth;
+	bool done = inner.Update(internal_result, false);
+	sim_stats.depth--;
 	
 	//exit tile
 	if (done) {
@@ -186,8 +286,8 @@ bool RecursiveTile::Collide(Marble& m, collision_result& result) {
 		result.inside_tile = false;
 		active = false;
 		//configure outside marble
-		m.SetColor(grid.marble.GetColor());
-		m.SetDirection(grid.marble.GetDirection());
+		m.SetColor(inner.marble.GetColor());
+		m.SetDirection(inner.marble.GetDirection());
 		m.SetActive(true);
 	}
 	if (internal_result.turn_parent) {
@@ -196,7 +296,7 @@ bool RecursiveTile::Collide(Marble& m, collision_result& result) {
 	if (internal_result.marble_reset) {
 		//pass event towards root
 		result.marble_reset = true;
-		m.Start(grid.marble.GetDirection(), grid.marble.GetColor());
+		m.Start(inner.marble.GetDirection(), inner.marble.GetColor());
 	}
 	
 	result.output = internal_result.output;
@@ -206,223 +306,964 @@ bool RecursiveTile::Collide(Marble& m, collision_result& result) {
 
 bool RecursiveTile::Turn(collision_result& result) {
 	collision_result tmp;
-	grid.TurnConnected(0, 0, tmp);
+	Own().TurnConnected(0, 0, tmp);
 	return true;
 }
 
 void RecursiveTile::Serialize(ostream& out) const {
-	out << "Grid " << color << " {\n";
-	grid.Serialize(out);
-	out << "}\n";
+	out << "Grid " << color;
 }
 
-void RecursiveTile::Deserialize(istream& in) {
-	char bracket;
-	
-	in >> color >> std::ws >> bracket;
-	
-	if (in.fail() || bracket != '{' || grid.Deserialize(in)) {
-		in.setstate(ios::failbit); //fail manually
-		return;
-	}
+void RecursiveTile::Deserialize(Scanner& in) {
+	//contents are read by Grid::Deserialize, which sees that this tile has a grid
+	in >> color;
 }
 
 
 // Serialization / Deserialization
 
-void Grid::Serialize(ostream& out) const {
-	for (auto& [pos, t] : tiles) {
-		out << pos.first << " " << pos.second << " ";
-		t->Serialize(out);
+vector<pair<pair<int, int>, const BaseTile*>> Grid::SortedTiles(void) const {
+	vector<pair<pair<int, int>, const BaseTile*>> sorted;
+	sorted.reserve(tiles.size());
+	for (auto& [pos, t] : tiles)
+		sorted.push_back({pos, t.get()});
+	
+	sort(sorted.begin(), sorted.end(), [](auto& a, auto& b) {
+		if (a.first.second != b.first.second) return a.first.second < b.first.second;
+		return a.first.first < b.first.first;
+	});
+	return sorted;
+}
+
+//a tile's nested grid without loading it
+static const Grid* Nested(const BaseTile& t) {
+	if (t.GetType() != TILE_GRID) return nullptr;
+	return static_cast<const RecursiveTile&>(t).Contents().get();
+}
+
+vector<const Grid*> Grid::Components(void) const {
+	//count the tiles referring to each grid, visiting a grid's contents once. Grids
+	//read from a grid not loaded yet are new each time, so they are never shared
+	unordered_map<const Grid*, int> uses;
+	vector<const Grid*> queue = {this};
+	bool shared = false;
+	for (size_t i = 0; i < queue.size(); i++)
+		for (auto& [pos, t] : queue[i]->tiles) {
+			const Grid* inner = Nested(*t);
+			if (inner == nullptr) continue;
+			const int n = ++uses[inner];
+			if (n == 1 && inner->Loaded()) queue.push_back(inner);
+			shared = shared || n > 1;
+		}
+	
+	vector<const Grid*> order;
+	if (!shared) return order;
+	
+	//post order of the written file, so each component only refers to earlier ones
+	struct frame {
+		const Grid* grid;
+		vector<pair<pair<int, int>, const BaseTile*>> sorted;
+		size_t next;
+	};
+	vector<frame> stack = {{this, SortedTiles(), 0}};
+	unordered_set<const Grid*> visited;
+	while (!stack.empty()) {
+		frame& f = stack.back();
+		if (f.next == f.sorted.size()) {
+			if (uses[f.grid] > 1) order.push_back(f.grid);
+			stack.pop_back();
+			continue;
+		}
+		const Grid* inner = Nested(*f.sorted[f.next++].second);
+		if (inner == nullptr || !visited.insert(inner).second) continue;
+		stack.push_back({inner, {}, 0});
+		if (inner->Loaded()) stack.back().sorted = inner->SortedTiles();
 	}
+	return order;
 }
 
-bool Grid::Deserialize(istream& in) {
-	tiles.clear();
-	AddTile(0, 0, make_shared<DropTile>());
-	
-	int x, y;
-	string tile_type;
-	
-	while (in >> x >> y >> tile_type) {
-		tile t;
-		if (tile_type == "Drop")
-			t = make_shared<DropTile>();
-		else if (tile_type == "OutputValue")
-			t = make_shared<OutputValueTile>();
-		else if (tile_type == "OutputDirection")
-			t = make_shared<OutputDirectionTile>();
-		else if (tile_type == "Exit")
-			t = make_shared<ExitTile>();
-		else if (tile_type == "Loop")
-			t = make_shared<LoopTile>();
-		else if (tile_type == "Ramp")
-			t = make_shared<RampTile>();
-		else if (tile_type == "Cross")
-			t = make_shared<CrossTile>();
-		else if (tile_type == "Bit")
-			t = make_shared<BitTile>();
-		else if (tile_type == "Gear")
-			t = make_shared<GearTile>();
-		else if (tile_type == "GearBit")
-			t = make_shared<GearBitTile>();
-		else if (tile_type == "Grid")
-			t = make_shared<RecursiveTile>();
-		else
-			return true;
+//writes the tiles of g, nested grids found in components are referred to by number
+static void SerializeBlock(ostream& out, const Grid& g, bool compact, const unordered_map<const Grid*, size_t>& components) {
+	struct level {
+		vector<pair<pair<int, int>, const BaseTile*>> sorted;
+		size_t next;
+		int px, py; //previous position for delta coding
+		unique_ptr<Grid> temp; //contents of a grid not loaded yet, until it is written
+	};
+	
+	//nested grids use an explicit stack like Deserialize
+	vector<level> stack;
+	stack.push_back({{}, 0, 0, 0, nullptr});
+	stack.back().sorted = g.Peek(stack.back().temp).SortedTiles();
+	ostringstream spec;
+	
+	while (!stack.empty()) {
+		level& l = stack.back();
+		if (l.next == l.sorted.size()) {
+			stack.pop_back();
+			if (!stack.empty()) out << "}\n";
+			continue;
+		}
 		
-		t->Deserialize(in);
+		auto [pos, t] = l.sorted[l.next++];
+		auto [x, y] = pos;
 		
-		if (in.fail()) return true;
+		if (compact) {
+			//deltas can need more than 32 bits, the loader reads them as int64_t
+			out << int64_t(x) - l.px << " " << int64_t(y) - l.py << " ";
+			l.px = x, l.py = y;
+		} else {
+			out << x << " " << y << " ";
+		}
+		
+		const Grid* inner = Nested(*t);
+		if (inner != nullptr) {
+			t->Serialize(out);
+			auto id = components.find(inner);
+			if (id != components.end()) {
+				out << " @" << id->second << "\n";
+				continue;
+			}
+			out << " {\n";
+			stack.push_back({{}, 0, 0, 0, nullptr});
+			stack.back().sorted = inner->Peek(stack.back().temp).SortedTiles();
+			continue;
+		}
+		
+		if (!compact) {
+			t->Serialize(out);
+			continue;
+		}
+		
+		//run of identical tiles to the right
+		spec.str("");
+		t->Serialize(spec);
+		const string first = spec.str();
+		int run = 1;
+		while (l.next < l.sorted.size()) {
+			auto [npos, nt] = l.sorted[l.next];
+			if (run == Grid::max_run || x > INT32_MAX - run) break;
+			if (npos.second != y || npos.first != x + run || Nested(*nt) != nullptr) break;
+			spec.str("");
+			nt->Serialize(spec);
+			if (spec.str() != first) break;
+			run++, l.next++;
+		}
 		
-		AddTile(x, y, t);
+		if (run == 1) {
+			out << first;
+		} else {
+			out.write(first.data(), first.size() - 1); //without newline
+			out << " *" << run << "\n";
+			l.px = x + run - 1;
+		}
 	}
+}
+
+void Grid::Serialize(ostream& out, bool compact) const {
+	if (compact) out << "%compact\n";
 	
-	in.clear();
+	unique_ptr<Grid> temp;
+	const Grid& self = Peek(temp);
+	const vector<const Grid*> shared = self.Components();
+	unordered_map<const Grid*, size_t> components;
+	for (size_t i = 0; i < shared.size(); i++) {
+		out << "%component " << (i + 1) << " {\n";
+		SerializeBlock(out, *shared[i], compact, components);
+		out << "}\n";
+		components[shared[i]] = i + 1;
+	}
+	SerializeBlock(out, self, compact, components);
+}
+
+bool Scanner::Fail(const string& message, int line, int column) {
+	if (!failed) {
+		failed = true;
+		error = {line > 0 ? line : Line(), column > 0 ? column : Column(), message};
+	}
+	return false;
+}
+
+bool Scanner::Expect(char c) {
+	if (Peek() != c)
+		return Fail(string("expected '") + c + "'");
+	pos++;
+	return true;
+}
+
+Scanner& Scanner::operator>>(int64_t& v) {
+	if (failed) return *this;
+	SkipSpace();
 	
-	in >> std::ws;
+	const char* p = pos;
+	bool negative = (p != end && *p == '-');
+	if (negative) p++;
 	
-	//hack for special case of recursion
-	char bracket;
-	if (!in.eof()) {
-		in >> bracket;
-		if (bracket != '}') return true;
+	if (p == end || *p < '0' || *p > '9') {
+		Fail("expected a number");
+		return *this;
 	}
 	
-	return false; //no errors
+	//one more for negative numbers, so INT64_MIN reads
+	const uint64_t limit = negative ? uint64_t(INT64_MAX) + 1 : uint64_t(INT64_MAX);
+	uint64_t value = 0;
+	for (; p != end && *p >= '0' && *p <= '9'; p++) {
+		const uint64_t digit = *p - '0';
+		if (value > (limit - digit) / 10) {
+			Fail("number out of range");
+			return *this;
+		}
+		value = value * 10 + digit;
+	}
+	
+	v = static_cast<int64_t>(negative ? 0 - value : value);
+	pos = p;
+	return *this;
 }
 
+Scanner& Scanner::operator>>(int& v) {
+	int64_t value = 0;
+	*this >> value;
+	if (value < INT32_MIN || value > INT32_MAX)
+		Fail("number out of range");
+	else
+		v = static_cast<int>(value);
+	return *this;
+}
 
-// GUI
+Scanner& Scanner::operator>>(short& v) {
+	int value = 0;
+	*this >> value;
+	if (value < INT16_MIN || value > INT16_MAX)
+		Fail("number out of range");
+	else
+		v = static_cast<short>(value);
+	return *this;
+}
 
-void DrawChar(gfx_char c, int x, int y, bool color) {
-	if (color) {
-		short pair = c.fg + c.bg*16 + 1;
-		attron(COLOR_PAIR(pair));
-		mvaddch(y, x, c.c);
-		attroff(COLOR_PAIR(pair));
-		return;
+Scanner& Scanner::operator>>(string_view& v) {
+	if (failed) return *this;
+	SkipSpace();
+	
+	const char* p = pos;
+	while (p != end && ((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z'))) p++;
+	
+	if (p == pos) {
+		Fail("expected a tile type");
+		return *this;
 	}
-	mvaddch(y, x, c.c);
+	
+	v = string_view(pos, p - pos);
+	pos = p;
+	return *this;
 }
 
-void DrawString(string& str, int x, int y, draw_params& p, bool color) {
-	attron(p.attr);
-	short pair = p.color + 1;
-	if (color) {
-		attron(COLOR_PAIR(pair));
+Scanner& Scanner::Name(string_view& v) {
+	if (failed) return *this;
+	SkipSpace();
+	
+	const char* p = pos;
+	while (p != end && (isalnum(static_cast<unsigned char>(*p)) || *p == '_' || *p == '-')) p++;
+	
+	if (p == pos) {
+		Fail("expected a component name");
+		return *this;
 	}
 	
-	mvprintw(y, x, str.c_str());
+	v = string_view(pos, p - pos);
+	pos = p;
+	return *this;
+}
+
+//tile registry, switches on length first so most names need a single compare
+static tile MakeTile(string_view type, const tile_allocator& alloc) {
+	switch (type.size()) {
+		case 3:
+			if (type == "Bit") return allocate_shared<BitTile>(alloc);
+			break;
+		case 4:
+			switch (type[0]) {
+				case 'D': if (type == "Drop") return allocate_shared<DropTile>(alloc); break;
+				case 'E': if (type == "Exit") return allocate_shared<ExitTile>(alloc); break;
+				case 'L': if (type == "Loop") return allocate_shared<LoopTile>(alloc); break;
+				case 'R': if (type == "Ramp") return allocate_shared<RampTile>(alloc); break;
+				case 'G':
+					if (type == "Gear") return allocate_shared<GearTile>(alloc);
+					if (type == "Grid") return allocate_shared<RecursiveTile>(alloc);
+					break;
+			}
+			break;
+		case 5:
+			if (type == "Cross") return allocate_shared<CrossTile>(alloc);
+			break;
+		case 7:
+			if (type == "GearBit") return allocate_shared<GearBitTile>(alloc);
+			break;
+		case 11:
+			if (type == "OutputValue") return allocate_shared<OutputValueTile>(alloc);
+			break;
+		case 15:
+			if (type == "OutputDirection") return allocate_shared<OutputDirectionTile>(alloc);
+			break;
+	}
+	return nullptr;
+}
+
+bool Grid::Deserialize(istream& in, parse_error* err) {
+	ostringstream buffer;
+	buffer << in.rdbuf();
+	const string text = buffer.str();
 	
-	attroff(COLOR_PAIR(pair) | p.attr);
+	Scanner scanner(text.data(), text.data() + text.size());
+	bool failed = Deserialize(scanner);
+	if (failed && err) *err = scanner.error;
+	return failed;
 }
 
-void DrawBox(int x1, int y1, int x2, int y2) {
-	//ensure correct order
-	if (x1 > x2) swap(x1, x2);
-	if (y1 > y2) swap(y1, y2);
+// Loading
+
+//a nested block found by the pre-scan, from after its '{' to its '}'
+struct block_range {
+	const char* begin;
+	const char* end;
+	int line, end_line;         //lines of begin and end
+	const char* line_start;     //where those lines start
+	const char* end_line_start;
+};
+
+//hashes a block's length and its last bytes, which were just read, so blocks are
+//not read again for every level they are nested in. Equal blocks are found by comparing
+struct block_hash {
+	size_t operator()(string_view s) const {
+		const size_t tail = min<size_t>(s.size(), 64);
+		return hash<string_view>()(s.substr(s.size() - tail)) ^ (s.size() * 0x9e3779b97f4a7c15ull);
+	}
+};
+
+//a reference to a component is only valid after the end of its definition, so
+//components refer to earlier ones and never to themselves
+struct component_def {
+	shared_ptr<Grid> grid;
+	const char* end; //nullptr while the definition is read
+};
+typedef unordered_map<string_view, component_def> component_map;
+
+//the buffer a board is loaded from. For lazy loading it is kept with the text by the
+//grids not read yet, which load their blocks from it later
+struct load_source {
+	string text; //only held for lazy loading
+	bool compact = false;
+	bool lazy = false;
+	vector<block_range> blocks; //sorted by begin, empty when loading on one thread
+};
+
+struct lazy_block {
+	shared_ptr<load_source> source;
+	const block_range* range;
+	//components the block refers to, not changed once it is checked. Holding only
+	//earlier components cannot make a cycle
+	shared_ptr<component_map> components;
+	once_flag once;
+	atomic<bool> loaded;
+	
+	lazy_block(shared_ptr<load_source> source, const block_range* range, shared_ptr<component_map> components)
+		: source(move(source)), range(range), components(move(components)), loaded(false) {}
+};
+
+//grid tiles whose contents are read by another task, with their blocks
+typedef vector<pair<shared_ptr<RecursiveTile>, const block_range*>> load_batch;
+
+//loads the contents of nested blocks on a thread pool. A pre-scan matches the braces
+//of the whole buffer, so a grid's block can be skipped and handed to another thread
+//as soon as its header is read. Blocks are independent: positions are delta coded
+//from the start of each block and every grid allocates from its own arena.
+//Tiles are held until the loader is gone, so one replaced while its block is read
+//is freed back to its parent's arena on the loading thread.
+//Blocks with the same text share one grid, big ones are only read the first time.
+//Lazy loading pre-scans on any machine and leaves big blocks to their grids' Load(),
+//reading them only to check them
+class GridLoader {
+private:
+	static constexpr size_t min_block = 256;      //smaller blocks are read in place
+	static constexpr size_t batch_bytes = 16384;  //small blocks are handed out in batches this big
+	static constexpr size_t min_buffer = 1 << 18; //smaller buffers are read on one thread
+	
+	shared_ptr<load_source> source;
+	//set when loading a lazy block, which was checked with the board
+	bool reading_lazy;
+	
+	mutex lock;
+	condition_variable wake;
+	vector<load_batch> queue;
+	vector<load_batch> done;
+	int active = 1; //tasks running, starting with the root grid's
+	vector<parse_error> errors;
+	vector<thread> workers;
+	
+	//grids by the text of their blocks and by component name, the text is in the buffer
+	mutex shared_lock;
+	unordered_map<string_view, shared_ptr<Grid>, block_hash> blocks_read;
+	shared_ptr<component_map> components;
+	//components referred to by the lazy block being checked
+	shared_ptr<component_map> referred;
+	
+	void Prescan(const Scanner& in);
+	//shares the grid of an earlier block with the same text, returns true if there was one
+	bool Share(RecursiveTile& t, string_view text);
+	//the component a reference at pos can use, its grid is nullptr if there is none
+	component_def Component(string_view name, const char* pos);
+	void Define(string_view name, const char* end);
+	void Work(void);
+	bool ParseTiles(Scanner& in, Grid* root, load_batch& batch);
+	
+public:
+	//components are only given for a lazy block, with the ones it refers to
+	GridLoader(const Scanner& in, shared_ptr<load_source> source, shared_ptr<component_map> components = nullptr);
+	
+	//the block starting at begin, nullptr if it is read in place
+	const block_range* Find(const char* begin) const;
+	void Add(load_batch&& batch);
+	//reads a grid's tiles up to the end of in, returns true on error
+	bool Parse(Scanner& in, Grid* root);
+	//waits for all blocks, the first error in the buffer is reported on in
+	bool Finish(Scanner& in, bool failed);
+};
+
+void GridLoader::Prescan(const Scanner& in) {
+	vector<block_range>& blocks = source->blocks;
+	struct open_block {
+		const char* begin;
+		int line;
+		const char* line_start;
+	};
+	vector<open_block> open;
+	const char* end = in.End();
+	const char* line_start = in.Pos() - (in.Column() - 1);
+	int line = in.Line();
+	
+	//jumps from brace to brace, counting the lines in between
+	auto Next = [end](const char* p, char c) {
+		const void* found = memchr(p, c, end - p);
+		return found ? static_cast<const char*>(found) : end;
+	};
+	const char* counted = in.Pos();
+	const char* next_open = Next(counted, '{');
+	const char* next_close = Next(counted, '}');
 	
-	int dx = x2 - x1, dy = y2 - y1;
-	//sides
-	if (dx > 1 || dy > 1) {
-		mvhline(y1, x1+1, '-', dx-1);
-		mvhline(y2, x1+1, '-', dx-1);
-		mvvline(y1+1, x1, '|', dy-1);
-		mvvline(y1+1, x2, '|', dy-1);
+	while (next_open != end || next_close != end) {
+		const char* p = min(next_open, next_close);
+		line += count(counted, p, '\n');
+		const void* last = memrchr(counted, '\n', p - counted);
+		if (last) line_start = static_cast<const char*>(last) + 1;
+		counted = p;
+		
+		if (p == next_open) {
+			open.push_back({p + 1, line, line_start});
+			next_open = Next(p + 1, '{');
+			continue;
+		}
+		
+		//unbalanced, the parser reports where
+		if (open.empty()) {
+			blocks.clear();
+			return;
+		}
+		const open_block& o = open.back();
+		if (static_cast<size_t>(p - o.begin) >= min_block)
+			blocks.push_back({o.begin, p, o.line, line, o.line_start, line_start});
+		open.pop_back();
+		next_close = Next(p + 1, '}');
+	}
+	if (!open.empty()) {
+		blocks.clear();
+		return;
+	}
+	
+	//blocks were found in order of their ends
+	sort(blocks.begin(), blocks.end(), [](const block_range& a, const block_range& b) { return a.begin < b.begin; });
+}
+
+GridLoader::GridLoader(const Scanner& in, shared_ptr<load_source> source, shared_ptr<component_map> components)
+	: source(move(source)), reading_lazy(components != nullptr), components(move(components)) {
+	if (!reading_lazy) this->components = make_shared<component_map>();
+	if (this->source->lazy) {
+		if (!reading_lazy) Prescan(in);
+		return;
 	}
 	
-	//corners
-	mvaddch(y1, x1, '+');  // Top-left corner
-	mvaddch(y1, x2, '+');  // Top-right corner
-	mvaddch(y2, x1, '+');  // Bottom-left corner
-	mvaddch(y2, x2, '+');  // Bottom-right corner
+	const unsigned threads = thread::hardware_concurrency();
+	if (threads < 2 || static_cast<size_t>(in.End() - in.Pos()) < min_buffer) return;
+	
+	Prescan(in);
+	if (this->source->blocks.empty()) return;
 	
-	//fill inside
-	for (int i = y1+1; i < y2; i++)
-		mvhline(i, x1+1, ' ', dx-1);
+	for (unsigned i = 1; i < threads; i++)
+		workers.emplace_back(&GridLoader::Work, this);
 }
 
-void Panel::AddString(int x, int y, string s, draw_params p) {
-	str.push_back(make_tuple(x, y, s, p));
-	Fit(x + s.length(), y + 1);
+const block_range* GridLoader::Find(const char* begin) const {
+	const vector<block_range>& blocks = source->blocks;
+	auto it = lower_bound(blocks.begin(), blocks.end(), begin, [](const block_range& b, const char* p) { return b.begin < p; });
+	return (it != blocks.end() && it->begin == begin) ? &*it : nullptr;
 }
 
-void Panel::EditString(int index, string s) {
-	if (index < 0 || index >= str.size()) return;
-	get<2>(str[index]) = s;
-	Fit(x + s.length(), y + 1);
+void GridLoader::Add(load_batch&& batch) {
+	lock_guard<mutex> guard(lock);
+	queue.push_back(move(batch));
+	wake.notify_one();
 }
 
-void Panel::Render(render_info& info) {
-	if (hide) return;
+void GridLoader::Work(void) {
+	unique_lock<mutex> guard(lock);
+	while (true) {
+		wake.wait(guard, [this] { return !queue.empty() || active == 0; });
+		if (queue.empty()) return;
+		
+		load_batch batch = move(queue.back());
+		queue.pop_back();
+		active++;
+		guard.unlock();
+		
+		parse_error error;
+		bool failed = false;
+		for (auto& [t, b] : batch) {
+			Scanner in(b->begin, b->end, b->line, b->line_start);
+			if (Parse(in, t->Contents().get())) {
+				error = in.error;
+				failed = true;
+				break;
+			}
+		}
+		
+		guard.lock();
+		if (failed) errors.push_back(error);
+		done.push_back(move(batch));
+		if (--active == 0) wake.notify_all();
+	}
+}
+
+bool GridLoader::Parse(Scanner& in, Grid* root) {
+	//blocks skipped before an error are still read, one may hold an earlier error
+	load_batch batch;
+	const bool failed = ParseTiles(in, root, batch);
+	if (!batch.empty()) Add(move(batch));
+	return failed;
+}
+
+bool GridLoader::Share(RecursiveTile& t, string_view text) {
+	lock_guard<mutex> guard(shared_lock);
+	auto [it, added] = blocks_read.try_emplace(text, t.Contents());
+	if (added) return false;
+	t.SetContents(it->second);
+	return true;
+}
+
+component_def GridLoader::Component(string_view name, const char* pos) {
+	lock_guard<mutex> guard(shared_lock);
+	auto it = components->find(name);
+	if (it == components->end() || it->second.end == nullptr || it->second.end > pos) return {nullptr, nullptr};
+	return it->second;
+}
+
+void GridLoader::Define(string_view name, const char* end) {
+	lock_guard<mutex> guard(shared_lock);
+	(*components)[name].end = end;
+}
+
+bool GridLoader::ParseTiles(Scanner& in, Grid* root, load_batch& batch) {
+	struct level {
+		Grid* grid; //nullptr for blocks that are only checked
+		int px, py; //previous position for delta coding
+		shared_ptr<RecursiveTile> tile; //the tile the block belongs to
+		const char* begin; //start of the block
+		string_view defines; //component defined by the block
+	};
 	
-	//border
-	DrawBox(x, y, x+w+1, y+h+1);
+	//nested grids are handled with an explicit stack instead of recursion
+	vector<level> stack = {{root, 0, 0, nullptr, nullptr, {}}};
+	size_t batched = 0;
+	const bool compact = source->compact;
 	
-	//strings
-	for (auto it = str.begin(); it != str.end(); it++) {
-		DrawString(get<2>(*it), x+1+get<0>(*it), y+1+get<1>(*it), get<3>(*it), info.color);
-	}
+	//tiles for blocks that are only checked, one of each type
+	vector<pair<string_view, tile>> scratch;
+	auto Scratch = [&scratch](string_view type) {
+		for (auto& [name, t] : scratch)
+			if (name == type) return t;
+		tile t = MakeTile(type, tile_allocator());
+		if (t) scratch.push_back({type, t});
+		return t;
+	};
 	
-	//call render function with offset and width,height
-	if (renderFunc) renderFunc(*this, info, x+1, y+1, w, h);
+	//reads the block of a grid, hands it to another task or leaves it to the grid.
+	//Returns the block unless it is read in place
+	auto Block = [&](shared_ptr<RecursiveTile> t) -> const block_range* {
+		const block_range* b = Find(in.Pos());
+		if (b == nullptr) {
+			stack.push_back({t->Contents().get(), 0, 0, t, in.Pos(), {}});
+			return nullptr;
+		}
+		const char* start = in.Pos();
+		in.Seek(b->end + 1, b->end_line, b->end_line_start);
+		if (Share(*t, string_view(b->begin, b->end - b->begin))) return b;
+		
+		if (source->lazy && reading_lazy) {
+			t->Contents()->lazy = make_shared<lazy_block>(source, b, components);
+			return b;
+		}
+		if (source->lazy) {
+			referred = make_shared<component_map>();
+			t->Contents()->lazy = make_shared<lazy_block>(source, b, referred);
+			in.Seek(start, b->line, b->line_start);
+			stack.push_back({nullptr, 0, 0, nullptr, nullptr, {}});
+			return b;
+		}
+		
+		//big blocks go alone and split further there, small ones are collected
+		const size_t size = b->end - b->begin;
+		if (size >= batch_bytes) {
+			Add({{t, b}});
+		} else {
+			batch.push_back({t, b});
+			batched += size;
+			if (batched >= batch_bytes) {
+				Add(move(batch));
+				batch.clear();
+				batched = 0;
+			}
+		}
+		return b;
+	};
 	
-	//call character function for every pixel
-	if (charFunc)
-		for (int j = 0; j < h; j++)
-			for (int i = 0; i < w; i++) {
-				gfx_char c = charFunc(info, i, j);
-				if (c.c == '\0') continue;
-				DrawChar(c, i+x+1, j+y+1, info.color);
+	while (!in.AtEnd()) {
+		if (in.Peek() == '}') {
+			if (stack.size() == 1) {
+				in.Fail("unexpected '}'");
+				return true;
+			}
+			const level& l = stack.back();
+			if (l.tile) Share(*l.tile, string_view(l.begin, in.Pos() - l.begin));
+			if (!l.defines.empty()) Define(l.defines, in.Pos());
+			in.Expect('}');
+			stack.pop_back();
+			continue;
+		}
+		
+		//component definition, read like a nested grid that is not placed anywhere
+		if (in.Peek() == '%') {
+			const int line = in.Line(), column = in.Column();
+			string_view word, name;
+			in.Expect('%');
+			in >> word;
+			if (!in.fail() && word != "component")
+				in.Fail("unknown directive \"" + string(word) + "\"", line, column);
+			else if (!in.fail() && stack.size() > 1)
+				in.Fail("components must be defined outside of grids", line, column);
+			in.Name(name);
+			in.Expect('{');
+			if (in.fail()) return true;
+			
+			auto t = make_shared<RecursiveTile>();
+			bool added;
+			{
+				lock_guard<mutex> guard(shared_lock);
+				added = components->emplace(name, component_def{t->Contents(), nullptr}).second;
+			}
+			if (!added) {
+				in.Fail("component \"" + string(name) + "\" is defined twice", line, column);
+				return true;
+			}
+			const block_range* b = Block(t);
+			if (b) Define(name, b->end);
+			else stack.back().defines = name;
+			continue;
+		}
+		
+		int64_t dx, dy; //positions, relative to the previous tile if compact
+		string_view tile_type;
+		in >> dx >> dy;
+		in.SkipSpace();
+		const int line = in.Line(), column = in.Column();
+		in >> tile_type;
+		if (in.fail()) return true;
+		
+		level& l = stack.back();
+		tile t = (l.grid ? MakeTile(tile_type, l.grid->Allocator()) : Scratch(tile_type));
+		if (t == nullptr) {
+			in.Fail("unknown tile type \"" + string(tile_type) + "\"", line, column);
+			return true;
+		}
+		
+		t->Deserialize(in);
+		if (in.fail()) return true;
+		
+		const bool nested = (t->GetType() == TILE_GRID);
+		int run = 1;
+		
+		int x, y;
+		if (__builtin_add_overflow(dx, compact ? l.px : 0, &x) || __builtin_add_overflow(dy, compact ? l.py : 0, &y)) {
+			in.Fail("position out of range", line, column);
+			return true;
+		}
+		if (compact) {
+			if (!nested && in.Peek() == '*') {
+				in.Expect('*');
+				in >> run;
+				if (in.fail()) return true;
+				if (run < 1 || run > Grid::max_run) {
+					in.Fail("run length must be between 1 and " + to_string(Grid::max_run));
+					return true;
+				}
+				if (x > INT32_MAX - (run - 1)) {
+					in.Fail("run goes past the end of the row");
+					return true;
+				}
+			}
+			l.px = x + run - 1, l.py = y;
+		}
+		
+		if (l.grid) {
+			l.grid->AddTile(x, y, t);
+			for (int i = 1; i < run; i++)
+				l.grid->AddTile(x + i, y, t->Copy(l.grid->Allocator()));
+		}
+		
+		//contents of the tile's grid follow, a new tile's grid only holds its drop
+		if (!nested) continue;
+		auto rt = static_pointer_cast<RecursiveTile>(t);
+		const bool only_checked = (l.grid == nullptr);
+		
+		if (in.Peek() == '@') {
+			in.Expect('@');
+			const int name_line = in.Line(), name_column = in.Column();
+			string_view name;
+			in.Name(name);
+			if (in.fail()) return true;
+			
+			const component_def c = Component(name, in.Pos());
+			if (c.grid == nullptr) {
+				in.Fail("unknown component \"" + string(name) + "\"", name_line, name_column);
+				return true;
 			}
+			if (only_checked)
+				referred->emplace(name, c);
+			else
+				rt->SetContents(c.grid);
+			continue;
+		}
+		if (!in.Expect('{')) return true;
+		if (only_checked)
+			stack.push_back({nullptr, 0, 0, nullptr, nullptr, {}});
+		else
+			Block(rt);
+	}
+	
+	if (stack.size() > 1) {
+		in.Fail("missing '}'");
+		return true;
+	}
+	return false;
 }
 
-bool Panel::Inside(int x, int y, int& ox, int& oy) const {
-	int x1 = this->x + 1, y1 = this->y + 1;
-	int x2 = x1 + w - 1, y2 = y1 + h - 1;
+bool GridLoader::Finish(Scanner& in, bool failed) {
+	if (workers.empty()) return failed;
 	
+	{
+		lock_guard<mutex> guard(lock);
+		if (--active == 0) wake.notify_all();
+	}
+	Work();
+	for (thread& t : workers)
+		t.join();
 	
-	if (x1-1 <= x && x <= x2+1 && y1-1 <= y && y <= y2+1) {
-		ox = -1;
-		oy = -1;
-		if (x1 <= x && x <= x2 && y1 <= y && y <= y2) {
-			ox = x - x1;
-			oy = y - y1;
-		}
-		return true;
+	//reading in order would have stopped at the first error
+	if (failed) errors.push_back(in.error);
+	if (errors.empty()) return false;
+	
+	const parse_error& first = *min_element(errors.begin(), errors.end(), [](const parse_error& a, const parse_error& b) {
+		return a.line != b.line ? a.line < b.line : a.column < b.column;
+	});
+	if (failed) in.error = first;
+	else in.Fail(first.message, first.line, first.column);
+	return true;
+}
+
+bool Grid::Deserialize(Scanner& in) {
+	return Deserialize(in, make_shared<load_source>());
+}
+
+bool Grid::Deserialize(Scanner& in, shared_ptr<load_source> source) {
+	PerfScope perf(PERF_LOAD);
+	//loading is not an edit, the hook is put back once the grid is read
+	auto hook = move(on_edit);
+	on_edit = nullptr;
+	const bool failed = Read(in, move(source));
+	on_edit = move(hook);
+	return failed;
+}
+
+bool Grid::Read(Scanner& in, shared_ptr<load_source> source) {
+	//a new arena, the old one goes once nothing holds its tiles
+	tiles.clear();
+	lazy.reset();
+	arena = TileArena::Create();
+	AddTile(0, 0, NewTile<DropTile>());
+	
+	//one tile per line at most, saves rehashing while loading big boards
+	tiles.reserve(in.CountLines());
+	
+	//compact files start with a marker, see Serialize(). Other directives are read with the tiles
+	bool compact = false;
+	if (in.Peek() == '%') {
+		const char* start = in.Pos();
+		const int line = in.Line(), column = in.Column();
+		string_view marker;
+		in.Expect('%');
+		in >> marker;
+		if (in.fail()) return true;
+		compact = (marker == "compact");
+		if (!compact) in.Seek(start, line, start - (column - 1));
 	}
 	
+	source->compact = compact;
+	GridLoader loader(in, move(source));
+	const bool failed = loader.Parse(in, this);
+	return loader.Finish(in, failed);
+}
+
+bool Grid::DeserializeLazy(string&& text, parse_error& err) {
+	auto source = make_shared<load_source>();
+	source->text = move(text);
+	source->lazy = true;
+	
+	Scanner in(source->text.data(), source->text.data() + source->text.size());
+	if (Deserialize(in, move(source))) {
+		err = in.error;
+		return true;
+	}
 	return false;
 }
 
-shared_ptr<Panel> Panels::Get(int id) const {
-	for (auto it = panels.begin(); it != panels.end(); it++)
-		if ((*it)->id == id)
-			return *it;
-	return nullptr;
+void Grid::Load(void) const {
+	if (lazy == nullptr) return;
+	call_once(lazy->once, [this] {
+		PerfScope perf(PERF_LOAD);
+		//the block was checked when the board was loaded
+		const block_range& b = *lazy->range;
+		Scanner in(b.begin, b.end, b.line, b.line_start);
+		GridLoader loader(in, lazy->source, lazy->components);
+		Grid* self = const_cast<Grid*>(this);
+		loader.Finish(in, loader.Parse(in, self));
+		lazy->loaded = true;
+	});
 }
 
-void Panels::RemoveAll(int id) {
-	for (auto it = panels.begin(); it != panels.end(); )
-		if ((*it)->id == id) {
-			it = panels.erase(it);
-		} else {
-			it++;
-		}
+bool Grid::Loaded(void) const {
+	return lazy == nullptr || lazy->loaded;
 }
 
-bool Panels::Inside(int x, int y, int& ox, int& oy, shared_ptr<Panel>& p) const {
-	for (auto it = panels.rbegin(); it != panels.rend(); it++) {
-		if (!(*it)->IsHidden() && (*it)->Inside(x, y, ox, oy)) {
-			p = *it;
-			return true;
+const Grid& Grid::Peek(unique_ptr<Grid>& temp) const {
+	if (Loaded()) return *this;
+	temp = make_unique<Grid>();
+	temp->lazy = make_shared<lazy_block>(lazy->source, lazy->range, lazy->components);
+	temp->Load();
+	return *temp;
+}
+
+
+// Files
+
+//ostream buffer that compresses through zlib
+class GzipBuf : public streambuf {
+private:
+	gzFile file;
+	char buffer[1 << 16];
+	
+public:
+	GzipBuf(gzFile file) : file(file) {
+		setp(buffer, buffer + sizeof(buffer));
+	}
+	
+protected:
+	int_type overflow(int_type c) override {
+		if (sync() != 0) return traits_type::eof();
+		if (c != traits_type::eof()) {
+			*pptr() = traits_type::to_char_type(c);
+			pbump(1);
 		}
+		return traits_type::not_eof(c);
+	}
+	
+	int sync() override {
+		const int n = static_cast<int>(pptr() - pbase());
+		if (n > 0 && gzwrite(file, pbase(), n) != n) return -1;
+		setp(buffer, buffer + sizeof(buffer));
+		return 0;
+	}
+};
+
+bool CompactPath(const string& path) {
+	return EndsWith(path, ".gz") || EndsWith(path, ".compact.ttsim");
+}
+
+bool SaveGrid(const Grid& g, const string& path) {
+	if (!EndsWith(path, ".gz")) {
+		ofstream out(path);
+		if (!out.is_open()) return true;
+		g.Serialize(out, CompactPath(path));
+		out.close();
+		return out.fail();
+	}
+	
+	gzFile file = gzopen(path.c_str(), "wb6");
+	if (file == nullptr) return true;
+	
+	GzipBuf buffer(file);
+	ostream out(&buffer);
+	g.Serialize(out, true);
+	out.flush();
+	
+	const bool failed = out.fail();
+	return (gzclose(file) != Z_OK) || failed;
+}
+
+bool ReadBoardFile(const string& path, string& text) {
+	//zlib reads uncompressed files as they are
+	gzFile file = gzopen(path.c_str(), "rb");
+	if (file == nullptr) return true;
+	gzbuffer(file, 1 << 17);
+	
+	text.clear();
+	char chunk[1 << 16];
+	int n;
+	while ((n = gzread(file, chunk, sizeof(chunk))) > 0)
+		text.append(chunk, n);
+	gzclose(file);
+	
+	return n < 0;
+}
+
+bool LoadGrid(Grid& g, const string& path, parse_error& err) {
+	PerfScope perf(PERF_LOAD);
+	string text;
+	if (ReadBoardFile(path, text)) {
+		err = {0, 0, "could not read file"};
+		return true;
+	}
+	
+	Scanner in(text.data(), text.data() + text.size());
+	if (g.Deserialize(in)) {
+		err = in.error;
+		return true;
 	}
 	return false;
 }
 
-void Panels::Render(render_info& info) const {
-	for (auto it = panels.begin(); it != panels.end(); it++)
-		(*it)->Render(info);
+//FNV-1a
+uint64_t ContentHash(const string& data) {
+	uint64_t h = 14695981039346656037ull;
+	for (unsigned char c : data) {
+		h ^= c;
+		h *= 1099511628211ull;
+	}
+	return h;
 }
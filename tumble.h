@@ -0,0 +1,64 @@
+/* libtumble: the simulator as a library for other programs, with a C interface.
+ *
+ * A board is loaded once and can be shared by any number of machines, on any
+ * thread. A machine is the state of one run and is used by one thread at a time.
+ * Marbles are fed as bits, 1 for red and 0 for blue, and their outputs are kept
+ * until they are read. Functions returning int return 0 on success. Nothing here
+ * depends on a terminal, link with -ltumble -lz -pthread.
+ */
+
+#ifndef TUMBLE_H
+#define TUMBLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* changes only when the functions below change */
+#define TUMBLE_API_VERSION 1
+
+typedef struct tumble_board tumble_board;
+typedef struct tumble_machine tumble_machine;
+
+typedef struct tumble_error {
+	int line, column; /* 1 based, 0 when the error is not in the text */
+	char message[128];
+} tumble_error;
+
+int tumble_api_version(void);
+
+/* reads the text of a .ttsim file, plain or compact. Returns NULL on error, described in err if it is not NULL */
+tumble_board* tumble_board_load(const char* text, size_t size, tumble_error* err);
+/* reads a board file, gzip compressed if its name ends in .gz */
+tumble_board* tumble_board_load_file(const char* path, tumble_error* err);
+/* the board must outlive its machines */
+void tumble_board_free(tumble_board* board);
+
+tumble_machine* tumble_machine_new(const tumble_board* board);
+void tumble_machine_free(tumble_machine* m);
+/* puts the bits back in their starting states and drops unread outputs */
+void tumble_machine_reset(tumble_machine* m);
+
+/* drops a marble for each bit, each running until it leaves the board, within
+ * max_ticks ticks in total. Returns 1 if they ran out, the remaining bits are not
+ * dropped and the machine should be reset */
+int tumble_machine_feed(tumble_machine* m, const uint8_t* bits, size_t count, uint64_t max_ticks);
+/* output bits not read yet */
+size_t tumble_machine_pending(const tumble_machine* m);
+/* moves up to size output bits to out, oldest first, and returns how many */
+size_t tumble_machine_read(tumble_machine* m, uint8_t* out, size_t size);
+
+/* writes the machine's bits and marbles to buf if size is enough and returns the
+ * size needed. Unread outputs are not included */
+size_t tumble_machine_snapshot(const tumble_machine* m, void* buf, size_t size);
+/* returns 1 if the snapshot is not of this machine's board, the machine is unchanged then */
+int tumble_machine_restore(tumble_machine* m, const void* buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
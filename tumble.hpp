@@ -1,15 +1,31 @@
+#pragma once
+
 #include <iostream>
 #include <fstream>
 #include <cstdint>
 #include <memory>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 #include <functional>
 #include <algorithm>
-#include <ncurses.h>
+#include <string_view>
 
 using namespace std;
 
+//marble and tile colors, with the values ncurses gives the same names so the
+//editor can draw them directly. The simulation itself needs no terminal code
+#ifndef COLOR_BLACK
+#define COLOR_BLACK	0
+#define COLOR_RED	1
+#define COLOR_GREEN	2
+#define COLOR_YELLOW	3
+#define COLOR_BLUE	4
+#define COLOR_MAGENTA	5
+#define COLOR_CYAN	6
+#define COLOR_WHITE	7
+#endif
+
 struct render_info {
 	int w, h; //width and height of output
 	bool color; //whether color is enabled
@@ -21,6 +37,7 @@ struct gfx_char {
 };
 
 bool isOdd(int x, int y);
+bool EndsWith(const string& str, const string& suffix);
 void toWorldCoords(render_info& info, int x, int y, int& wx, int& wy);
 
 //hash used for an int,int pair needed by unordered map
@@ -69,10 +86,91 @@ public:
 };
 
 
+// Parsing
+
+struct parse_error {
+	int line, column; //1 based position of the error
+	string message;
+};
+
+//scanner over an in-memory .ttsim buffer, used like an istream by the tiles
+class Scanner {
+private:
+	const char* pos;
+	const char* end;
+	const char* line_start;
+	int line;
+	bool failed;
+	
+public:
+	parse_error error;
+	
+	//line_start is where begin's line starts, for columns when begin is not at a line start
+	Scanner(const char* begin, const char* end, int line = 1, const char* line_start = nullptr)
+		: pos(begin), end(end), line_start(line_start ? line_start : begin), line(line), failed(false), error{0, 0, ""} {}
+	
+	bool fail() const { return failed; }
+	bool AtEnd() { SkipSpace(); return pos == end; }
+	char Peek() { SkipSpace(); return pos == end ? '\0' : *pos; }
+	int Line() const { return line; }
+	int Column() const { return static_cast<int>(pos - line_start) + 1; }
+	const char* Pos() const { return pos; }
+	const char* End() const { return end; }
+	//continues at p, which is on the given line
+	void Seek(const char* p, int line, const char* line_start) {
+		pos = p, this->line = line, this->line_start = line_start;
+	}
+	
+	void SkipSpace(void) {
+		for (; pos != end; pos++) {
+			if (*pos == '\n') {
+				line++;
+				line_start = pos + 1;
+			} else if (*pos != ' ' && *pos != '\t' && *pos != '\r') {
+				break;
+			}
+		}
+	}
+	
+	//number of lines left in the buffer
+	size_t CountLines(void) const {
+		return count(pos, end, '\n') + 1;
+	}
+	
+	//records the first error only, always returns false
+	bool Fail(const string& message, int line = 0, int column = 0);
+	//consumes c or fails
+	bool Expect(char c);
+	
+	Scanner& operator>>(int64_t& v);
+	Scanner& operator>>(int& v);
+	Scanner& operator>>(short& v);
+	//reads a word made of letters
+	Scanner& operator>>(string_view& v);
+	//reads a component name made of letters, digits, '_' and '-'
+	Scanner& Name(string_view& v);
+};
+
+
 // Tile classes
 
 class Grid; //forward declaration
 
+//identifies tile classes for code that lowers a Grid into other forms
+enum tile_type : uint8_t {
+	TILE_DROP,
+	TILE_OUTPUT_VALUE,
+	TILE_OUTPUT_DIRECTION,
+	TILE_EXIT,
+	TILE_LOOP,
+	TILE_RAMP,
+	TILE_CROSS,
+	TILE_BIT,
+	TILE_GEAR,
+	TILE_GEARBIT,
+	TILE_GRID
+};
+
 struct collision_result {
 	int output; //0,1 or -1 for none
 	bool marble_reset; //set when marble has been reset
@@ -92,6 +190,90 @@ public:
 	}
 };
 
+//statistics of the simulation running on this thread, reset before a run to measure it
+struct sim_counters {
+	uint64_t turns;  //TurnConnected() calls, including those inside nested grids
+	uint64_t flips;  //gear bits flipped by turns
+	int depth;       //RecursiveTile nesting of the current tick
+	int max_depth;   //deepest nesting reached
+	
+	void Reset(void) {
+		turns = flips = 0;
+		depth = max_depth = 0;
+	}
+};
+
+extern thread_local sim_counters sim_stats;
+
+
+// Tile memory
+
+//memory for the tiles of one grid. Blocks are cut from chunks that grow as the grid
+//does and freed blocks are reused by size. The arena counts its grid and its live
+//blocks, the chunks are released together when both are gone. Like the grid it is
+//used by one thread at a time
+class TileArena {
+private:
+	static constexpr size_t granule = alignof(void*); //block sizes are rounded up to this
+	static constexpr size_t max_block = 512;          //bigger blocks use operator new
+	
+	vector<unique_ptr<char[]>> chunks;
+	char* pos = nullptr;
+	char* end = nullptr;
+	size_t chunk_size = 512;
+	void* free_blocks[max_block / granule] = {}; //singly linked through the blocks
+	size_t refs = 1;                             //the grid and every live block
+	
+	TileArena() = default;
+	~TileArena() = default;
+	
+public:
+	TileArena(const TileArena&) = delete;
+	TileArena& operator=(const TileArena&) = delete;
+	
+	//deleter for the grid's reference
+	struct Release {
+		void operator()(TileArena* a) const { if (--a->refs == 0) delete a; }
+	};
+	static unique_ptr<TileArena, Release> Create(void) { return unique_ptr<TileArena, Release>(new TileArena); }
+	
+	void* Allocate(size_t size);
+	void Deallocate(void* p, size_t size);
+};
+
+//allocator for allocate_shared, every block it hands out keeps the arena alive.
+//Without an arena it allocates with operator new
+template<class T>
+class ArenaAllocator {
+private:
+	TileArena* arena = nullptr;
+	
+	template<class U> friend class ArenaAllocator;
+	
+public:
+	typedef T value_type;
+	
+	ArenaAllocator() = default;
+	explicit ArenaAllocator(TileArena* arena) : arena(arena) {}
+	template<class U> ArenaAllocator(const ArenaAllocator<U>& o) : arena(o.arena) {}
+	
+	T* allocate(size_t n) {
+		static_assert(alignof(T) <= alignof(void*), "over-aligned tile");
+		if (arena == nullptr) return static_cast<T*>(::operator new(n * sizeof(T)));
+		return static_cast<T*>(arena->Allocate(n * sizeof(T)));
+	}
+	void deallocate(T* p, size_t n) {
+		if (arena == nullptr) return ::operator delete(p);
+		arena->Deallocate(p, n * sizeof(T));
+	}
+	
+	template<class U> bool operator==(const ArenaAllocator<U>& o) const { return arena == o.arena; }
+	template<class U> bool operator!=(const ArenaAllocator<U>& o) const { return arena != o.arena; }
+};
+
+class BaseTile;
+typedef ArenaAllocator<BaseTile> tile_allocator;
+
 class BaseTile {
 public:
 	//called when simulation starts
@@ -104,23 +286,33 @@ public:
 	virtual bool Turn(collision_result& result) { return false; }
 	//used for tiles that point to a different grid
 	virtual Grid* GetGrid(void) { return nullptr; }
+	virtual const Grid* GetGrid(void) const { return nullptr; }
 	
 	virtual gfx_char GetGraphic(render_info& info) const {
 		return (gfx_char){'?', COLOR_WHITE, COLOR_BLACK};
 	}
 	
-	virtual shared_ptr<BaseTile> Copy() const = 0;
+	virtual tile_type GetType(void) const = 0;
+	//value written after the type when saving, 0 if there is none
+	virtual int GetParameter(void) const { return 0; }
+	//state changed by the simulation, 0 if there is none
+	virtual int GetState(void) const { return 0; }
+	
+	//copies are made with the allocator of the grid they go in
+	virtual shared_ptr<BaseTile> Copy(const tile_allocator& alloc) const = 0;
+	shared_ptr<BaseTile> Copy(void) const { return Copy(tile_allocator()); }
 	virtual void Serialize(ostream& out) const = 0;
-	virtual void Deserialize(istream& in) {}
+	virtual void Deserialize(Scanner& in) {}
 };
 
 typedef shared_ptr<BaseTile> tile;
 
 class DropTile : public BaseTile {
 public:
-	tile Copy(void) const override {
-		return make_shared<DropTile>(*this);
+	tile Copy(const tile_allocator& alloc) const override {
+		return allocate_shared<DropTile>(alloc, *this);
 	}
+	tile_type GetType(void) const override { return TILE_DROP; }
 	void Serialize(ostream& out) const override {
 		out << "Drop\n";
 	}
@@ -137,9 +329,10 @@ public:
 
 class OutputValueTile : public BaseTile {
 public:
-	tile Copy(void) const override {
-		return make_shared<OutputValueTile>(*this);
+	tile Copy(const tile_allocator& alloc) const override {
+		return allocate_shared<OutputValueTile>(alloc, *this);
 	}
+	tile_type GetType(void) const override { return TILE_OUTPUT_VALUE; }
 	void Serialize(ostream& out) const override {
 		out << "OutputValue\n";
 	}
@@ -156,9 +349,10 @@ public:
 
 class OutputDirectionTile : public BaseTile {
 public:
-	tile Copy(void) const override {
-		return make_shared<OutputDirectionTile>(*this);
+	tile Copy(const tile_allocator& alloc) const override {
+		return allocate_shared<OutputDirectionTile>(alloc, *this);
 	}
+	tile_type GetType(void) const override { return TILE_OUTPUT_DIRECTION; }
 	void Serialize(ostream& out) const override {
 		out << "OutputDirection\n";
 	}
@@ -175,9 +369,10 @@ public:
 
 class ExitTile : public BaseTile {
 public:
-	tile Copy(void) const override {
-		return make_shared<ExitTile>(*this);
+	tile Copy(const tile_allocator& alloc) const override {
+		return allocate_shared<ExitTile>(alloc, *this);
 	}
+	tile_type GetType(void) const override { return TILE_EXIT; }
 	void Serialize(ostream& out) const override {
 		out << "Exit\n";
 	}
@@ -204,13 +399,15 @@ protected:
 public:
 	LoopTile() : marble_color(COLOR_BLUE) {}
 	
-	tile Copy(void) const override {
-		return make_shared<LoopTile>(*this);
+	tile Copy(const tile_allocator& alloc) const override {
+		return allocate_shared<LoopTile>(alloc, *this);
 	}
+	tile_type GetType(void) const override { return TILE_LOOP; }
+	int GetParameter(void) const override { return marble_color; }
 	void Serialize(ostream& out) const override {
 		out << "Loop " << marble_color << "\n";
 	}
-	void Deserialize(istream& in) override {
+	void Deserialize(Scanner& in) override {
 		in >> marble_color;
 	}
 	
@@ -241,13 +438,15 @@ protected:
 public:
 	RampTile() : direction(1) {}
 	
-	tile Copy(void) const override {
-		return make_shared<RampTile>(*this);
+	tile Copy(const tile_allocator& alloc) const override {
+		return allocate_shared<RampTile>(alloc, *this);
 	}
+	tile_type GetType(void) const override { return TILE_RAMP; }
+	int GetParameter(void) const override { return direction; }
 	void Serialize(ostream& out) const override {
 		out << "Ramp " << direction << "\n";
 	}
-	void Deserialize(istream& in) override {
+	void Deserialize(Scanner& in) override {
 		in >> direction;
 	}
 	
@@ -266,9 +465,10 @@ public:
 
 class CrossTile : public BaseTile {
 public:
-	tile Copy(void) const override {
-		return make_shared<CrossTile>(*this);
+	tile Copy(const tile_allocator& alloc) const override {
+		return allocate_shared<CrossTile>(alloc, *this);
 	}
+	tile_type GetType(void) const override { return TILE_CROSS; }
 	void Serialize(ostream& out) const override {
 		out << "Cross\n";
 	}
@@ -285,18 +485,20 @@ protected:
 public:
 	BitTile() : current_dir(1) {}
 	
-	tile Copy(void) const override {
-		return make_shared<BitTile>(*this);
+	tile Copy(const tile_allocator& alloc) const override {
+		return allocate_shared<BitTile>(alloc, *this);
 	}
+	tile_type GetType(void) const override { return TILE_BIT; }
 	void Serialize(ostream& out) const override {
 		out << "Bit " << direction << "\n";
 	}
-	void Deserialize(istream& in) override {
+	void Deserialize(Scanner& in) override {
 		in >> direction;
 		current_dir = direction;
 	}
 	
 	void Reset(void) override { current_dir = direction; }
+	int GetState(void) const override { return current_dir; }
 	
 	void Interract(void) override { direction = -direction, current_dir = direction; }
 	
@@ -314,9 +516,10 @@ public:
 
 class GearTile : public BaseTile {
 public:
-	tile Copy(void) const override {
-		return make_shared<GearTile>(*this);
+	tile Copy(const tile_allocator& alloc) const override {
+		return allocate_shared<GearTile>(alloc, *this);
 	}
+	tile_type GetType(void) const override { return TILE_GEAR; }
 	void Serialize(ostream& out) const override {
 		out << "Gear\n";
 	}
@@ -336,19 +539,21 @@ public:
 
 class GearBitTile : public BitTile {
 public:
-	tile Copy(void) const override {
-		return make_shared<GearBitTile>(*this);
+	tile Copy(const tile_allocator& alloc) const override {
+		return allocate_shared<GearBitTile>(alloc, *this);
 	}
+	tile_type GetType(void) const override { return TILE_GEARBIT; }
 	void Serialize(ostream& out) const override {
 		out << "GearBit " << direction << "\n";
 	}
-	void Deserialize(istream& in) override {
+	void Deserialize(Scanner& in) override {
 		in >> direction;
 		current_dir = direction;
 	}
 	
 	bool Turn(collision_result& result) override {
 		current_dir = -current_dir;
+		sim_stats.flips++;
 		return true;
 	}
 	
@@ -368,16 +573,48 @@ public:
 
 // Grid class
 
+//position of a nested grid, as the tiles entered from the root grid
+typedef vector<pair<int, int>> grid_path;
+
+enum grid_edit_type : uint8_t {
+	GRID_EDIT_ADD,      //AddTile(), which may have replaced a tile
+	GRID_EDIT_REMOVE,
+	GRID_EDIT_INTERRACT
+};
+
+//a change to one cell of a grid
+struct grid_edit {
+	grid_edit_type type;
+	int x, y;
+};
+
+struct lazy_block;  //contents of a nested grid not read yet, see Grid::DeserializeLazy()
+struct load_source; //the buffer a board is loaded from, see tumble.cpp
+
 class Grid {
 private:
 	//sparse set of tiles
 	unordered_map<pair<int, int>, tile, IntPairHash> tiles;
+	//where this grid's tiles are allocated, replaced when all tiles are cleared
+	unique_ptr<TileArena, TileArena::Release> arena;
+	//set on nested grids whose contents are still in the loaded text, read by Load()
+	shared_ptr<lazy_block> lazy;
+	
+	friend class GridLoader;
+	bool Deserialize(Scanner& in, shared_ptr<load_source> source);
+	bool Read(Scanner& in, shared_ptr<load_source> source);
 	
 	//recursive function used by TurnConnected()
 	void TurnConnected(unordered_set<pair<int, int>, IntPairHash>& v, int x, int y, collision_result& result);
+	//nested grids more than one tile refers to, in the order Serialize() writes them
+	vector<const Grid*> Components(void) const;
 	
 public:
 	Marble marble;
+	//called after AddTile(), RemoveTile() and Interract() change this grid, so forms
+	//prepared from it can be patched instead of rebuilt. Loading does not call it, and
+	//copies of the grid do not keep it
+	function<void(const Grid& g, const grid_edit& e)> on_edit;
 	
 	//tile functions
 	void AddTile(int x, int y, tile t);
@@ -386,10 +623,20 @@ public:
 	void Interract(int x, int y);
 	void TurnConnected(int x, int y, collision_result& result);
 	
+	//tiles for this grid should be created with its allocator
+	tile_allocator Allocator(void) const { return tile_allocator(arena.get()); }
+	template<class T, class... Args>
+	tile NewTile(Args&&... args) const { return allocate_shared<T>(Allocator(), forward<Args>(args)...); }
+	
 	//constructors
-	Grid() {
-		AddTile(0, 0, make_shared<DropTile>());
+	Grid() : arena(TileArena::Create()) {
+		AddTile(0, 0, NewTile<DropTile>());
 	}
+	//copies are deep, every tile is duplicated
+	Grid(const Grid& other);
+	Grid& operator=(const Grid& other);
+	Grid(Grid&& other) = default;
+	Grid& operator=(Grid&& other) = default;
 	
 	//marble functions
 	void AddMarble(int direction = -1, short color = COLOR_BLUE);
@@ -397,36 +644,74 @@ public:
 	bool Update(collision_result& result, bool root = true);
 	//called when simulation finishes, call manually to stop
 	void Reset();
-	
-	//render function
+	//drops one marble and runs it until it leaves the board, ticks is the remaining budget.
+	//Returns false if the budget ran out
+	bool Drop(bool value, vector<bool>& output, uint64_t& ticks);
+	//runs a whole simulation without rendering, same as pressing Enter in the editor
+	//returns false if max_ticks was reached before the last marble finished
+	bool Run(const vector<bool>& input, vector<bool>& output, uint64_t max_ticks = 10000000);
+	
+	//draws the grid on the terminal, defined in gui.cpp with the rest of the editor's drawing
 	void Render(render_info& info, int x, int y, bool blink = true, int mx = -1, int my = -1, short blink_color = COLOR_YELLOW+8) const;
 	
-	//for saving/loading
-	void Serialize(ostream& out) const;
-	bool Deserialize(istream& in);
+	//tiles sorted by row then column
+	vector<pair<pair<int, int>, const BaseTile*>> SortedTiles(void) const;
+	
+	//for saving/loading, Deserialize returns true on error
+	//tiles are written sorted by row then column so equal boards give equal files
+	//compact output uses delta coded positions and run lengths for repeated tiles in a row
+	//of at most max_run tiles, longer rows are split into several runs
+	//nested grids shared by several tiles are written once as components. Loading
+	//shares components and nested grids whose blocks have the same text
+	static constexpr int max_run = 1 << 16;
+	void Serialize(ostream& out, bool compact = false) const;
+	bool Deserialize(istream& in, parse_error* err = nullptr);
+	bool Deserialize(Scanner& in);
+	
+	//like Deserialize(), but big nested blocks are only checked and their grids are read
+	//the first time they are used. The text is kept as long as grids loaded from it are
+	bool DeserializeLazy(string&& text, parse_error& err);
+	//reads contents left in the text, several threads may load one grid at once
+	void Load(void) const;
+	bool Loaded(void) const;
+	//the contents without loading them: a grid not read yet is read into temp, which is not kept
+	const Grid& Peek(unique_ptr<Grid>& temp) const;
 };
 
 
 //recursive tile depends on grid
+//the grid is copy on write: tiles may share one as long as none of them changes it,
+//so a shared grid is always as it was loaded. Only the const GetGrid() and Contents()
+//leave it shared. A grid not read yet counts as shared, it is loaded when first used
 class RecursiveTile : public BaseTile {
 protected:
-	Grid grid;
+	shared_ptr<Grid> grid;
 	short color;
 	bool active;
 	
+	//the grid, copied first if other tiles share it
+	Grid& Own(void);
+	
 public:
-	RecursiveTile(void) : color(COLOR_YELLOW+8), active(false) {}
+	RecursiveTile(void) : grid(make_shared<Grid>()), color(COLOR_YELLOW+8), active(false) {}
 	
-	void Reset(void) override {
-		grid.Reset();
-		active = false;
-	}
+	void Reset(void) override;
+	
+	//shares the grid if it is shared already, anything else may be changed through a
+	//Grid* handed out before and is copied
+	tile Copy(const tile_allocator& alloc) const override;
+	tile_type GetType(void) const override { return TILE_GRID; }
+	int GetParameter(void) const override { return color; }
 	
-	tile Copy(void) const override {
-		return make_shared<RecursiveTile>(*this);
+	Grid* GetGrid(void) override { return &Own(); }
+	const Grid* GetGrid(void) const override {
+		grid->Load();
+		return grid.get();
 	}
 	
-	Grid* GetGrid(void) { return &grid; }
+	//for the loader and Serialize(), which fill and share grids without loading them
+	const shared_ptr<Grid>& Contents(void) const { return grid; }
+	void SetContents(shared_ptr<Grid> g) { grid = move(g); }
 	
 	void Interract(void) override {
 		if (++color >= 16) color = 8;
@@ -439,114 +724,19 @@ public:
 	//these functions are in tumble.cpp
 	bool Collide(Marble& m, collision_result& result) override;
 	bool Turn(collision_result& result) override;
+	//only writes the type and color, the block or component is written by Grid::Serialize
 	void Serialize(ostream& out) const override;
-	void Deserialize(istream& in) override;
+	void Deserialize(Scanner& in) override;
 };
 
 
-// GUI
-
-struct draw_params {
-public:
-	int attr;
-	short color;
-	
-	draw_params() : attr(0), color(COLOR_WHITE) {}
-	
-	void SetColor(short clr) { color = clr; }
-	
-	void SetBold(bool v = true) {
-		attr &= ~(A_BOLD);
-		attr |= (v ? A_BOLD : 0);
-	}
-	void SetUnderline(bool v = true) {
-		attr &= ~(A_UNDERLINE);
-		attr |= (v ? A_UNDERLINE : 0);
-	}
-	void SetDim(bool v = true) {
-		attr &= ~(A_DIM);
-		attr |= (v ? A_DIM : 0);
-	}
-	
-	draw_params(short clr, bool bold = false, bool underline = false, bool dim = false) : color(clr) {
-		SetBold(bold);
-		SetUnderline(underline);
-		SetDim(dim);
-	}
-};
-
-void DrawChar(gfx_char c, int x, int y, bool color = false);
-void DrawString(string& str, int x, int y, draw_params& p, bool color = false);
-void DrawBox(int x1, int y1, int x2, int y2);
-
-class Panel {
-private:
-	int x, y;
-	int w, h;
-	bool hide;
-	
-	vector<tuple<int, int, string, draw_params>> str;
-	
-	//callback functions
-	typedef function<gfx_char(render_info&, int, int)> charFunction;
-	typedef function<void(Panel&, render_info&, int, int, int, int)> renderFunction;
-	
-	//return '\0' for nothing
-	charFunction charFunc;
-	renderFunction renderFunc;
-	
-public:
-	const int id;
-	
-	Panel(int id = -1, int x = 0, int y = 0, int w = 1, int h = 1)
-		: id(id), x(x), y(y), w(w), h(h), hide(false) {}
-	
-	void Resize(int w, int h) { this->w = w, this->h = h; }
-	void Fit(int w, int h) {
-		if (this->w < w) this->w = w;
-		if (this->h < h) this->h = h;
-	}
-	void Move(int x, int y) { this->x = x, this->y = y; }
-	void Hide(void) { hide = true; }
-	void Show(void) { hide = false; }
-	bool IsHidden(void) const { return hide; }
-	
-	void AddString(int x, int y, string s, draw_params p = draw_params());
-	void EditString(int index, string s);
-	
-	void SetCharacterCallback(charFunction cf) { charFunc = cf; }
-	void SetRenderCallback(renderFunction rf) { renderFunc = rf; }
-	
-	//convenience constructors
-	
-	Panel(string str, int id = -1, int x = 0, int y = 0) : Panel(id, x, y, str.length(), 1) {
-		AddString(0, 0, str);
-	}
-	
-	//if panel is touched, returns true and sets offset. Border returns an offset of (-1,-1)
-	bool Inside(int x, int y, int& ox, int& oy) const;
-	
-	void Render(render_info& info);
-};
-
-class Panels {
-private:
-	vector<shared_ptr<Panel>> panels;
-	
-public:
-	Panels() = default;
-	
-	void Add(shared_ptr<Panel> p) {
-		panels.push_back(p);
-	}
-	void Remove(shared_ptr<Panel> p) {
-		panels.erase(remove(panels.begin(), panels.end(), p), panels.end());
-	}
-	void RemoveAll(int id);
-	
-	shared_ptr<Panel> Get(int id) const;
-	
-	bool Inside(int x, int y, int& ox, int& oy, shared_ptr<Panel>& p) const;
-	
-	void Render(render_info& info) const;
-};
+//file helpers, paths ending in .gz are written compact and gzip compressed, paths
+//ending in .compact.ttsim compact only. Both are detected when loading. Both return
+//true on error
+bool CompactPath(const string& path);
+bool SaveGrid(const Grid& g, const string& path);
+bool LoadGrid(Grid& g, const string& path, parse_error& err);
+//reads a whole board file, decompressing if needed
+bool ReadBoardFile(const string& path, string& text);
+//hash of a board's text, used to identify boards
+uint64_t ContentHash(const string& data);